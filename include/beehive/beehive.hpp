@@ -2,13 +2,72 @@
 #define BEEHIVE_BEHAVIOR_TREE_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <functional>
+#include <iomanip>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+/*!
+ \brief Bytes of inline storage available to each node's process function.
+
+    Define before including beehive.hpp to change it. See #beehive::InlineFunction.
+*/
+#ifndef BEEHIVE_FUNCTION_CAPACITY
+#define BEEHIVE_FUNCTION_CAPACITY (4 * sizeof(void *))
+#endif
+
+/*!
+ \brief Define to 1 to let node process functions that do not fit inline be
+    allocated on the heap instead of failing to compile.
+*/
+#ifndef BEEHIVE_FUNCTION_ALLOW_HEAP
+#define BEEHIVE_FUNCTION_ALLOW_HEAP 0
+#endif
+
+/*!
+ \brief 1 if coroutine leaves are available. See #beehive::BuilderBase::action.
+
+    Defaults to 1 when compiling as C++20 with coroutine support. Define to 0
+    before including beehive.hpp to turn them off.
+*/
+#ifndef BEEHIVE_COROUTINES
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define BEEHIVE_COROUTINES 1
+#endif
+#endif
+#endif
+#ifndef BEEHIVE_COROUTINES
+#define BEEHIVE_COROUTINES 0
+#endif
+
+#if BEEHIVE_COROUTINES
+#include <coroutine>
+#endif
+
 /*!
  \file beehive.hpp
 */
@@ -26,202 +85,6273 @@ enum class Status
     SUCCESS //!< Returns when the process has succeeded.
 };
 
-struct TreeState {
-    size_t resume_index{};
-    size_t offset{};
-private:
-    TreeState(size_t tree_id): _tree_id(tree_id) {}
-    
-    size_t _tree_id; 
+/*!
+ \brief A non-owning view of a contiguous array, standing in for C++20's std::span.
+*/
+template<typename T>
+class Span
+{
+public:
+    Span() = default; //!< Constructs an empty span.
 
-    template<typename C, typename A>
-    friend class Tree;
+    /*!
+     \brief Views `size` elements starting at `data`.
+    */
+    Span(T *data, size_t size)
+        : _data(data)
+        , _size(size)
+    {}
+
+    /*!
+     \brief Views the elements of a built-in array.
+    */
+    template<size_t N>
+    Span(T (&array)[N])
+        : Span(array, N)
+    {}
+
+    /*!
+     \brief Views the elements of a contiguous container, such as std::vector or std::array.
+    */
+    template<
+        typename Container,
+        typename = typename std::enable_if<
+            std::is_convertible<decltype(std::declval<Container &>().data()), T *>::value
+        >::type
+    >
+    Span(Container &container)
+        : Span(container.data(), container.size())
+    {}
+
+    T *data() const { return _data; } //!< Returns a pointer to the first element.
+    size_t size() const { return _size; } //!< Returns the number of elements.
+    bool empty() const { return _size == 0; } //!< Returns true if there are no elements.
+    T *begin() const { return _data; } //!< Returns an iterator to the first element.
+    T *end() const { return _data + _size; } //!< Returns an iterator past the last element.
+
+    /*!
+     \brief Returns the element at the given index.
+    */
+    T &operator[](size_t index) const
+    {
+        assert(index < _size); // out of range!
+        return _data[index];
+    }
+
+    /*!
+     \brief Returns a view of `count` elements starting at `offset`.
+    */
+    Span subspan(size_t offset, size_t count) const
+    {
+        assert(offset + count <= _size); // out of range!
+        return {_data + offset, count};
+    }
+
+private:
+    T *_data{};
+    size_t _size{};
 };
 
 /*!
- \brief A handle on a process function. This should not be built directly, see #beehive::Builder.
+ \brief A fixed set of worker threads that split ranges of work between them,
+    stealing from each other when they run out.
+
+    See #beehive::Tree::process_batch for ticking entities on a pool.
 */
-template<typename C>
-struct Node
+class ThreadPool
 {
-    using ProcessFunction = std::function<Status(C &context, Node const &self, TreeState &state)>;
+public:
+    static constexpr size_t default_grain_size = 256; //!< Items per chunk unless told otherwise.
 
-    Node(ProcessFunction process): _process(move(process)) {}
+    /*!
+     \brief Creates a pool that runs work on `thread_count` threads, one of which is
+        always the thread calling parallel_for().
+    */
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency());
 
-    Status process(C &context, TreeState &state) const
+    ThreadPool(ThreadPool const &) = delete; //!< Deleted copy constructor.
+    ThreadPool &operator=(ThreadPool const &) = delete; //!< Deleted copy assignment operator.
+
+    /*!
+     \brief Stops and joins the worker threads.
+    */
+    ~ThreadPool();
+
+    /*!
+     \brief Returns the number of threads work is spread over, including the caller's.
+    */
+    size_t thread_count() const
     {
-        return _process(context, *this, state);
+        return _queue_count;
     }
 
-    size_t child_count() const {
-        return _child_count;
+    /*!
+     \brief Calls `body(begin, end)` on disjoint ranges covering [0, count) and
+        returns once all of them are done.
+
+        The range is cut into chunks of `grain_size` items. Each thread starts on its
+        own contiguous share of the chunks and steals single chunks from the others
+        once its share is done. `body` must be safe to call concurrently. If it
+        throws, the first exception is rethrown here after the remaining chunks
+        finish. Calls from inside a body, or from several threads at once, are
+        serialized.
+    */
+    template<typename F>
+    void parallel_for(size_t count, size_t grain_size, F &&body);
+
+private:
+    // Padded rather than aligned, since new[] ignores extended alignment
+    // before C++17. Chunks 64 bytes apart never share a cache line anyway.
+    struct Queue
+    {
+        // Chunk indices [begin, end) packed as end << 32 | begin. The owner takes
+        // from the front and thieves from the back, both with a compare-exchange.
+        std::atomic<uint64_t> chunks{};
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    using Body = void(*)(void *body, size_t begin, size_t end);
+
+    template<typename F>
+    static void call_body(void *body, size_t begin, size_t end)
+    {
+        (*static_cast<F *>(body))(begin, end);
     }
-    
-    size_t descendent_count() const {
-        auto count = _child_count;
-        auto *child = first_child();
-        for (size_t i = 0; i < _child_count; ++i) {
-            count += child->descendent_count();
-            child = child->next_sibling();
+
+    static ThreadPool *&current()
+    {
+        thread_local ThreadPool *pool{};
+        return pool;
+    }
+
+    void work(size_t queue);
+    void run(size_t queue);
+    bool take(size_t queue, bool front, uint64_t &chunk);
+
+    size_t _queue_count{};
+    std::unique_ptr<Queue[]> _queues;
+    std::vector<std::thread> _threads;
+
+    std::mutex _submit_mutex;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    size_t _generation{};
+    size_t _active{};
+    bool _stopping{};
+    std::exception_ptr _error;
+
+    Body _body{};
+    void *_body_data{};
+    size_t _count{};
+    size_t _grain_size{};
+};
+
+inline ThreadPool::ThreadPool(size_t thread_count)
+    : _queue_count(std::max<size_t>(thread_count, 1))
+    , _queues(new Queue[_queue_count])
+{
+    // The last queue belongs to the thread calling parallel_for().
+    for (size_t i = 0; i + 1 < _queue_count; ++i) {
+        _threads.emplace_back([this, i] { work(i); });
+    }
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    for (auto &thread : _threads) {
+        thread.join();
+    }
+}
+
+template<typename F>
+void ThreadPool::parallel_for(size_t count, size_t grain_size, F &&body)
+{
+    if (count == 0) {
+        return;
+    }
+    grain_size = std::max<size_t>(grain_size, 1);
+    auto const chunk_count = (count + grain_size - 1) / grain_size;
+    assert(chunk_count <= UINT32_MAX); // grain size too small!
+    if (_queue_count == 1 || chunk_count == 1 || current() == this) {
+        for (size_t begin = 0; begin < count; begin += grain_size) {
+            body(begin, std::min(begin + grain_size, count));
         }
-        return count;
+        return;
     }
-    
-    void add_child() {
-        ++_child_count;
+
+    std::lock_guard<std::mutex> submit(_submit_mutex);
+    for (size_t i = 0; i < _queue_count; ++i) {
+        uint64_t const begin = chunk_count * i / _queue_count;
+        uint64_t const end = chunk_count * (i + 1) / _queue_count;
+        _queues[i].chunks.store(end << 32 | begin, std::memory_order_relaxed);
+    }
+    using Body = typename std::remove_reference<F>::type;
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _body = &call_body<Body>;
+        _body_data = const_cast<void *>(static_cast<void const *>(std::addressof(body)));
+        _count = count;
+        _grain_size = grain_size;
+        _error = nullptr;
+        _active = _threads.size();
+        ++_generation;
     }
+    _wake.notify_all();
 
-    Node const *first_child() const {
-        if (_child_count == 0) {
-            return nullptr;
+    auto *previous = current();
+    current() = this;
+    run(_queue_count - 1);
+    current() = previous;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _active == 0; });
+        error = _error;
+        _error = nullptr;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+inline void ThreadPool::work(size_t queue)
+{
+    current() = this;
+    size_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this, seen] { return _stopping || _generation != seen; });
+            if (_stopping) {
+                return;
+            }
+            seen = _generation;
+        }
+        run(queue);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (--_active == 0) {
+                _done.notify_one();
+            }
         }
-        return this + 1;
     }
-    
-    Node const *next_sibling() const {
-        return this + descendent_count() + 1;
+}
+
+inline void ThreadPool::run(size_t queue)
+{
+    uint64_t chunk;
+    for (;;) {
+        bool found = take(queue, true, chunk);
+        for (size_t i = 1; !found && i < _queue_count; ++i) {
+            found = take((queue + i) % _queue_count, false, chunk);
+        }
+        if (!found) {
+            return; // nothing left anywhere, and nothing new gets added
+        }
+        auto const begin = chunk * _grain_size;
+        auto const end = std::min(begin + _grain_size, _count);
+        try {
+            _body(_body_data, begin, end);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error) {
+                _error = std::current_exception();
+            }
+        }
     }
-    
-    size_t index() const {
-        return _index;
+}
+
+inline bool ThreadPool::take(size_t queue, bool front, uint64_t &chunk)
+{
+    auto &chunks = _queues[queue].chunks;
+    auto range = chunks.load(std::memory_order_relaxed);
+    for (;;) {
+        auto const begin = range & UINT32_MAX;
+        auto const end = range >> 32;
+        if (begin >= end) {
+            return false;
+        }
+        auto const next = front ? (end << 32 | (begin + 1)) : ((end - 1) << 32 | begin);
+        if (chunks.compare_exchange_weak(range, next, std::memory_order_relaxed)) {
+            chunk = front ? begin : end - 1;
+            return true;
+        }
+    }
+}
+
+/// @cond
+namespace detail
+{
+
+enum class Opcode : uint8_t; // see below
+
+// The suspended coroutines of a state's action leaves, by slot. Only their
+// addresses are kept, so that the state's layout doesn't depend on whether
+// coroutines are enabled. Copies start without any, so a copied state starts
+// its actions over.
+class ActionFrames
+{
+public:
+    ActionFrames() = default;
+
+    ActionFrames(ActionFrames const &) {}
+
+    ActionFrames(ActionFrames &&other) noexcept
+        : _frames(std::move(other._frames))
+    {
+        other._frames.clear();
+    }
+
+    ActionFrames &operator=(ActionFrames const &other)
+    {
+        if (this != &other) {
+            clear();
+        }
+        return *this;
+    }
+
+    ActionFrames &operator=(ActionFrames &&other) noexcept
+    {
+        if (this != &other) {
+            clear();
+            _frames.swap(other._frames);
+        }
+        return *this;
+    }
+
+    ~ActionFrames()
+    {
+        clear();
+    }
+
+    void *get(size_t slot) const
+    {
+        return slot < _frames.size() ? _frames[slot].address : nullptr;
+    }
+
+    void set(size_t slot, size_t slot_count, void *address, void (*destroy)(void *))
+    {
+        if (_frames.size() < slot_count) {
+            _frames.resize(slot_count);
+        }
+        _frames[slot] = {address, destroy};
+    }
+
+    // Forgets the frame without destroying it, once it has finished.
+    void release(size_t slot)
+    {
+        if (slot < _frames.size()) {
+            _frames[slot] = {};
+        }
+    }
+
+    void destroy(size_t slot)
+    {
+        auto &frame = _frames[slot];
+        if (frame.address != nullptr) {
+            frame.destroy(frame.address);
+            frame = {};
+        }
     }
 
 private:
-    template<typename Context, typename A>
-    friend class Tree;
-    
-    size_t _index{};
-    size_t _child_count{};
-    ProcessFunction _process;
+    struct Frame
+    {
+        void *address;
+        void (*destroy)(void *);
+    };
+
+    void clear()
+    {
+        for (size_t slot = 0; slot < _frames.size(); ++slot) {
+            destroy(slot);
+        }
+        _frames.clear();
+    }
+
+    std::vector<Frame> _frames;
 };
 
-template<typename C>
-using Generator = std::function<Node<C> const *()>;
+// What the async leaves of one state wait for, by slot. Each operation started
+// gets a new ticket, so the completion of an abandoned operation is ignored.
+struct AsyncInbox
+{
+    struct Result
+    {
+        uint32_t ticket;
+        Status status;
+        bool delivered;
+    };
 
-/*!
- \brief Composites define how to run the process() function on the child range.
- 
-   The generator function returns the next child in the child array or nullptr after the
-   end of the child array. If the previous call to process() returned RUNNING status,
-   the first result of the generator will be the same child as was returned when the
-   previous called returned the RUNNING status. This allows composites to resume
-   where they left off.
-   
-   The child pointer returned is only valid within the scope of the composite function
-   body.
-*/
-template<typename C>
-using Composite = std::function<Status(C &, Generator<C> const &, TreeState &)>;
+    explicit AsyncInbox(size_t slot_count)
+        : results(slot_count)
+    {}
 
-/*!
- \brief Composite that returns success if all children return success.
-*/
-template<typename C>
-Status sequence(C &context, Generator<C> const &next_child, TreeState &state)
+    std::vector<Result> results;
+    uint32_t next_ticket{};
+    size_t delivered{}; // results not yet returned by their leaves
+};
+
+// A state's inbox, made when its first async leaf starts. Copies start without
+// one, like ActionFrames, so a copied state starts its async leaves over.
+class AsyncInboxRef
 {
-    while (auto const *child = next_child())
+public:
+    AsyncInboxRef() = default;
+
+    AsyncInboxRef(AsyncInboxRef const &) {}
+
+    AsyncInboxRef(AsyncInboxRef &&) noexcept = default;
+
+    AsyncInboxRef &operator=(AsyncInboxRef const &other)
     {
-        auto status = child->process(context, state);
-        if (status != Status::SUCCESS)
-        {
-            return status;
+        if (this != &other) {
+            _inbox.reset();
         }
+        return *this;
     }
-    return Status::SUCCESS;
-}
+
+    AsyncInboxRef &operator=(AsyncInboxRef &&) noexcept = default;
+
+    std::shared_ptr<AsyncInbox> const &get(size_t slot_count)
+    {
+        if (!_inbox) {
+            _inbox = std::make_shared<AsyncInbox>(slot_count);
+        } else if (_inbox->results.size() < slot_count) {
+            _inbox->results.resize(slot_count); // migrated to a tree with more slots
+        }
+        return _inbox;
+    }
+
+    bool delivered() const
+    {
+        return _inbox && _inbox->delivered > 0;
+    }
+
+private:
+    std::shared_ptr<AsyncInbox> _inbox;
+};
+
+// A finished operation on its way through an AsyncQueue.
+struct AsyncCompletion
+{
+    std::shared_ptr<AsyncInbox> inbox;
+    size_t slot;
+    uint32_t ticket;
+    Status status;
+    AsyncCompletion *next;
+};
+
+} // namespace detail
+/// @endcond
+
+class AsyncCallback;
 
 /*!
- \brief Composite that returns success on the first successful call.
+ \brief Carries the results of #beehive::BuilderBase::async_leaf operations from
+    the threads finishing them to the thread ticking the tree.
+
+    Any number of threads may finish operations at once without taking a lock.
+    One thread drains the queue, either with drain() or through
+    #beehive::Tree::process_batch with the queue. The queue must outlive every
+    #beehive::AsyncCallback given out for it.
 */
-template<typename C>
-Status selector(C &context, Generator<C> const &next_child, TreeState &state)
+class AsyncQueue
 {
-    while (auto const *child = next_child())
+public:
+    AsyncQueue() = default;
+
+    AsyncQueue(AsyncQueue const &) = delete;
+    AsyncQueue &operator=(AsyncQueue const &) = delete;
+
+    ~AsyncQueue()
     {
-        auto status = child->process(context, state);
-        if (status != Status::FAILURE)
+        drain();
+    }
+
+    /*!
+     \brief Hands the results finished so far to the states waiting for them, and
+        returns how many were woken up.
+
+        Must not run while the waiting states are being ticked, nor on two
+        threads at once.
+    */
+    size_t drain()
+    {
+        // Completions are pushed newest first; deliver them in order.
+        auto *completion = _head.exchange(nullptr, std::memory_order_acquire);
+        detail::AsyncCompletion *oldest = nullptr;
+        while (completion != nullptr) {
+            auto *const next = completion->next;
+            completion->next = oldest;
+            oldest = completion;
+            completion = next;
+        }
+        size_t woken = 0;
+        while (oldest != nullptr) {
+            std::unique_ptr<detail::AsyncCompletion> finished{oldest};
+            oldest = finished->next;
+            auto &inbox = *finished->inbox;
+            auto &result = inbox.results[finished->slot];
+            if (result.ticket == finished->ticket && !result.delivered) {
+                result.status = finished->status;
+                result.delivered = true;
+                ++inbox.delivered;
+                ++woken;
+            }
+        }
+        return woken;
+    }
+
+private:
+    friend class AsyncCallback;
+
+    void push(detail::AsyncCompletion *completion)
+    {
+        completion->next = _head.load(std::memory_order_relaxed);
+        while (!_head.compare_exchange_weak(completion->next, completion, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::atomic<detail::AsyncCompletion *> _head{};
+};
+
+/*!
+ \brief Finishes the operation started by a #beehive::BuilderBase::async_leaf,
+    from any thread.
+
+    Copies finish the same operation, and only the first call counts. If every
+    copy is destroyed without being called, the operation fails.
+*/
+class AsyncCallback
+{
+public:
+    /*!
+     \brief Finishes the operation with SUCCESS or FAILURE.
+    */
+    void operator()(Status status) const
+    {
+        assert(status != Status::RUNNING); // an operation must finish!
+        _pending->finish(status);
+    }
+
+    /*!
+     \brief Finishes the operation with SUCCESS if `success` is true, otherwise FAILURE.
+    */
+    void operator()(bool success) const
+    {
+        _pending->finish(success ? Status::SUCCESS : Status::FAILURE);
+    }
+
+private:
+    template<typename C, typename F>
+    friend struct AsyncProcess;
+
+    struct Pending
+    {
+        ~Pending()
         {
-            return status;
+            finish(Status::FAILURE);
         }
+
+        void finish(Status status)
+        {
+            if (auto *const finished = completion.exchange(nullptr, std::memory_order_acq_rel)) {
+                finished->status = status;
+                queue->push(finished);
+            }
+        }
+
+        AsyncQueue *queue;
+        std::atomic<detail::AsyncCompletion *> completion;
+    };
+
+    AsyncCallback(AsyncQueue &queue, std::unique_ptr<detail::AsyncCompletion> completion)
+        : _pending(std::make_shared<Pending>())
+    {
+        _pending->queue = &queue;
+        _pending->completion = completion.release();
     }
-    return Status::FAILURE;
+
+    std::shared_ptr<Pending> _pending;
+};
+
+/*!
+ \brief A limit on how many nodes, or how much time, budgeted ticks may use.
+    See #beehive::Tree::process_budgeted.
+
+    Once the budget is spent, the next node to start returns RUNNING instead of
+    running, and the tick continues from that node next time. A node that has
+    started always finishes, so a time limit can be overrun by the slowest node.
+    One budget can be shared by the ticks of many entities in the same frame.
+*/
+class Budget
+{
+public:
+    using Clock = std::chrono::steady_clock; //!< The clock time limits are measured with.
+
+    /*!
+     \brief Allows `node_count` nodes to start.
+    */
+    explicit Budget(size_t node_count)
+        : _nodes_left(node_count)
+    {}
+
+    /*!
+     \brief Allows nodes to start until `limit` from now.
+    */
+    explicit Budget(Clock::duration limit)
+        : _deadline(Clock::now() + limit)
+        , _timed(true)
+    {}
+
+    /*!
+     \brief Allows nodes to start until either limit is reached.
+    */
+    Budget(size_t node_count, Clock::duration limit)
+        : _nodes_left(node_count)
+        , _deadline(Clock::now() + limit)
+        , _timed(true)
+    {}
+
+    /*!
+     \brief Returns whether a node had to stop because the budget was spent.
+    */
+    bool exhausted() const
+    {
+        return _exhausted;
+    }
+
+    /*!
+     \brief Returns the number of nodes started within the budget.
+    */
+    size_t nodes_processed() const
+    {
+        return _nodes_processed;
+    }
+
+private:
+    template<typename C>
+    friend struct Node;
+
+    bool spend()
+    {
+        if (_exhausted || _nodes_left == 0 || (_timed && Clock::now() >= _deadline)) {
+            _exhausted = true;
+            return false;
+        }
+        --_nodes_left;
+        ++_nodes_processed;
+        return true;
+    }
+
+    size_t _nodes_left{SIZE_MAX};
+    Clock::time_point _deadline{};
+    bool _timed{};
+    bool _exhausted{};
+    size_t _nodes_processed{};
+};
+
+/*!
+ \brief Reads the current time for the timed decorators, like
+    #beehive::BuilderBase::cooldown. The default is `std::chrono::steady_clock::now`;
+    pass another function to run them on simulation time.
+*/
+using TimeSource = std::chrono::steady_clock::time_point (*)();
+
+/*!
+ \brief A node returning during a traced tick. See #beehive::Tracer.
+*/
+struct TraceEvent
+{
+    uint32_t tick; //!< The entity's tick, counting process() calls with its state.
+    uint32_t node; //!< The #beehive::Node::index of the node that returned.
+    Status status; //!< What the node returned.
+};
+
+/*!
+ \brief A fixed-size ring of one entity's trace events, written by the thread
+    ticking the entity and drained by another. See #beehive::Tracer.
+
+    Writing and draining take no lock. A full buffer drops new events, counting
+    them, so drain it often enough to keep up.
+*/
+class TraceBuffer
+{
+public:
+    /*!
+     \brief Makes room for at least `capacity` events, rounded up to a power of two.
+    */
+    explicit TraceBuffer(size_t capacity)
+    {
+        assert(capacity > 0); // a buffer must hold something!
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        _events.reset(new TraceEvent[size]);
+        _mask = size - 1;
+    }
+
+    TraceBuffer(TraceBuffer const &) = delete;
+    TraceBuffer &operator=(TraceBuffer const &) = delete;
+
+    /*!
+     \brief Returns the number of events the buffer holds when full.
+    */
+    size_t capacity() const
+    {
+        return _mask + 1;
+    }
+
+    /*!
+     \brief Moves the oldest events, as many as fit, into `events` and returns how
+        many were moved.
+
+        Only one thread may drain a buffer at a time.
+    */
+    size_t drain(Span<TraceEvent> events)
+    {
+        auto const tail = _tail.load(std::memory_order_relaxed);
+        auto const head = _head.load(std::memory_order_acquire);
+        auto const count = std::min(head - tail, events.size());
+        for (size_t i = 0; i < count; ++i) {
+            events[i] = _events[(tail + i) & _mask];
+        }
+        _tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    /*!
+     \brief Returns the number of events dropped so far because the buffer was full.
+    */
+    uint64_t dropped() const
+    {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class Tracer;
+
+    template<typename C>
+    friend struct ParallelProcess;
+
+    void push(TraceEvent const &event)
+    {
+        auto const head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) > _mask) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        _events[head & _mask] = event;
+        _head.store(head + 1, std::memory_order_release);
+    }
+
+    // Moves the events of a buffer that the calling thread also wrote, after
+    // those already here.
+    void append(TraceBuffer &other)
+    {
+        auto const tail = other._tail.load(std::memory_order_relaxed);
+        auto const head = other._head.load(std::memory_order_relaxed);
+        for (auto i = tail; i < head; ++i) {
+            push(other._events[i & other._mask]);
+        }
+        other._tail.store(head, std::memory_order_relaxed);
+        _dropped.fetch_add(other.dropped(), std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<TraceEvent[]> _events;
+    size_t _mask{};
+    std::atomic<uint64_t> _dropped{};
+
+    // The writer's and the drainer's counters, a cache line apart so that
+    // they don't slow each other down.
+    std::atomic<size_t> _head{};
+    char _padding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> _tail{};
+};
+
+/*!
+ \brief Per-entity state that lets a tree resume RUNNING nodes. See #beehive::Tree::make_state.
+
+    The state records the path of composites down to the node that returned
+    RUNNING, so the next process() call goes straight back to that node, however
+    deeply it is nested, and then carries on through its parents. The path is
+    stored in a buffer sized to the tree's depth when the state is made, so
+    processing never allocates.
+*/
+struct TreeState {
+    size_t resume_index{}; //!< The innermost composite that returned RUNNING, or 0. Inside a #beehive::BuilderBase::subtree_ref, an index into the referenced tree. For debugging.
+    size_t offset{}; //!< The offset of the child of resume_index that returned RUNNING. For debugging.
+
+    /*!
+     \brief Marks the given keys as changed, so that every #beehive::BuilderBase::reactive
+        subtree depending on any of them is evaluated again when next reached.
+
+        Keys are bits chosen by you, one per piece of context the subtrees read.
+    */
+    void invalidate(uint64_t keys)
+    {
+        if (_key_versions.empty()) {
+            return; // nothing is cached
+        }
+        ++_version;
+        for (size_t key = 0; key < _key_versions.size(); ++key) {
+            if ((keys >> key) & 1) {
+                _key_versions[key] = _version;
+            }
+        }
+    }
+
+    /*!
+     \brief Makes trees instrumented with a #beehive::Tracer record this entity's
+        ticks into the given buffer, or stop recording if it is nullptr.
+
+        The buffer must outlive its use by the state. Copies of the state
+        record into the same buffer.
+    */
+    void trace(TraceBuffer *buffer)
+    {
+        _trace = buffer;
+    }
+
+    /*!
+     \brief Returns true if the last tick ended waiting for a #beehive::BuilderBase::async_leaf
+        operation and no result has arrived since. #beehive::Tree::process_batch
+        with an #beehive::AsyncQueue skips such entities.
+    */
+    bool parked() const
+    {
+        return _parked && !_async.delivered();
+    }
+
+    /*!
+     \brief Returns the number of bytes this state occupies, including its
+        resume path, slots and the paths of parallel composites. Suspended
+        #beehive::BuilderBase::action coroutines and pending async results
+        are not counted.
+    */
+    size_t memory_usage() const
+    {
+        auto bytes = sizeof(TreeState)
+            + _frames.capacity() * sizeof(Frame)
+            + _slots.capacity() * sizeof(uint32_t)
+            + _key_versions.capacity() * sizeof(uint32_t)
+            + _paths.capacity() * sizeof(std::vector<Frame>);
+        for (auto const &path : _paths) {
+            bytes += path.capacity() * sizeof(Frame);
+        }
+        return bytes;
+    }
+
+private:
+    struct Frame
+    {
+        uint32_t index;
+        uint32_t offset;
+    };
+
+    TreeState(size_t tree_id, size_t depth = 0, size_t slot_count = 0)
+        : _tree_id(tree_id)
+        , _frames(depth)
+        , _slots(slot_count)
+        , _key_versions(slot_count > 0 ? 64 : 0)
+    {}
+
+    // Frames are stored innermost first. During a tick the previous path is read
+    // from the top down while composites are entered, and the new path is written
+    // from the bottom up as RUNNING composites return. Reading stops at the first
+    // composite that isn't on the previous path, or once writing starts.
+    void begin()
+    {
+        _cursor = _depth;
+        _depth = 0;
+        ++_tick;
+        _parked = false;
+    }
+
+    bool resume(size_t index, size_t &offset)
+    {
+        if (_cursor == 0) {
+            return false;
+        }
+        auto const &frame = _frames[_cursor - 1];
+        if (frame.index != index) {
+            _cursor = 0;
+            return false;
+        }
+        --_cursor;
+        offset = frame.offset;
+        return frame.offset != stopped; // a stopped node starts from the beginning
+    }
+
+    // The offset of the frame of a node that a budgeted tick stopped at
+    // instead of running. It is always the innermost frame. Only composites
+    // read their own frames, so for other nodes the frame is skipped by
+    // Node::process during budgeted ticks, and simply left unread otherwise.
+    static constexpr uint32_t stopped = UINT32_MAX;
+
+    void resume_stopped(size_t index)
+    {
+        auto const &frame = _frames[_cursor - 1];
+        if (frame.index == index && frame.offset == stopped) {
+            --_cursor;
+        }
+    }
+
+    void push(size_t index, size_t offset)
+    {
+        _cursor = 0;
+        if (_depth < _frames.size()) {
+            _frames[_depth++] = {static_cast<uint32_t>(index), static_cast<uint32_t>(offset)};
+        }
+    }
+
+    void end(Status status)
+    {
+        if (status != Status::RUNNING) {
+            _depth = 0;
+        }
+        resume_index = _depth > 0 ? _frames[0].index : 0;
+        offset = _depth > 0 ? _frames[0].offset : 0;
+    }
+
+    size_t _tree_id;
+    std::vector<Frame> _frames;
+    size_t _depth{};
+    size_t _cursor{};
+
+    // Per-entity values kept by nodes that need them, see Node::_slot. Nodes
+    // of a referenced subtree find theirs at an offset of _slot_base.
+    std::vector<uint32_t> _slots;
+
+    // When each key was last invalidated, counting invalidate() calls.
+    std::vector<uint32_t> _key_versions;
+    uint32_t _version{};
+
+    uint32_t _slot_base{}; // next to _version, since every state pays for its size
+
+    // Counts ticks, so that memoized leaves can tell a status cached in this tick.
+    uint32_t _tick{};
+
+    detail::ActionFrames _actions;
+
+    // The paths of the RUNNING children of parallel composites, by slot.
+    std::vector<std::vector<Frame>> _paths;
+
+    // The budget of the current tick, if any. See Node::process.
+    Budget *_budget{};
+
+    // Where a Tracer records this entity's ticks, if anywhere.
+    TraceBuffer *_trace{};
+
+    // What the async leaves are waiting for, and whether this tick waited.
+    detail::AsyncInboxRef _async;
+    bool _parked{};
+
+    template<typename C, typename A, typename I>
+    friend class Tree;
+
+    template<typename C>
+    friend class Generator;
+
+    template<typename C, typename F>
+    friend struct CompositeProcess;
+
+    template<typename C, typename T>
+    friend struct SubtreeProcess;
+
+    template<typename C>
+    friend struct ReactiveProcess;
+
+    template<typename C, typename F>
+    friend struct ActionProcess;
+
+    template<typename C, typename F>
+    friend struct AsyncProcess;
+
+    template<typename C>
+    friend struct ParallelProcess;
+
+    template<typename C, detail::Opcode Op>
+    friend struct StatefulDecoratorProcess;
+
+    template<typename C, typename F>
+    friend struct UtilityProcess;
+
+    template<typename C, typename P>
+    friend struct MemoizedProcess;
+
+    template<typename C>
+    friend struct Node;
+
+    friend class TreeStatePool;
+
+    friend class StateMigration;
+
+    friend class Tracer;
+
+    template<typename C, typename A>
+    friend class CompiledTree;
+
+    template<typename C, typename A>
+    friend class TreeHandle;
+};
+
+/*!
+ \brief Compact resume state for many entities sharing one tree. See #beehive::Tree::make_state_pool.
+
+    Stores the same information as one #beehive::TreeState per entity, but in
+    columns: the path depth of every entity, then the composite index and child
+    offset at each level of the path. Values are 16 bits wide when the tree has
+    fewer than 65536 nodes, otherwise 32 bits.
+*/
+class TreeStatePool
+{
+public:
+    /*!
+     \brief Returns the number of entities in the pool.
+    */
+    size_t size() const
+    {
+        return _size;
+    }
+
+    /*!
+     \brief Adds or removes entities at the end of the pool. New entities start at the root.
+    */
+    void resize(size_t size)
+    {
+        if (_wide) {
+            resize_columns(_wide_columns, size);
+        } else {
+            resize_columns(_narrow_columns, size);
+        }
+        _size = size;
+    }
+
+    /*!
+     \brief Makes the given entity start from the root on its next tick.
+    */
+    void reset(size_t entity)
+    {
+        assert(entity < _size); // out of range!
+        set(0, entity, 0);
+    }
+
+    /*!
+     \brief Returns the innermost composite the entity is running in, or 0, as
+        #beehive::TreeState::resume_index.
+    */
+    size_t resume_index(size_t entity) const
+    {
+        assert(entity < _size); // out of range!
+        return get(0, entity) > 0 ? get(1, entity) : 0;
+    }
+
+    /*!
+     \brief Returns the number of bytes of state kept per entity.
+    */
+    size_t bytes_per_entity() const
+    {
+        return column_count() * (_wide ? sizeof(uint32_t) : sizeof(uint16_t));
+    }
+
+private:
+    template<typename C, typename A, typename I>
+    friend class Tree;
+
+    TreeStatePool(size_t tree_id, size_t node_count, size_t depth, size_t size)
+        : _tree_id(tree_id)
+        , _depth(depth)
+        , _wide(node_count > UINT16_MAX)
+    {
+        resize(size);
+    }
+
+    // Column 0 is the path depth, then the index and offset of each frame.
+    size_t column_count() const
+    {
+        return 1 + 2 * _depth;
+    }
+
+    template<typename T>
+    void resize_columns(std::vector<T> &columns, size_t size)
+    {
+        std::vector<T> resized(column_count() * size);
+        auto const kept = std::min(size, _size);
+        for (size_t column = 0; column < column_count(); ++column) {
+            std::copy_n(columns.begin() + column * _size, kept, resized.begin() + column * size);
+        }
+        columns = std::move(resized);
+    }
+
+    size_t get(size_t column, size_t entity) const
+    {
+        auto const i = column * _size + entity;
+        return _wide ? _wide_columns[i] : _narrow_columns[i];
+    }
+
+    void set(size_t column, size_t entity, size_t value)
+    {
+        auto const i = column * _size + entity;
+        if (_wide) {
+            _wide_columns[i] = static_cast<uint32_t>(value);
+        } else {
+            _narrow_columns[i] = static_cast<uint16_t>(value);
+        }
+    }
+
+    void load(size_t entity, TreeState &state) const
+    {
+        if (_wide) {
+            load_columns(_wide_columns.data() + entity, state);
+        } else {
+            load_columns(_narrow_columns.data() + entity, state);
+        }
+    }
+
+    void store(size_t entity, TreeState const &state)
+    {
+        if (_wide) {
+            store_columns(_wide_columns.data() + entity, state);
+        } else {
+            store_columns(_narrow_columns.data() + entity, state);
+        }
+    }
+
+    // `values` points at the entity's value in the first column.
+    template<typename T>
+    void load_columns(T const *values, TreeState &state) const
+    {
+        state._depth = values[0];
+        for (size_t level = 0; level < state._depth; ++level) {
+            state._frames[level] = {values[(1 + 2 * level) * _size], values[(2 + 2 * level) * _size]};
+        }
+    }
+
+    template<typename T>
+    void store_columns(T *values, TreeState const &state) const
+    {
+        values[0] = static_cast<T>(state._depth);
+        for (size_t level = 0; level < state._depth; ++level) {
+            values[(1 + 2 * level) * _size] = static_cast<T>(state._frames[level].index);
+            values[(2 + 2 * level) * _size] = static_cast<T>(state._frames[level].offset);
+        }
+    }
+
+    size_t _tree_id;
+    size_t _depth;
+    bool _wide;
+    size_t _size{};
+    std::vector<uint16_t> _narrow_columns;
+    std::vector<uint32_t> _wide_columns;
+
+    friend class StateMigration;
+
+    template<typename C, typename A>
+    friend class TreeHandle;
+};
+
+/*!
+ \brief Moves states made by one tree over to another, such as a reloaded version
+    of it. See #beehive::Tree::migration_from.
+
+    Nodes are matched from the root down: a node matches the node in the same
+    place of the other tree if both are of the same kind and have as many
+    children, and then their children are matched pair by pair. A migrated
+    state resumes along the part of its path that still matches, and starts the
+    rest over. The values kept by matched nodes, like reactive() caches and
+    parallel() progress, carry over. Coroutine actions and the inside of
+    referenced subtrees start over, and so do async leaves: a migrated state
+    isn't parked, the operation is started again when the leaf is next
+    reached, and the result of the one it was waiting for is dropped.
+*/
+class StateMigration
+{
+public:
+    StateMigration() = default; //!< Constructs a migration that applies to no state.
+
+    /*!
+     \brief Returns whether the state was made by the tree migrated from.
+    */
+    bool applies_to(TreeState const &state) const
+    {
+        return _from != 0 && state._tree_id == _from;
+    }
+
+    /*!
+     \brief Returns whether the pool was made by the tree migrated from.
+    */
+    bool applies_to(TreeStatePool const &pool) const
+    {
+        return _from != 0 && pool._tree_id == _from;
+    }
+
+    /*!
+     \brief Replaces the state with one for the tree migrated to.
+    */
+    void migrate(TreeState &state) const
+    {
+        assert(applies_to(state)); // state of another tree!
+        TreeState migrated{_to, _depth + 1, _slot_count};
+        migrated._depth = remap(state._frames.data(), state._depth, migrated._frames);
+        migrated.end(migrated._depth > 0 ? Status::RUNNING : Status::SUCCESS);
+        migrated._tick = state._tick; // memoized leaves compare it to their slots
+        migrated._trace = state._trace;
+
+        if (state._slots.size() >= _from_slot_count && _slot_count > 0) {
+            for (auto const &slots : _slots) {
+                std::copy_n(state._slots.begin() + slots.from, slots.count, migrated._slots.begin() + slots.to);
+                if (!slots.paths || state._paths.size() < slots.from + slots.count) {
+                    continue;
+                }
+                migrated._paths.resize(_slot_count);
+                for (uint32_t i = 0; i < slots.count; ++i) {
+                    auto const &path = state._paths[slots.from + i];
+                    auto &remapped = migrated._paths[slots.to + i];
+                    remapped.resize(path.size());
+                    remapped.resize(remap(path.data(), path.size(), remapped));
+                }
+            }
+            if (!state._key_versions.empty()) {
+                migrated._key_versions = state._key_versions;
+                migrated._version = state._version;
+            }
+        }
+        state = std::move(migrated);
+    }
+
+    /*!
+     \brief Replaces the pool with one for the tree migrated to, keeping its entities' paths.
+    */
+    void migrate(TreeStatePool &pool) const
+    {
+        assert(applies_to(pool)); // state pool of another tree!
+        TreeStatePool migrated{_to, _node_count, _depth, pool.size()};
+        TreeState from{_from, pool._depth};
+        TreeState to{_to, _depth};
+        for (size_t entity = 0; entity < pool.size(); ++entity) {
+            pool.load(entity, from);
+            to._depth = remap(from._frames.data(), from._depth, to._frames);
+            migrated.store(entity, to);
+        }
+        pool = std::move(migrated);
+    }
+
+private:
+    template<typename C, typename A, typename I>
+    friend class Tree;
+
+    using Frame = TreeState::Frame;
+
+    static constexpr uint32_t none = UINT32_MAX;
+
+    // Where a node of the old tree went, if it matched.
+    struct Match
+    {
+        uint32_t index;
+        bool last; // a referenced subtree, whose inner frames index another tree
+    };
+
+    // The values of a matched node, in the slots of each tree.
+    struct Slots
+    {
+        uint32_t from;
+        uint32_t to;
+        uint32_t count;
+        bool paths; // a parallel composite's children's paths, by slot
+    };
+
+    // Writes the frames of the path that still match to `out`, innermost
+    // first like the path itself, and returns how many there are.
+    size_t remap(Frame const *frames, size_t depth, std::vector<Frame> &out) const
+    {
+        size_t kept = 0;
+        for (auto level = depth; level-- > 0 && kept < out.size();) {
+            auto const &frame = frames[level];
+            if (frame.index >= _nodes.size() || _nodes[frame.index].index == none) {
+                break;
+            }
+            out[kept++] = {_nodes[frame.index].index, frame.offset};
+            if (_nodes[frame.index].last) {
+                break;
+            }
+        }
+        std::reverse(out.begin(), out.begin() + kept);
+        return kept;
+    }
+
+    size_t _from{};
+    size_t _to{};
+    size_t _node_count{};
+    size_t _depth{};
+    size_t _slot_count{};
+    size_t _from_slot_count{};
+    std::vector<Match> _nodes; // by index in the old tree
+    std::vector<Slots> _slots;
+};
+
+/// @cond
+namespace detail
+{
+
+template<typename F, typename... Args>
+auto invoke(F &f, Args &&... args)
+    -> typename std::enable_if<
+        !std::is_member_pointer<F>::value,
+        decltype(f(std::forward<Args>(args)...))
+    >::type
+{
+    return f(std::forward<Args>(args)...);
+}
+
+// Member function pointers are called on the first argument, so that leaves
+// can be members of the context type.
+template<typename F, typename... Args>
+auto invoke(F &f, Args &&... args)
+    -> typename std::enable_if<
+        std::is_member_pointer<F>::value,
+        decltype(std::mem_fn(f)(std::forward<Args>(args)...))
+    >::type
+{
+    return std::mem_fn(f)(std::forward<Args>(args)...);
+}
+
+// LEB128 variable-length integers, used by state snapshots and traces so that the small
+// values they mostly hold take a byte each, in any byte order.
+inline void write_varint(std::vector<unsigned char> &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+struct VarintReader
+{
+    uint64_t read()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (position == end) {
+                throw std::runtime_error(std::string(what) + " is truncated");
+            }
+            auto const byte = *position++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error(std::string(what) + " has an invalid number");
+    }
+
+    // Reads a value that must be at most `max`.
+    uint64_t read(uint64_t max)
+    {
+        auto const value = read();
+        if (value > max) {
+            throw std::runtime_error(std::string(what) + " has a value out of range");
+        }
+        return value;
+    }
+
+    unsigned char const *position;
+    unsigned char const *end;
+    char const *what = "state snapshot"; // what is read, for errors
+};
+
+// How a #beehive::CompiledTree runs a node. Only the built-in composites and
+// decorators have their own opcode; everything up to SHARED is called
+// through the node and only says what kind of node it is.
+enum class Opcode : uint8_t
+{
+    CALL, // a node not added by a builder
+    LEAF,
+    COMPOSITE,
+    DECORATOR,
+    SUBTREE,
+    PARALLEL,
+    REPEAT,
+    RETRY,
+    COOLDOWN,
+    TIMEOUT,
+    RATE_LIMIT,
+    UTILITY,
+    SHARED,
+    REACTIVE,
+    FORWARDER,
+    INVERTER,
+    SUCCEEDER,
+    SEQUENCE,
+    SELECTOR,
+};
+
+inline bool is_call(Opcode opcode)
+{
+    return opcode <= Opcode::SHARED;
+}
+
+inline char const *opcode_name(Opcode opcode)
+{
+    static char const *const names[] = {
+        "node",
+        "leaf",
+        "composite",
+        "decorator",
+        "subtree",
+        "parallel",
+        "repeat",
+        "retry",
+        "cooldown",
+        "timeout",
+        "rate_limit",
+        "utility_selector",
+        "shared",
+        "reactive",
+        "forwarder",
+        "inverter",
+        "succeeder",
+        "sequence",
+        "selector",
+    };
+    return names[static_cast<size_t>(opcode)];
+}
+
+} // namespace detail
+/// @endcond
+
+/// @cond
+namespace detail
+{
+
+// A unique address per type, for telling types apart without RTTI.
+template<typename T>
+void const *type_tag()
+{
+    static char const tag{};
+    return &tag;
+}
+
+} // namespace detail
+/// @endcond
+
+/*!
+ \brief A reference to a context of any type, so that trees for many agent types
+    can share one instantiation of the engine: Tree<AnyContext>, its nodes,
+    composites and decorators are compiled once, and only the leaves, made
+    with #beehive::typed, know the agent type. See #beehive::TypedTree.
+*/
+class AnyContext
+{
+public:
+    /*!
+     \brief Refers to the given context, which must outlive the reference.
+    */
+    template<
+        typename C,
+        typename = typename std::enable_if<!std::is_same<typename std::decay<C>::type, AnyContext>::value>::type
+    >
+    AnyContext(C &context)
+        : _context(&context)
+        , _type(detail::type_tag<C>())
+    {}
+
+    /*!
+     \brief Returns true if the context is a `C`.
+    */
+    template<typename C>
+    bool is() const
+    {
+        return _type == detail::type_tag<C>();
+    }
+
+    /*!
+     \brief Returns the context, which must be a `C`.
+    */
+    template<typename C>
+    C &get() const
+    {
+        assert(is<C>()); // context of another type!
+        return *static_cast<C *>(_context);
+    }
+
+private:
+    void *_context;
+    void const *_type;
+};
+
+/*!
+ \brief Calls a function of a `C` with the `C` that a #beehive::AnyContext refers to.
+    See #beehive::typed.
+*/
+template<typename C, typename F>
+struct Typed
+{
+    /// @cond
+    template<typename... Args>
+    auto operator()(AnyContext &context, Args &&... args)
+        -> decltype(detail::invoke(std::declval<F &>(), std::declval<C &>(), std::forward<Args>(args)...))
+    {
+        return detail::invoke(function, context.get<C>(), std::forward<Args>(args)...);
+    }
+    /// @endcond
+
+    F function; //!< The function called, taking a `C &` first.
+};
+
+/*!
+ \brief Adapts a leaf, or a decorator or composite, written for contexts of
+    type `C` to a tree of #beehive::AnyContext.
+
+    \code
+    auto tree = Builder<AnyContext>{}
+        .sequence()
+            .leaf(typed<Zombie>(&Zombie::is_hungry))
+            .void_leaf(typed<Zombie>([](Zombie &zombie) { zombie.eat(); }))
+        .end()
+        .build();
+    \endcode
+*/
+template<typename C, typename F>
+Typed<C, typename std::decay<F>::type> typed(F &&function)
+{
+    return {std::forward<F>(function)};
+}
+
+template<typename Signature, size_t Capacity = BEEHIVE_FUNCTION_CAPACITY, bool AllowHeap = BEEHIVE_FUNCTION_ALLOW_HEAP>
+class InlineFunction;
+
+/*!
+ \brief A copyable type-erased callable, like std::function, that keeps the
+    target in `Capacity` bytes of inline storage.
+
+    Targets that do not fit (or whose move constructor may throw) are rejected at
+    compile time unless `AllowHeap` is true, in which case they are allocated on
+    the heap. Trivially copyable targets are copied with memcpy.
+*/
+template<typename R, typename... Args, size_t Capacity, bool AllowHeap>
+class InlineFunction<R(Args...), Capacity, AllowHeap>
+{
+    template<typename F>
+    using FitsInline = std::integral_constant<bool,
+        sizeof(F) <= Capacity
+        && alignof(F) <= alignof(void *)
+        && std::is_nothrow_move_constructible<F>::value
+    >;
+
+public:
+    static constexpr size_t capacity = Capacity; //!< Bytes of inline storage.
+
+    InlineFunction() noexcept = default; //!< Constructs an empty function.
+
+    InlineFunction(std::nullptr_t) noexcept {} //!< Constructs an empty function.
+
+    /*!
+     \brief Stores a copy of the given callable.
+    */
+    template<
+        typename F,
+        typename = typename std::enable_if<
+            !std::is_same<typename std::decay<F>::type, InlineFunction>::value
+        >::type
+    >
+    InlineFunction(F &&f)
+    {
+        using Target = typename std::decay<F>::type;
+        static_assert(
+            std::is_copy_constructible<Target>::value,
+            "InlineFunction targets must be copy constructible"
+        );
+        static_assert(
+            AllowHeap || FitsInline<Target>::value,
+            "callable does not fit in the inline storage: capture less, raise "
+            "BEEHIVE_FUNCTION_CAPACITY or define BEEHIVE_FUNCTION_ALLOW_HEAP"
+        );
+        emplace<Target>(std::forward<F>(f), FitsInline<Target>{});
+    }
+
+    InlineFunction(InlineFunction const &other) //!< Copy constructor.
+    {
+        copy_from(other);
+    }
+
+    InlineFunction(InlineFunction &&other) noexcept //!< Move constructor.
+    {
+        move_from(other);
+    }
+
+    InlineFunction &operator=(InlineFunction const &other) //!< Copy assignment operator.
+    {
+        if (this != &other) {
+            InlineFunction copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    InlineFunction &operator=(InlineFunction &&other) noexcept //!< Move assignment operator.
+    {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    ~InlineFunction()
+    {
+        reset();
+    }
+
+    /*!
+     \brief Returns true if a target is stored.
+    */
+    explicit operator bool() const noexcept
+    {
+        return _invoke != nullptr;
+    }
+
+    /*!
+     \brief Calls the stored target, which must exist.
+    */
+    R operator()(Args... args) const
+    {
+        assert(_invoke); // calling an empty function!
+        return _invoke(const_cast<void *>(static_cast<void const *>(&_storage)), std::forward<Args>(args)...);
+    }
+
+    /*!
+     \brief Returns the stored target if it is an `F`, or null otherwise.
+    */
+    template<typename F>
+    F const *target() const noexcept
+    {
+        auto const *storage = static_cast<void const *>(&_storage);
+        if (_invoke == &invoke_inline<F>) {
+            return static_cast<F const *>(storage);
+        }
+        if (_invoke == &invoke_heap<F>) {
+            return *static_cast<F const * const *>(storage);
+        }
+        return nullptr;
+    }
+
+    /*!
+     \brief Returns the number of bytes the target keeps on the heap, which is 0
+        unless it didn't fit inline.
+    */
+    size_t heap_size() const noexcept
+    {
+        size_t size = 0;
+        if (_manage) {
+            _manage(Operation::SIZE, nullptr, &size);
+        }
+        return size;
+    }
+
+private:
+    enum class Operation
+    {
+        COPY,
+        MOVE,
+        DESTROY,
+        SIZE, // writes the size of a heap target to other
+    };
+
+    using Invoke = R(*)(void *storage, Args &&... args);
+    using Manage = void(*)(Operation operation, void *storage, void *other);
+
+    template<typename F>
+    static R invoke_inline(void *storage, Args &&... args)
+    {
+        return detail::invoke(*static_cast<F *>(storage), std::forward<Args>(args)...);
+    }
+
+    template<typename F>
+    static R invoke_heap(void *storage, Args &&... args)
+    {
+        return detail::invoke(**static_cast<F **>(storage), std::forward<Args>(args)...);
+    }
+
+    template<typename F>
+    static void manage_inline(Operation operation, void *storage, void *other)
+    {
+        switch (operation) {
+        case Operation::COPY:
+            new (storage) F(*static_cast<F const *>(other));
+            break;
+        case Operation::MOVE:
+            new (storage) F(std::move(*static_cast<F *>(other)));
+            static_cast<F *>(other)->~F();
+            break;
+        case Operation::DESTROY:
+            static_cast<F *>(storage)->~F();
+            break;
+        case Operation::SIZE:
+            break;
+        }
+    }
+
+    template<typename F>
+    static void manage_heap(Operation operation, void *storage, void *other)
+    {
+        switch (operation) {
+        case Operation::COPY:
+            *static_cast<F **>(storage) = new F(**static_cast<F const * const *>(other));
+            break;
+        case Operation::MOVE:
+            *static_cast<F **>(storage) = *static_cast<F **>(other);
+            break;
+        case Operation::DESTROY:
+            delete *static_cast<F **>(storage);
+            break;
+        case Operation::SIZE:
+            *static_cast<size_t *>(other) = sizeof(F);
+            break;
+        }
+    }
+
+    template<typename F, typename G>
+    void emplace(G &&f, std::true_type /* inline */)
+    {
+        new (&_storage) F(std::forward<G>(f));
+        _invoke = &invoke_inline<F>;
+        // A null manager means the storage may be copied bytewise and needs no destruction.
+        _manage = std::is_trivially_copyable<F>::value ? nullptr : &manage_inline<F>;
+    }
+
+    template<typename F, typename G>
+    void emplace(G &&f, std::false_type /* heap */)
+    {
+        *reinterpret_cast<F **>(&_storage) = new F(std::forward<G>(f));
+        _invoke = &invoke_heap<F>;
+        _manage = &manage_heap<F>;
+    }
+
+    void copy_from(InlineFunction const &other)
+    {
+        if (other._manage) {
+            other._manage(Operation::COPY, &_storage, const_cast<void *>(static_cast<void const *>(&other._storage)));
+        } else if (other._invoke) {
+            std::memcpy(&_storage, &other._storage, sizeof(_storage));
+        }
+        _invoke = other._invoke;
+        _manage = other._manage;
+    }
+
+    void move_from(InlineFunction &other) noexcept
+    {
+        if (other._manage) {
+            other._manage(Operation::MOVE, &_storage, &other._storage);
+        } else if (other._invoke) {
+            std::memcpy(&_storage, &other._storage, sizeof(_storage));
+        }
+        _invoke = other._invoke;
+        _manage = other._manage;
+        other._invoke = nullptr;
+        other._manage = nullptr;
+    }
+
+    void reset() noexcept
+    {
+        if (_manage) {
+            _manage(Operation::DESTROY, &_storage, nullptr);
+        }
+        _invoke = nullptr;
+        _manage = nullptr;
+    }
+
+    static_assert(Capacity >= sizeof(void *), "Capacity must at least hold a pointer");
+
+    Invoke _invoke{};
+    Manage _manage{};
+    // Zeroed so that trivially copyable targets smaller than the storage can be
+    // copied bytewise without reading uninitialized bytes.
+    typename std::aligned_storage<Capacity, alignof(void *)>::type _storage{};
+};
+
+/*!
+ \brief A handle on a process function. This should not be built directly, see #beehive::Builder.
+
+    Nodes hold only what walking the tree needs, so that ticks touch few cache
+    lines. What each node runs, and how it was built, is kept in a #beehive::Node::Body
+    of the tree instead.
+*/
+template<typename C>
+struct Node
+{
+    using ProcessFunction = InlineFunction<Status(C &context, Node const &self, TreeState &state)>;
+
+    /*!
+     \brief The process function of a node and the rest of what it was built
+        with, which the tree keeps apart from the nodes. See #beehive::MemoryUsage.
+    */
+    struct Body
+    {
+        /// @cond
+        Body(ProcessFunction process): process(std::move(process)) {}
+
+        void add_child() {
+            ++child_count;
+        }
+
+        ProcessFunction process;
+        uint32_t child_count{};
+        uint32_t slot_count{}; // per-entity values needed by the node, see TreeState::_slots
+        uint32_t subtree_depth{}; // resume frames needed by a referenced subtree
+        uint32_t memo{unmemoized}; // shared by copies of a memoized leaf, see BuilderBase::memoized_leaf
+        uint32_t function{unregistered}; // the FunctionTable entry it was built from, if any
+        detail::Opcode opcode{detail::Opcode::CALL};
+        bool condition{}; // cheap and without side effects, see BuilderBase::condition
+        /// @endcond
+    };
+
+    Status process(C &context, TreeState &state) const
+    {
+        if (state._budget != nullptr) {
+            // Nodes on the way back to where the last tick stopped are free, so
+            // each budgeted tick gets at least one node further than the last.
+            if (state._cursor != 0) {
+                state.resume_stopped(_index);
+            } else if (!state._budget->spend()) {
+                state.push(_index, TreeState::stopped);
+                return Status::RUNNING; // out of budget, start here next time
+            }
+        }
+        return _body->process(context, *this, state);
+    }
+
+    size_t child_count() const {
+        return _child_count;
+    }
+    
+    /*!
+     \brief Returns the number of nodes in this node's subtree, excluding itself.
+     
+        Constant time once the node belongs to a #beehive::Tree, which computes the
+        count for every node on construction. Other nodes fall back to walking
+        their children.
+    */
+    size_t descendent_count() const {
+        if (_descendent_count != npos) {
+            return _descendent_count;
+        }
+        size_t count = _child_count;
+        auto *child = first_child();
+        for (size_t i = 0; i < _child_count; ++i) {
+            count += child->descendent_count();
+            child = child->next_sibling();
+        }
+        return count;
+    }
+    
+    void add_child() {
+        ++_child_count;
+        _descendent_count = npos;
+    }
+
+    Node const *first_child() const {
+        if (_child_count == 0) {
+            return nullptr;
+        }
+        return this + 1;
+    }
+    
+    Node const *next_sibling() const {
+        return this + descendent_count() + 1;
+    }
+    
+    size_t index() const {
+        return _index;
+    }
+
+private:
+    template<typename Context, typename A, typename I>
+    friend class Tree;
+
+    template<typename Context, typename A>
+    friend class CompiledTree;
+
+    friend class Profiler;
+
+    template<typename Tree>
+    friend void dump_trace(std::ostream &out, Tree const &tree, Span<TraceEvent const> events);
+
+    template<typename Context, typename A>
+    friend class BuilderBase;
+
+    template<typename Context, typename A>
+    friend class Builder;
+
+    template<typename Context, typename T>
+    friend struct SubtreeProcess;
+
+    template<typename Context>
+    friend struct ReactiveProcess;
+
+    template<typename Context, typename F>
+    friend struct ActionProcess;
+
+    template<typename Context, typename F>
+    friend struct AsyncProcess;
+
+    template<typename Context>
+    friend struct ParallelProcess;
+
+    template<typename Context, detail::Opcode Op>
+    friend struct StatefulDecoratorProcess;
+
+    template<typename Context, typename F>
+    friend struct UtilityProcess;
+
+    template<typename Context, typename P>
+    friend struct MemoizedProcess;
+
+    template<typename Context>
+    friend class FunctionTable;
+    
+    static constexpr uint32_t npos = UINT32_MAX;
+    static constexpr uint32_t unregistered = UINT32_MAX;
+    static constexpr uint32_t unmemoized = UINT32_MAX;
+
+    // Counts are 32 bits, see Tree::Tree.
+    Body const *_body{}; // in the tree's Tree::_bodies, at the same index
+    uint32_t _index{};
+    uint32_t _child_count{};
+    uint32_t _descendent_count{npos};
+    uint32_t _slot{}; // the first per-entity value of this node, assigned by the tree
+};
+
+/*!
+ \brief Yields a composite's children in order. See #beehive::Composite.
+
+    Copies of a generator share its position.
+*/
+template<typename C>
+class Generator
+{
+public:
+    /*!
+     \brief Returns the next child, or nullptr after the last child.
+    */
+    Node<C> const *operator()() const
+    {
+        auto &cursor = *_cursor;
+        // Forget the path of any earlier child that returned RUNNING without the
+        // composite returning RUNNING itself.
+        cursor.state->_depth = cursor.depth;
+        if (cursor.index++ == cursor.count) {
+            return nullptr;
+        }
+        auto const *child = cursor.next;
+        cursor.next = child->next_sibling();
+        return child;
+    }
+
+private:
+    template<typename Context, typename F>
+    friend struct CompositeProcess;
+
+    struct Cursor
+    {
+        size_t index;
+        size_t count;
+        Node<C> const *next;
+        TreeState *state;
+        size_t depth;
+    };
+
+    Generator(Cursor &cursor): _cursor(&cursor) {}
+
+    Cursor *_cursor;
+};
+
+/*!
+ \brief Composites define how to run the process() function on the child range.
+ 
+   The generator function returns the next child in the child array or nullptr after the
+   end of the child array. If the previous call to process() returned RUNNING status,
+   the first result of the generator will be the same child as was returned when the
+   previous called returned the RUNNING status. This allows composites to resume
+   where they left off.
+   
+   The child pointer returned is only valid within the scope of the composite function
+   body.
+*/
+template<typename C>
+using Composite = std::function<Status(C &, Generator<C> const &, TreeState &)>;
+
+/*!
+ \brief Composite that returns success if all children return success.
+*/
+template<typename C>
+Status sequence(C &context, Generator<C> const &next_child, TreeState &state)
+{
+    while (auto const *child = next_child())
+    {
+        auto status = child->process(context, state);
+        if (status != Status::SUCCESS)
+        {
+            return status;
+        }
+    }
+    return Status::SUCCESS;
+}
+
+/*!
+ \brief Composite that returns success on the first successful call.
+*/
+template<typename C>
+Status selector(C &context, Generator<C> const &next_child, TreeState &state)
+{
+    while (auto const *child = next_child())
+    {
+        auto status = child->process(context, state);
+        if (status != Status::FAILURE)
+        {
+            return status;
+        }
+    }
+    return Status::FAILURE;
+}
+
+/*!
+ \brief A decorator is a composite that may only have a single child.
+*/
+template<typename C>
+using Decorator = std::function<Status(C &context, Node<C> const &child, TreeState &state)>;
+
+/*!
+ \brief Decorator that just returns the result of the child. Not very useful...
+*/
+template<typename C>
+Status forwarder(C &context, Node<C> const &child, TreeState &state)
+{
+    return child.process(context, state);
+}
+
+/*!
+ \brief Decorator that inverts the result of its child node.
+*/
+template<typename C>
+Status inverter(C &context, Node<C> const &child, TreeState &state)
+{
+    const auto status = child.process(context, state);
+    if (status == Status::RUNNING)
+    {
+        return status;
+    }
+    return status == Status::FAILURE ? Status::SUCCESS : Status::FAILURE;
+}
+
+/*!
+ \brief Decorator that returns success regardless of the child result.
+*/
+template<typename C>
+Status succeeder(C &context, Node<C> const &child, TreeState &state)
+{
+    child.process(context, state);
+    return Status::SUCCESS;
+}
+
+
+template<typename ReturnType, typename ContextType>
+using BasicLeaf = std::function<ReturnType(ContextType &context)>; //!< Leaf nodes are the `process()` function taking the mutable context and must return a status.
+
+template<typename C>
+using Leaf = BasicLeaf<Status, C>; //!< A Leaf function takes a Context & and returns a Status.
+
+template<typename C>
+using BoolLeaf = BasicLeaf<bool, C>; //!< A Leaf function returning bool returns SUCCESS on true and FAILURE on false. It is not possible to return RUNNING from such a function.
+
+template<typename C>
+using VoidLeaf = BasicLeaf<void, C>; //!< A Leaf function returning anything other than bool or Status can be added using #beehive::BuilderBase::void_leaf. The return value is ignored and SUCCESS is returned.
+
+/*!
+ \brief A leaf that always succeeds. Not very useful...
+*/
+template<typename C>
+Status noop(C &)
+{
+    return Status::SUCCESS;
+}
+
+/*!
+ \brief Returns a new process-wide unique ID. Safe to call from any thread.
+*/
+inline size_t id() {
+    static std::atomic<size_t> id{};
+    return ++id;
+}
+
+/// @cond
+namespace detail
+{
+
+// A process-wide unique key for a memoized leaf, shared by its copies.
+inline uint32_t memo_key()
+{
+    static std::atomic<uint32_t> key{};
+    return key++;
+}
+
+} // namespace detail
+/// @endcond
+
+/*!
+ \brief Monotonic memory for building trees. See #beehive::ArenaAllocator.
+
+    Allocations are carved out of large blocks one after another and are only
+    freed together when the arena is destroyed, so the arena must outlive
+    everything allocated from it.
+*/
+class Arena
+{
+public:
+    static constexpr size_t default_block_size = 64 * 1024; //!< The size of the blocks the arena allocates.
+
+    /*!
+     \brief Creates an empty arena. Blocks are only allocated once needed.
+    */
+    explicit Arena(size_t block_size = default_block_size)
+        : _block_size(block_size)
+    {}
+
+    Arena(Arena const &) = delete; //!< Deleted copy constructor.
+    Arena &operator=(Arena const &) = delete; //!< Deleted copy assignment operator.
+
+    /*!
+     \brief Returns `size` bytes aligned to `alignment`.
+    */
+    void *allocate(size_t size, size_t alignment)
+    {
+        auto space = _blocks.empty() ? 0 : _blocks.back().size - _used;
+        void *pointer = _blocks.empty() ? nullptr : _blocks.back().data.get() + _used;
+        if (_blocks.empty() || !std::align(alignment, size, pointer, space)) {
+            // Requests bigger than a block get a block of their own.
+            auto const block_size = std::max(_block_size, size + alignment);
+            _blocks.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[block_size]), block_size});
+            space = block_size;
+            pointer = _blocks.back().data.get();
+            std::align(alignment, size, pointer, space);
+        }
+        _used = _blocks.back().size - space + size;
+        _allocated += size;
+        return pointer;
+    }
+
+    /*!
+     \brief Returns the number of bytes handed out so far.
+    */
+    size_t bytes_allocated() const
+    {
+        return _allocated;
+    }
+
+    /*!
+     \brief Returns the number of blocks allocated so far.
+    */
+    size_t block_count() const
+    {
+        return _blocks.size();
+    }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+    };
+
+    size_t _block_size;
+    std::vector<Block> _blocks;
+    size_t _used{}; // bytes used in the last block
+    size_t _allocated{};
+};
+
+/*!
+ \brief An allocator that takes its memory from an #beehive::Arena and never frees it.
+
+    Use it with a #beehive::Builder to place a tree's nodes, and the callables
+    stored inside them, in the arena. Reserve the node count up front with
+    #beehive::Builder::reserve so that growing the node vector doesn't leave
+    earlier copies behind in the arena.
+*/
+template<typename T>
+class ArenaAllocator
+{
+public:
+    /// @cond
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = ArenaAllocator<U>;
+    };
+    /// @endcond
+
+    /*!
+     \brief Allocates from the given arena.
+    */
+    ArenaAllocator(Arena &arena): _arena(&arena) {}
+
+    /*!
+     \brief Allocates from the same arena as the other allocator.
+    */
+    template<typename U>
+    ArenaAllocator(ArenaAllocator<U> const &other): _arena(other._arena) {}
+
+    /// @cond
+    T *allocate(size_t count)
+    {
+        return static_cast<T *>(_arena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template<typename U>
+    bool operator==(ArenaAllocator<U> const &other) const
+    {
+        return _arena == other._arena;
+    }
+
+    template<typename U>
+    bool operator!=(ArenaAllocator<U> const &other) const
+    {
+        return _arena != other._arena;
+    }
+    /// @endcond
+
+private:
+    template<typename U>
+    friend class ArenaAllocator;
+
+    Arena *_arena;
+};
+
+#if BEEHIVE_COROUTINES
+/*!
+ \brief Where the frames of #beehive::Action coroutines come from. See
+    #beehive::BuilderBase::action.
+*/
+class FrameAllocator
+{
+public:
+    /*!
+     \brief Returns `size` bytes aligned for any type.
+    */
+    virtual void *allocate(size_t size) = 0;
+
+    /*!
+     \brief Gives back memory returned by allocate() with the same size.
+    */
+    virtual void deallocate(void *pointer, size_t size) = 0;
+
+protected:
+    ~FrameAllocator() = default;
+};
+
+/*!
+ \brief A #beehive::FrameAllocator that recycles coroutine frames.
+
+    Frames are rounded up to a multiple of `size_class` bytes and carved from an
+    #beehive::Arena. Freed frames go on a list per size, so agents running the
+    same actions keep reusing the same memory. Frames above `max_pooled_size`
+    bytes use the global operator new. Not thread-safe: use one pool per thread.
+*/
+class FramePool : public FrameAllocator
+{
+public:
+    static constexpr size_t size_class = 64; //!< The granularity of pooled frames.
+    static constexpr size_t max_pooled_size = 4096; //!< The largest pooled frame.
+
+    /*!
+     \brief Creates an empty pool that allocates blocks of the given size.
+    */
+    explicit FramePool(size_t block_size = Arena::default_block_size)
+        : _arena(block_size)
+    {}
+
+    /// @cond
+    void *allocate(size_t size) override
+    {
+        if (size > max_pooled_size) {
+            return ::operator new(size);
+        }
+        auto const index = size_index(size);
+        if (index >= _free.size()) {
+            _free.resize(index + 1);
+        }
+        auto *&head = _free[index];
+        if (head == nullptr) {
+            return _arena.allocate((index + 1) * size_class, alignof(std::max_align_t));
+        }
+        auto *frame = head;
+        head = *static_cast<void **>(frame);
+        return frame;
+    }
+
+    void deallocate(void *pointer, size_t size) override
+    {
+        if (size > max_pooled_size) {
+            ::operator delete(pointer);
+            return;
+        }
+        auto &head = _free[size_index(size)];
+        *static_cast<void **>(pointer) = head;
+        head = pointer;
+    }
+    /// @endcond
+
+    /*!
+     \brief Returns the number of bytes taken from the arena so far.
+    */
+    size_t bytes_allocated() const
+    {
+        return _arena.bytes_allocated();
+    }
+
+private:
+    static size_t size_index(size_t size)
+    {
+        return (std::max<size_t>(size, 1) - 1) / size_class;
+    }
+
+    Arena _arena;
+    std::vector<void *> _free;
+};
+
+/// @cond
+namespace detail
+{
+
+// The allocator of the action leaf currently creating a coroutine. Each frame
+// remembers its allocator in a header, so it can be freed from anywhere.
+inline FrameAllocator *&frame_allocator()
+{
+    static thread_local FrameAllocator *allocator{};
+    return allocator;
+}
+
+class FrameAllocatorScope
+{
+public:
+    explicit FrameAllocatorScope(FrameAllocator *allocator)
+        : _previous(frame_allocator())
+    {
+        frame_allocator() = allocator;
+    }
+
+    FrameAllocatorScope(FrameAllocatorScope const &) = delete;
+    FrameAllocatorScope &operator=(FrameAllocatorScope const &) = delete;
+
+    ~FrameAllocatorScope()
+    {
+        frame_allocator() = _previous;
+    }
+
+private:
+    FrameAllocator *_previous;
+};
+
+constexpr size_t frame_header_size = alignof(std::max_align_t);
+
+inline void *allocate_frame(size_t size)
+{
+    auto *allocator = frame_allocator();
+    auto const total = size + frame_header_size;
+    void *block = allocator != nullptr ? allocator->allocate(total) : ::operator new(total);
+    std::memcpy(block, &allocator, sizeof(allocator));
+    return static_cast<unsigned char *>(block) + frame_header_size;
+}
+
+inline void deallocate_frame(void *frame, size_t size)
+{
+    void *block = static_cast<unsigned char *>(frame) - frame_header_size;
+    FrameAllocator *allocator;
+    std::memcpy(&allocator, block, sizeof(allocator));
+    if (allocator != nullptr) {
+        allocator->deallocate(block, size + frame_header_size);
+    } else {
+        ::operator delete(block);
+    }
+}
+
+} // namespace detail
+/// @endcond
+
+template<typename C, typename F>
+struct ActionProcess;
+
+/*!
+ \brief The return type of coroutines used as leaves. See #beehive::BuilderBase::action.
+
+    The coroutine runs until it awaits #beehive::next_tick, which makes the leaf
+    return RUNNING, and continues from there on the next tick. It finishes with
+    `co_return` and a Status or a bool.
+*/
+class Action
+{
+public:
+    /// @cond
+    struct promise_type
+    {
+        Action get_return_object()
+        {
+            return Action{Handle::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(Status result)
+        {
+            assert(result != Status::RUNNING); // use co_await next_tick to return RUNNING!
+            status = result;
+        }
+
+        void return_value(bool result)
+        {
+            status = result ? Status::SUCCESS : Status::FAILURE;
+        }
+
+        void unhandled_exception()
+        {
+            error = std::current_exception();
+        }
+
+        static void *operator new(size_t size)
+        {
+            return detail::allocate_frame(size);
+        }
+
+        static void operator delete(void *frame, size_t size)
+        {
+            detail::deallocate_frame(frame, size);
+        }
+
+        Status status{Status::FAILURE};
+        std::exception_ptr error;
+    };
+
+    using Handle = std::coroutine_handle<promise_type>;
+    /// @endcond
+
+    Action(Action const &) = delete; //!< Deleted copy constructor.
+    Action &operator=(Action const &) = delete; //!< Deleted copy assignment operator.
+
+    /*!
+     \brief Takes over the other action's coroutine.
+    */
+    Action(Action &&other) noexcept
+        : _handle(other.release())
+    {}
+
+    /*!
+     \brief Destroys the coroutine unless a leaf took it.
+    */
+    ~Action()
+    {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+private:
+    template<typename C, typename F>
+    friend struct ActionProcess;
+
+    explicit Action(Handle handle)
+        : _handle(handle)
+    {}
+
+    Handle release()
+    {
+        auto handle = _handle;
+        _handle = {};
+        return handle;
+    }
+
+    Handle _handle;
+};
+
+/*!
+ \brief Awaited by an #beehive::Action to return RUNNING and continue on the next tick.
+*/
+struct NextTick
+{
+    /// @cond
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<>) const noexcept {}
+
+    void await_resume() const noexcept {}
+    /// @endcond
+};
+
+constexpr NextTick next_tick{}; //!< `co_await beehive::next_tick;` in an #beehive::Action.
+#endif // BEEHIVE_COROUTINES
+
+class BlackboardSchema;
+class Blackboard;
+
+/*!
+ \brief A typed handle to one value of a #beehive::Blackboard, resolved once by
+    #beehive::BlackboardSchema::add or #beehive::BlackboardSchema::key.
+*/
+template<typename T>
+class BlackboardKey
+{
+public:
+    using value_type = T; //!< The type of the value.
+
+    /*!
+     \brief Returns the byte offset of the value in each blackboard.
+    */
+    size_t offset() const
+    {
+        return _offset;
+    }
+
+private:
+    friend class BlackboardSchema;
+    friend class Blackboard;
+
+    explicit BlackboardKey(size_t offset)
+        : _offset(static_cast<uint32_t>(offset))
+    {}
+
+    uint32_t _offset;
+};
+
+/*!
+ \brief The named, typed values every #beehive::Blackboard made from it holds.
+
+    Add the keys once, look them up by name while building the tree, and let the
+    leaves capture the resulting #beehive::BlackboardKey. Values are laid out one
+    after another in the order they were added, so keys used together should be
+    added together. Only trivially copyable types can be stored.
+*/
+class BlackboardSchema
+{
+public:
+    /*!
+     \brief Adds a value named `name` that new blackboards start with `initial`.
+
+        Throws std::invalid_argument if a value was already added as `name`.
+    */
+    template<typename T>
+    BlackboardKey<T> add(std::string name, T const &initial = T{})
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Blackboard values must be trivially copyable!");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "Blackboard values can't be over-aligned!");
+        if (find(name) != nullptr) {
+            throw std::invalid_argument("blackboard key \"" + name + "\" already added");
+        }
+        auto const offset = (_initial.size() + alignof(T) - 1) / alignof(T) * alignof(T);
+        assert(offset + sizeof(T) <= UINT32_MAX); // blackboard too large!
+        _initial.resize(offset + sizeof(T));
+        std::memcpy(_initial.data() + offset, &initial, sizeof(T));
+        _entries.push_back({std::move(name), offset, detail::type_tag<T>()});
+        return BlackboardKey<T>{offset};
+    }
+
+    /*!
+     \brief Returns the key of the value added as `name`, which must have type T.
+
+        Throws std::invalid_argument if no value was added as `name`, or if it
+        has another type.
+    */
+    template<typename T>
+    BlackboardKey<T> key(std::string const &name) const
+    {
+        auto const *entry = find(name);
+        if (entry == nullptr) {
+            throw std::invalid_argument("no blackboard key named \"" + name + "\"");
+        }
+        if (entry->type != detail::type_tag<T>()) {
+            throw std::invalid_argument("blackboard key \"" + name + "\" has another type");
+        }
+        return BlackboardKey<T>{entry->offset};
+    }
+
+    /*!
+     \brief Returns whether a value was added as `name`.
+    */
+    bool contains(std::string const &name) const
+    {
+        return find(name) != nullptr;
+    }
+
+    /*!
+     \brief Returns the number of bytes of values in each blackboard.
+    */
+    size_t size() const
+    {
+        return _initial.size();
+    }
+
+    /*!
+     \brief Creates a blackboard holding the initial values.
+    */
+    Blackboard make_blackboard() const;
+
+private:
+    friend class Blackboard;
+
+    struct Entry
+    {
+        std::string name;
+        size_t offset;
+        void const *type;
+    };
+
+    Entry const *find(std::string const &name) const
+    {
+        for (auto const &entry : _entries) {
+            if (entry.name == name) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<Entry> _entries;
+    std::vector<unsigned char> _initial;
+};
+
+/*!
+ \brief One agent's values of a #beehive::BlackboardSchema, kept in one flat
+    buffer and read through keys without any lookup.
+
+    Use it as the tree's context, or derive the context from it, and adapt
+    leaves over single values with #beehive::with_key.
+*/
+class Blackboard
+{
+public:
+    /*!
+     \brief Creates a blackboard holding the schema's initial values.
+    */
+    explicit Blackboard(BlackboardSchema const &schema)
+        : _storage((schema.size() + sizeof(Storage) - 1) / sizeof(Storage))
+    {
+        if (schema.size() > 0) {
+            std::memcpy(_storage.data(), schema._initial.data(), schema.size());
+        }
+    }
+
+    /*!
+     \brief Returns the value of the given key.
+    */
+    template<typename T>
+    T &operator[](BlackboardKey<T> key)
+    {
+        assert(key._offset + sizeof(T) <= _storage.size() * sizeof(Storage)); // key of another schema!
+        return *reinterpret_cast<T *>(reinterpret_cast<unsigned char *>(_storage.data()) + key._offset);
+    }
+
+    /*!
+     \brief Returns the value of the given key.
+    */
+    template<typename T>
+    T const &operator[](BlackboardKey<T> key) const
+    {
+        assert(key._offset + sizeof(T) <= _storage.size() * sizeof(Storage)); // key of another schema!
+        return *reinterpret_cast<T const *>(reinterpret_cast<unsigned char const *>(_storage.data()) + key._offset);
+    }
+
+    /*!
+     \brief Returns the value of the given key.
+    */
+    template<typename T>
+    T const &get(BlackboardKey<T> key) const
+    {
+        return (*this)[key];
+    }
+
+    /*!
+     \brief Sets the value of the given key.
+    */
+    template<typename T>
+    void set(BlackboardKey<T> key, T const &value)
+    {
+        (*this)[key] = value;
+    }
+
+private:
+    using Storage = std::max_align_t;
+
+    std::vector<Storage> _storage;
+};
+
+inline Blackboard BlackboardSchema::make_blackboard() const
+{
+    return Blackboard{*this};
+}
+
+/// @cond
+template<typename T, typename F>
+struct KeyLeaf
+{
+    auto operator()(Blackboard &blackboard) -> decltype(std::declval<F &>()(blackboard[std::declval<BlackboardKey<T>>()]))
+    {
+        return function(blackboard[key]);
+    }
+
+    BlackboardKey<T> key;
+    F function;
+};
+/// @endcond
+
+/*!
+ \brief Adapts a function of one blackboard value into a leaf for trees whose
+    context is, or derives from, #beehive::Blackboard.
+
+    The function takes a `T &` (or `T const &`, or a copy) and returns a Status,
+    a bool or anything else like any other leaf. For example:
+
+        auto const health = schema.key<float>("health");
+        builder.leaf(with_key(health, [](float health) { return health > 0; }));
+*/
+template<typename T, typename F>
+KeyLeaf<T, typename std::decay<F>::type> with_key(BlackboardKey<T> key, F &&function)
+{
+    return {key, std::forward<F>(function)};
+}
+
+/// @cond
+template<typename F>
+struct BatchScorer
+{
+    template<typename... Args>
+    auto operator()(Args &&... args) -> decltype(std::declval<F &>()(std::forward<Args>(args)...))
+    {
+        return score(std::forward<Args>(args)...);
+    }
+
+    F score;
+};
+/// @endcond
+
+/*!
+ \brief Marks a utility selector's scorer as one that process_batch() may call
+    once for the whole batch. See #beehive::BuilderBase::utility_selector.
+
+    `score` must also be callable as `score(Span<C const> contexts, Span<float> scores)`,
+    writing the score of child `i` for context `j` to `scores[i * contexts.size() + j]`.
+    The batch is scored when its first entity reaches the selector, before the
+    others have run the nodes in front of it, and every later visit in the
+    same call reuses those scores. So the scorer must only read what no node
+    changes during a tick; otherwise leave it unmarked, and each entity is
+    scored when it reaches the selector. For example:
+
+        builder.utility_selector(batch_scored(NeedsScorer{}));
+*/
+template<typename F>
+BatchScorer<typename std::decay<F>::type> batch_scored(F &&score)
+{
+    return {std::forward<F>(score)};
+}
+
+template<typename ContextType, typename A>
+class CompiledTree;
+
+/// @cond
+namespace detail {
+
+template<typename F>
+struct is_batch_scorer : std::false_type {};
+
+template<typename F>
+struct is_batch_scorer<BatchScorer<F>> : std::true_type {};
+
+// Whether a utility selector's scorer also scores a span of contexts at once.
+template<typename F, typename C, typename = void>
+struct has_batch_score : std::false_type {};
+
+template<typename F, typename C>
+struct has_batch_score<F, C, decltype(void(std::declval<F &>()(std::declval<Span<C const>>(), std::declval<Span<float>>())))>
+    : std::true_type {};
+
+// The scores of the utility selectors with batch_scored() scorers, for the
+// contexts of the process_batch() call running on this thread. A selector scores every
+// context of the batch when the first of them reaches it, keeping the scores
+// child by child: the score of child `i` for context `j` is at `i * size + j`.
+template<typename C>
+class BatchScores
+{
+public:
+    explicit BatchScores(Span<C> contexts)
+        : _contexts(contexts.data(), contexts.size())
+        , _outer(current())
+    {
+        current() = this;
+    }
+
+    ~BatchScores()
+    {
+        current() = _outer;
+    }
+
+    BatchScores(BatchScores const &) = delete;
+    BatchScores &operator=(BatchScores const &) = delete;
+
+    static BatchScores *&current()
+    {
+        static thread_local BatchScores *scores = nullptr;
+        return scores;
+    }
+
+    // Copies the scores of the node's children for the given context, scoring
+    // the whole batch first if needed. Returns false if the context isn't part
+    // of the batch.
+    template<typename F>
+    bool find(F &score, Node<C> const &node, C const &context, Span<float> scores)
+    {
+        std::less<C const *> const less;
+        auto const *first = _contexts.data();
+        auto const size = _contexts.size();
+        if (less(&context, first) || !less(&context, first + size)) {
+            return false;
+        }
+        auto it = std::find_if(_scored.begin(), _scored.end(), [&](Scored const &scored) {
+            return scored.node == &node;
+        });
+        if (it == _scored.end()) {
+            _scored.push_back({&node, std::vector<float>(scores.size() * size)});
+            it = _scored.end() - 1;
+            score(_contexts, Span<float>(it->scores));
+        }
+        auto const entity = static_cast<size_t>(&context - first);
+        for (size_t i = 0; i < scores.size(); ++i) {
+            scores[i] = it->scores[i * size + entity];
+        }
+        return true;
+    }
+
+private:
+    struct Scored
+    {
+        Node<C> const *node;
+        std::vector<float> scores;
+    };
+
+    Span<C const> _contexts;
+    BatchScores *_outer;
+    std::vector<Scored> _scored;
+};
+
+// The results of the shared() decorators for the contexts of the
+// process_batch_shared() call running on this thread. Contexts with equal keys
+// are numbered as one group, and each decorator keeps the status plus one of
+// every group, or 0 until a group's status is known.
+template<typename C>
+class SharedResults
+{
+public:
+    template<typename Key>
+    SharedResults(Span<C> contexts, Key &key)
+        : _contexts(contexts.data(), contexts.size())
+        , _outer(current())
+    {
+        using K = typename std::decay<decltype(detail::invoke(key, std::declval<C const &>()))>::type;
+        std::unordered_map<K, uint32_t> groups;
+        _groups.reserve(contexts.size());
+        for (auto const &context : _contexts) {
+            auto const group = static_cast<uint32_t>(groups.size());
+            _groups.push_back(groups.emplace(detail::invoke(key, context), group).first->second);
+        }
+        _group_count = groups.size();
+        current() = this;
+    }
+
+    ~SharedResults()
+    {
+        current() = _outer;
+    }
+
+    SharedResults(SharedResults const &) = delete;
+    SharedResults &operator=(SharedResults const &) = delete;
+
+    static SharedResults *&current()
+    {
+        static thread_local SharedResults *results = nullptr;
+        return results;
+    }
+
+    // Sets the status shared by the context's group at the node, or RUNNING if
+    // none is yet. Returns false if the context isn't part of the batch.
+    bool find(Node<C> const &node, C const &context, Status &status)
+    {
+        size_t group;
+        if (!find_group(context, group)) {
+            return false;
+        }
+        auto const result = results(node)[group];
+        status = result == 0 ? Status::RUNNING : static_cast<Status>(result - 1);
+        return true;
+    }
+
+    void store(Node<C> const &node, C const &context, Status status)
+    {
+        size_t group;
+        if (status != Status::RUNNING && find_group(context, group)) {
+            results(node)[group] = static_cast<uint8_t>(static_cast<uint8_t>(status) + 1);
+        }
+    }
+
+private:
+    struct Shared
+    {
+        Node<C> const *node;
+        std::vector<uint8_t> results;
+    };
+
+    bool find_group(C const &context, size_t &group) const
+    {
+        std::less<C const *> const less;
+        auto const *first = _contexts.data();
+        if (less(&context, first) || !less(&context, first + _contexts.size())) {
+            return false;
+        }
+        group = _groups[static_cast<size_t>(&context - first)];
+        return true;
+    }
+
+    std::vector<uint8_t> &results(Node<C> const &node)
+    {
+        auto it = std::find_if(_shared.begin(), _shared.end(), [&](Shared const &shared) {
+            return shared.node == &node;
+        });
+        if (it == _shared.end()) {
+            _shared.push_back({&node, std::vector<uint8_t>(_group_count)});
+            it = _shared.end() - 1;
+        }
+        return it->results;
+    }
+
+    Span<C const> _contexts;
+    SharedResults *_outer;
+    std::vector<uint32_t> _groups;
+    size_t _group_count{};
+    std::vector<Shared> _shared;
+};
+
+} // namespace detail
+/// @endcond
+
+/*!
+ \brief The default instrumentation of a #beehive::Tree, which adds no code at all.
+*/
+struct NoInstrumentation {};
+
+/*!
+ \brief The bytes a #beehive::Tree takes. See #beehive::Tree::memory_usage.
+*/
+struct MemoryUsage
+{
+    size_t node_count{}; //!< The number of nodes.
+    size_t nodes{}; //!< The array of #beehive::Node, all that walking the tree reads, including unused capacity.
+    size_t bodies{}; //!< The array of #beehive::Node::Body, with the callables stored inline, including unused capacity.
+    size_t callables{}; //!< What node callables keep on the heap, see #beehive::InlineFunction::heap_size. Referenced subtrees aren't counted.
+    size_t state{}; //!< One #beehive::TreeState made by make_state(), see #beehive::TreeState::memory_usage.
+    size_t pooled_state{}; //!< One entity of a #beehive::TreeStatePool, see #beehive::TreeStatePool::bytes_per_entity.
+};
+
+/*!
+ \brief The behavior tree class which passes the ContextType around. See #beehive::Builder for making one.
+
+    The Instrumentation, if any, is called around every node. See #beehive::Tree::instrumented.
+*/
+template<
+    typename ContextType,
+    typename A = std::allocator<Node<ContextType>>,
+    typename Instrumentation = NoInstrumentation
+>
+class Tree
+{
+public:
+    using Context = ContextType;
+
+    Tree(Tree const &other); //!< Copy constructor.
+    Tree(Tree &&other) noexcept; //!< Move constructor.
+    Tree &operator=(Tree const &other); //!< Copy assignment operator.
+    Tree &operator=(Tree &&other); //!< Move assignment operator.
+
+    /*!
+     \brief Process with the given context reference.
+    */
+    Status process(Context &context) const;
+
+    /*!
+     \brief Process with the given state and context reference.
+    */
+    Status process(TreeState &state, Context &context) const;
+
+    /*!
+     \brief Processes many entities in one call, writing each entity's status to the
+        matching element of `statuses`.
+
+        Element `i` of each span belongs to the same entity. All three spans must be
+        the same size. Entities waiting on the same node are processed together so
+        that the node's code and data stay in cache; beyond that, the order in which
+        entities are processed is unspecified.
+    */
+    void process_batch(Span<TreeState> states, Span<Context> contexts, Span<Status> statuses) const;
+
+    /*!
+     \brief Like process_batch() above, but first drains the queue of the tree's
+        #beehive::BuilderBase::async_leaf nodes, then skips the entities still
+        #beehive::TreeState::parked, giving them RUNNING.
+    */
+    void process_batch(Span<TreeState> states, Span<Context> contexts, Span<Status> statuses, AsyncQueue &queue) const;
+
+    /*!
+     \brief Like process_batch() above, but entities whose contexts give equal keys
+        share the results of #beehive::BuilderBase::shared decorators: each such
+        decorator's child runs once per distinct key, not once per entity.
+
+        `key` is called once for each context, as `key(context)` with a const
+        context; its results must be hashable with std::hash and comparable
+        with ==.
+    */
+    template<typename Key>
+    void process_batch_shared(Span<TreeState> states, Span<Context> contexts, Span<Status> statuses, Key &&key) const
+    {
+        detail::SharedResults<Context> shared{contexts, key};
+        process_batch(states, contexts, statuses);
+    }
+
+    /*!
+     \brief Like process() with a state, but stops at the first node that would
+        start after the budget is spent and returns RUNNING. The next tick,
+        budgeted or not, continues from that node.
+
+        Use `budget.exhausted()` to tell such a pause from a node returning
+        RUNNING. A decorator that turns RUNNING into another status, like
+        succeeder(), ends the paused tick there instead. Children run on a
+        thread pool by parallel() are not budgeted.
+    */
+    Status process_budgeted(TreeState &state, Context &context, Budget &budget) const;
+
+    /*!
+     \brief Ticks entities in turn, starting with entity `first`, until each has
+        been ticked once or the budget is spent. Returns the entity to start
+        with next time.
+
+        Writes the status of each entity ticked to the matching element of
+        `statuses`. An entity paused by the budget is the first one ticked next
+        time, so every entity keeps getting its turn however small the budget.
+    */
+    size_t process_round_robin(
+        Span<TreeState> states,
+        Span<Context> contexts,
+        Span<Status> statuses,
+        Budget &budget,
+        size_t first = 0
+    ) const;
+
+    /*!
+     \brief Like process_batch() above, but spreads the entities over the threads of
+        the given pool in chunks of `grain_size`.
+
+        Leaves, composites and decorators must be safe to call concurrently on
+        different contexts. Each chunk is grouped as by the single-threaded version.
+    */
+    void process_batch(
+        Span<TreeState> states,
+        Span<Context> contexts,
+        Span<Status> statuses,
+        ThreadPool &pool,
+        size_t grain_size = ThreadPool::default_grain_size
+    ) const;
+
+    /*!
+     \brief Processes one entity of a state pool with the given context.
+
+        Not safe to call concurrently on the same pool; use process_batch() for that.
+    */
+    Status process(TreeStatePool &pool, size_t entity, Context &context) const;
+
+    /*!
+     \brief Like process_batch() above, with state `i` being entity `i` of the pool.
+    */
+    void process_batch(TreeStatePool &pool, Span<Context> contexts, Span<Status> statuses) const;
+
+    /*!
+     \brief Like process_batch_shared() above, with state `i` being entity `i` of the pool.
+    */
+    template<typename Key>
+    void process_batch_shared(TreeStatePool &pool, Span<Context> contexts, Span<Status> statuses, Key &&key) const
+    {
+        detail::SharedResults<Context> shared{contexts, key};
+        process_batch(pool, contexts, statuses);
+    }
+
+    /*!
+     \brief Like process_batch() above, with state `i` being entity `i` of the pool,
+        and the entities spread over the threads of the given thread pool.
+    */
+    void process_batch(
+        TreeStatePool &pool,
+        Span<Context> contexts,
+        Span<Status> statuses,
+        ThreadPool &threads,
+        size_t grain_size = ThreadPool::default_grain_size
+    ) const;
+
+    /*!
+     \brief Retrieves the nodes, for debugging purposes.
+    */
+    std::vector<Node<Context>, A> const &nodes() const {
+        return _nodes;
+    }
+
+    /*!
+     \brief Creates a state object that can be passed to subsequent process() calls. 
+    */    
+    TreeState make_state() const {  
+        return {_id, _depth + 1, _slot_count}; // room for a node stopped by a budget
+    }
+
+    /*!
+     \brief Creates compact resume state for `size` entities, which can be passed to
+        subsequent process() and process_batch() calls.
+    */
+    TreeStatePool make_state_pool(size_t size = 0) const {
+        return {_id, _nodes.size(), _depth, size};
+    }
+
+    /*!
+     \brief Returns how many bytes the tree and the state of each entity take.
+
+        Most of a node's body is the inline storage of its callable, whose
+        capacity BEEHIVE_FUNCTION_CAPACITY sets.
+    */
+    MemoryUsage memory_usage() const;
+
+    /*!
+     \brief Returns a hash of the tree's structure: the kind, child count and
+        state needs of every node.
+
+        Unlike the ID that ties a state to its tree, the hash is the same in
+        every process and run, so trees built the same way anywhere accept each
+        other's state snapshots. See encode_states().
+    */
+    uint64_t structure_hash() const {
+        return _hash;
+    }
+
+    /*!
+     \brief Appends a snapshot of the given states to `out`, which a tree with the
+        same structure_hash(), in this process or another, can restore with
+        decode_states().
+
+        Each state is written as variable-length integers: its resume path, the
+        values kept by reactive() caches and parallel() composites, and the
+        paths of running parallel children, so a state that isn't running takes
+        a few bytes. Coroutine frames can't be saved; a restored
+        #beehive::BuilderBase::action starts over.
+    */
+    void encode_states(Span<TreeState const> states, std::vector<unsigned char> &out) const;
+
+    /*!
+     \brief Restores the states of a snapshot made by encode_states() into the
+        given states, made by this tree, and returns the number of bytes read.
+
+        There must be as many states as were encoded. Throws
+        std::runtime_error if the snapshot is malformed, resumes nodes this tree
+        can't resume, or was made for a tree with another structure hash.
+        Pending #beehive::BuilderBase::async_leaf operations start over.
+    */
+    size_t decode_states(void const *data, size_t size, Span<TreeState> states) const;
+
+    /*!
+     \brief Returns what moves the states made by `previous` over to this tree,
+        like when a changed version of a tree is loaded. See #beehive::StateMigration
+        and #beehive::TreeHandle.
+    */
+    template<typename OtherA, typename OtherI>
+    StateMigration migration_from(Tree<Context, OtherA, OtherI> const &previous) const;
+
+    /*!
+     \brief Returns a copy of the tree that runs on the flat interpreter. See #beehive::CompiledTree.
+    */
+    CompiledTree<Context, A> compile() const;
+
+    /*!
+     \brief Returns a copy of the tree that does the same with fewer nodes.
+
+        Forwarders are removed, including the root's and the one each tree
+        added with #beehive::BuilderBase::tree brings along. Pairs of inverters
+        cancel out, and a sequence or selector directly inside another of the
+        same kind is merged into it. Children of sequences added with
+        #beehive::BuilderBase::condition move ahead of their siblings, in their
+        original order. States of this tree can't be used with the copy.
+    */
+    Tree optimized() const;
+
+    /*!
+     \brief Returns a copy of the tree that calls the given instrumentation around
+        every node.
+
+        The instrumentation must provide `enter(size_t index)`, whose result is
+        passed back to `leave(size_t index, Status status, result)` once the node
+        with the given #beehive::Node::index returns. See #beehive::Profiler.
+        Instrumentation whose `enter()` also takes the entity's `TreeState const &`
+        gets it as a last argument of `leave()` too. See #beehive::Tracer.
+        Copies of the returned tree share the instrumentation.
+    */
+    template<typename I>
+    Tree<Context, A, I> instrumented(I instrumentation = {}) const;
+
+    /*!
+     \brief Returns the instrumentation of a tree made by instrumented().
+    */
+    Instrumentation &instrumentation() const {
+        assert(_instrumented); // not an instrumented tree!
+        return _instrumented->instrumentation;
+    }
+
+private:
+    template<typename C, typename Allocator>
+    friend class BuilderBase;
+
+    template<typename C, typename Allocator>
+    friend class Builder;
+
+    friend class CompiledTree<Context, A>;
+
+    template<typename C, typename Allocator, typename I>
+    friend class Tree;
+
+    template<typename C>
+    friend class FunctionTable;
+
+    template<typename C, typename Allocator>
+    friend class TreeHandle;
+    
+    using Body = typename Node<Context>::Body;
+    using BodyAllocator = typename std::allocator_traits<A>::template rebind_alloc<Body>;
+    using Bodies = std::vector<Body, BodyAllocator>;
+
+    /*!
+     \brief Constructs a tree with nodes for the given bodies.
+        See #beehive::Builder.
+    */
+    Tree(Bodies bodies);
+
+    // Points the nodes at the bodies, after both were copied or moved.
+    void link();
+
+    // The node process functions that instrumented processes call, and what
+    // they report to. Shared by copies so that the pointers stay valid.
+    struct Instrumented
+    {
+        Instrumentation instrumentation;
+        std::vector<typename Node<Context>::ProcessFunction> processes;
+    };
+
+    static constexpr size_t batch_grouping_min_nodes = 64;
+
+    template<typename ResumeIndex, typename Process>
+    void process_grouped(size_t count, ResumeIndex &&resume_index, Process &&process) const;
+
+    void process_pool_range(
+        TreeStatePool &pool,
+        TreeState &scratch,
+        Span<Context> contexts,
+        Span<Status> statuses,
+        size_t begin,
+        size_t end
+    ) const;
+
+    // See optimized().
+    size_t skip_redundant(size_t index) const;
+    void add_children(size_t index, detail::Opcode merged, std::vector<size_t> &children) const;
+    void add_optimized(size_t index, Bodies &bodies) const;
+
+    std::vector<Node<Context>, A> _nodes;
+    Bodies _bodies; // what each node runs, apart from what walking the tree reads
+    size_t _depth{}; // the most branch nodes on any path from the root
+    size_t _slot_count{}; // per-entity values needed by all nodes
+    size_t _id{id()};
+    uint64_t _hash{}; // see structure_hash()
+    std::shared_ptr<Instrumented> _instrumented;
+};
+
+template<typename C, typename A, typename I>
+Tree<C, A, I>::Tree(Bodies bodies)
+    : _nodes(bodies.size(), A(bodies.get_allocator()))
+    , _bodies(std::move(bodies))
+{
+    assert(_nodes.size() <= UINT32_MAX); // tree too large!
+    link();
+
+    // Walk backwards so that every child's subtree size is known before its
+    // parent needs it. Children are then skipped in constant time each.
+    std::vector<size_t> depths(_nodes.size());
+    for (auto i = _nodes.size(); i-- > 0;) {
+        auto &node = _nodes[i];
+        auto const &body = _bodies[i];
+        node._index = static_cast<uint32_t>(i);
+        node._child_count = body.child_count;
+        size_t count = 0;
+        size_t depth = 0;
+        auto child = i + 1;
+        for (size_t c = 0; c < node._child_count; ++c) {
+            auto const size = _nodes[child]._descendent_count + 1;
+            depth = std::max(depth, depths[child] + 1);
+            count += size;
+            child += size;
+        }
+        node._descendent_count = static_cast<uint32_t>(count);
+        depths[i] = std::max<size_t>(depth, body.subtree_depth);
+    }
+    _depth = _nodes.empty() ? 0 : depths[0];
+
+    // FNV-1a over what states depend on, byte by byte so it is stable everywhere.
+    uint64_t hash = 14695981039346656037ull;
+    auto const mix = [&hash](uint64_t value) {
+        for (size_t byte = 0; byte < 8; ++byte) {
+            hash = (hash ^ ((value >> (8 * byte)) & 0xff)) * 1099511628211ull;
+        }
+    };
+    mix(_nodes.size());
+    std::vector<std::pair<uint32_t, uint32_t>> memos; // the slot of each memoized leaf
+    for (auto &node : _nodes) {
+        auto const &body = *node._body;
+        node._slot = static_cast<uint32_t>(_slot_count);
+        if (body.memo == Node<C>::unmemoized) {
+            _slot_count += body.slot_count;
+        } else {
+            auto const it = std::find_if(memos.begin(), memos.end(), [&body](std::pair<uint32_t, uint32_t> memo) {
+                return memo.first == body.memo;
+            });
+            if (it == memos.end()) {
+                memos.emplace_back(body.memo, node._slot);
+                _slot_count += body.slot_count;
+            } else {
+                node._slot = it->second; // copies share their cache
+            }
+        }
+        mix(static_cast<uint64_t>(body.opcode));
+        mix(node._child_count);
+        mix(body.subtree_depth);
+        mix(body.slot_count);
+    }
+    assert(_slot_count <= UINT32_MAX); // too many slots!
+    _hash = hash;
+}
+
+template<typename C, typename A, typename I>
+Tree<C, A, I>::Tree(Tree const &other)
+    : _nodes(other._nodes)
+    , _bodies(other._bodies)
+    , _depth(other._depth)
+    , _slot_count(other._slot_count)
+    , _id(other._id)
+    , _hash(other._hash)
+    , _instrumented(other._instrumented)
+{
+    link();
+}
+
+template<typename C, typename A, typename I>
+Tree<C, A, I>::Tree(Tree &&other) noexcept
+    : _nodes(std::move(other._nodes))
+    , _bodies(std::move(other._bodies))
+    , _depth(other._depth)
+    , _slot_count(other._slot_count)
+    , _id(other._id)
+    , _hash(other._hash)
+    , _instrumented(std::move(other._instrumented))
+{
+    link();
+}
+
+template<typename C, typename A, typename I>
+auto Tree<C, A, I>::operator=(Tree const &other) -> Tree &
+{
+    if (this != &other) {
+        Tree copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+template<typename C, typename A, typename I>
+auto Tree<C, A, I>::operator=(Tree &&other) -> Tree &
+{
+    if (this != &other) {
+        _nodes = std::move(other._nodes);
+        _bodies = std::move(other._bodies);
+        _depth = other._depth;
+        _slot_count = other._slot_count;
+        _id = other._id;
+        _hash = other._hash;
+        _instrumented = std::move(other._instrumented);
+        link();
+    }
+    return *this;
+}
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::link()
+{
+    for (size_t i = 0; i < _nodes.size(); ++i) {
+        _nodes[i]._body = &_bodies[i];
+    }
+}
+
+/// @cond
+namespace detail
+{
+
+// The start of a state snapshot, followed by the hash as 8 little-endian bytes
+// and the number of states.
+constexpr char state_snapshot_magic[4] = {'B', 'H', 'V', 'S'};
+
+} // namespace detail
+/// @endcond
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::encode_states(Span<TreeState const> states, std::vector<unsigned char> &out) const
+{
+    using detail::write_varint;
+    out.insert(out.end(), std::begin(detail::state_snapshot_magic), std::end(detail::state_snapshot_magic));
+    for (size_t byte = 0; byte < 8; ++byte) {
+        out.push_back(static_cast<unsigned char>(_hash >> (8 * byte)));
+    }
+    write_varint(out, states.size());
+
+    // Offsets are written plus one, so that a stopped frame takes a byte.
+    auto const write_frames = [&out](TreeState::Frame const *frames, size_t count) {
+        write_varint(out, count);
+        for (size_t i = 0; i < count; ++i) {
+            write_varint(out, frames[i].index);
+            write_varint(out, static_cast<uint32_t>(frames[i].offset + 1));
+        }
+    };
+    for (auto const &state : states) {
+        assert(state._tree_id == _id); // another tree's state used with this tree
+        write_frames(state._frames.data(), state._depth);
+        write_varint(out, state._slots.size());
+        if (state._slots.empty()) {
+            continue;
+        }
+        for (auto const value : state._slots) {
+            write_varint(out, value);
+        }
+        write_varint(out, state._version);
+        write_varint(out, state._tick);
+        uint64_t keys = 0;
+        for (size_t key = 0; key < state._key_versions.size(); ++key) {
+            keys |= static_cast<uint64_t>(state._key_versions[key] != 0) << key;
+        }
+        write_varint(out, keys);
+        for (auto const version : state._key_versions) {
+            if (version != 0) {
+                write_varint(out, version);
+            }
+        }
+        size_t running = 0;
+        for (auto const &path : state._paths) {
+            running += !path.empty();
+        }
+        write_varint(out, running);
+        for (size_t slot = 0; slot < state._paths.size(); ++slot) {
+            if (!state._paths[slot].empty()) {
+                write_varint(out, slot);
+                write_frames(state._paths[slot].data(), state._paths[slot].size());
+            }
+        }
+    }
+}
+
+template<typename C, typename A, typename I>
+size_t Tree<C, A, I>::decode_states(void const *data, size_t size, Span<TreeState> states) const
+{
+    auto const *bytes = static_cast<unsigned char const *>(data);
+    constexpr size_t header_size = sizeof(detail::state_snapshot_magic) + 8;
+    if (size < header_size || std::memcmp(bytes, detail::state_snapshot_magic, sizeof(detail::state_snapshot_magic)) != 0) {
+        throw std::runtime_error("not a state snapshot");
+    }
+    uint64_t hash = 0;
+    for (size_t byte = 0; byte < 8; ++byte) {
+        hash |= static_cast<uint64_t>(bytes[sizeof(detail::state_snapshot_magic) + byte]) << (8 * byte);
+    }
+    if (hash != _hash) {
+        throw std::runtime_error("state snapshot was made for a tree of another structure");
+    }
+    detail::VarintReader reader{bytes + header_size, bytes + size};
+    if (reader.read() != states.size()) {
+        throw std::runtime_error("state snapshot has another number of states");
+    }
+
+    // Every frame must resume a node of this tree that pushes frames, at one
+    // of its children. Frames are innermost first; those inside a referenced
+    // subtree index the other tree, see CompositeProcess.
+    auto const check_frames = [this](TreeState::Frame const *frames, size_t count) {
+        for (auto level = count; level-- > 0;) {
+            auto const &frame = frames[level];
+            if (frame.index >= _nodes.size()) {
+                throw std::runtime_error("state snapshot resumes past the end of the tree");
+            }
+            auto const child_count = _nodes[frame.index]._child_count;
+            auto const &body = _bodies[frame.index];
+            auto const resumable = child_count > 0 || body.subtree_depth > 0;
+            if (frame.offset != TreeState::stopped
+                && (!resumable || frame.offset >= std::max<uint32_t>(child_count, 1))) {
+                throw std::runtime_error("state snapshot resumes a node that can't be resumed there");
+            }
+            if (body.opcode == detail::Opcode::SUBTREE) {
+                break;
+            }
+        }
+    };
+    auto const frame_count = _depth + 1;
+    auto const read_frames = [&reader, &check_frames, frame_count](std::vector<TreeState::Frame> &frames, size_t &count) {
+        count = static_cast<size_t>(reader.read(frame_count));
+        if (frames.size() < count) {
+            frames.resize(count);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            frames[i].index = static_cast<uint32_t>(reader.read(UINT32_MAX));
+            frames[i].offset = static_cast<uint32_t>(reader.read(UINT32_MAX)) - 1;
+        }
+        check_frames(frames.data(), count);
+    };
+    for (auto &state : states) {
+        assert(state._tree_id == _id); // another tree's state used with this tree
+        if (state._frames.size() < frame_count) {
+            state._frames.resize(frame_count);
+        }
+        read_frames(state._frames, state._depth);
+        state._cursor = 0;
+        state._slot_base = 0;
+        state._actions = {}; // frames of running actions stay behind
+        state._async = {}; // and so do pending async operations
+        state._parked = false;
+        state.end(state._depth > 0 ? Status::RUNNING : Status::SUCCESS);
+
+        auto const slot_count = reader.read(_slot_count);
+        if (slot_count != 0 && slot_count != _slot_count) {
+            throw std::runtime_error("state snapshot has another number of slots");
+        }
+        state._slots.resize(slot_count);
+        state._key_versions.assign(slot_count > 0 ? 64 : 0, 0);
+        state._paths.clear();
+        if (slot_count == 0) {
+            continue;
+        }
+        for (auto &value : state._slots) {
+            value = static_cast<uint32_t>(reader.read(UINT32_MAX));
+        }
+        state._version = static_cast<uint32_t>(reader.read(UINT32_MAX));
+        state._tick = static_cast<uint32_t>(reader.read(UINT32_MAX));
+        auto const keys = reader.read();
+        for (size_t key = 0; key < 64; ++key) {
+            if ((keys >> key) & 1) {
+                state._key_versions[key] = static_cast<uint32_t>(reader.read(UINT32_MAX));
+            }
+        }
+        auto const running = reader.read(slot_count);
+        if (running > 0) {
+            state._paths.resize(slot_count);
+        }
+        for (uint64_t i = 0; i < running; ++i) {
+            auto const slot = static_cast<size_t>(reader.read(slot_count - 1));
+            size_t count = 0;
+            read_frames(state._paths[slot], count);
+            state._paths[slot].resize(count);
+        }
+    }
+    return static_cast<size_t>(reader.position - bytes);
+}
+
+/// @cond
+// Reports a node's call to the tree's instrumentation around the node's own
+// process function.
+template<typename C, typename Instrumented>
+struct InstrumentedProcess
+{
+    template<typename I, typename = void>
+    struct TakesState : std::false_type {};
+
+    template<typename I>
+    struct TakesState<I, decltype(void(std::declval<I &>().enter(size_t{}, std::declval<TreeState const &>())))>
+        : std::true_type {};
+
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        return process(context, self, state, TakesState<decltype(instrumented->instrumentation)>{});
+    }
+
+    Status process(C &context, Node<C> const &self, TreeState &state, std::false_type)
+    {
+        auto const index = self.index();
+        auto &&entered = instrumented->instrumentation.enter(index);
+        auto const status = instrumented->processes[index](context, self, state);
+        instrumented->instrumentation.leave(index, status, entered);
+        return status;
+    }
+
+    Status process(C &context, Node<C> const &self, TreeState &state, std::true_type)
+    {
+        auto const index = self.index();
+        auto &&entered = instrumented->instrumentation.enter(index, state);
+        auto const status = instrumented->processes[index](context, self, state);
+        instrumented->instrumentation.leave(index, status, entered, state);
+        return status;
+    }
+
+    Instrumented *instrumented;
+};
+/// @endcond
+
+template<typename C, typename A, typename I>
+template<typename Instrumentation>
+Tree<C, A, Instrumentation> Tree<C, A, I>::instrumented(Instrumentation instrumentation) const
+{
+    static_assert(std::is_same<I, NoInstrumentation>::value, "the tree is already instrumented");
+    using InstrumentedTree = Tree<C, A, Instrumentation>;
+    using Instrumented = typename InstrumentedTree::Instrumented;
+    InstrumentedTree tree{_bodies};
+    tree._id = _id; // same structure, so states can be shared
+    tree._instrumented = std::make_shared<Instrumented>(Instrumented{std::move(instrumentation), {}});
+    auto &processes = tree._instrumented->processes;
+    processes.reserve(tree._bodies.size());
+    for (auto &body : tree._bodies) {
+        processes.push_back(std::move(body.process));
+        body.process = InstrumentedProcess<C, Instrumented>{tree._instrumented.get()};
+    }
+    return tree;
+}
+
+template<typename C, typename A, typename I>
+MemoryUsage Tree<C, A, I>::memory_usage() const
+{
+    MemoryUsage usage;
+    usage.node_count = _nodes.size();
+    usage.nodes = _nodes.capacity() * sizeof(Node<C>);
+    usage.bodies = _bodies.capacity() * sizeof(Body);
+    for (auto const &body : _bodies) {
+        usage.callables += body.process.heap_size();
+    }
+    if (_instrumented) {
+        usage.callables += _instrumented->processes.capacity() * sizeof(typename Node<C>::ProcessFunction);
+        for (auto const &process : _instrumented->processes) {
+            usage.callables += process.heap_size();
+        }
+    }
+    usage.state = make_state().memory_usage();
+    usage.pooled_state = make_state_pool().bytes_per_entity();
+    return usage;
+}
+
+template<typename C, typename A, typename I>
+Status Tree<C, A, I>::process(Context &context) const
+{
+    TreeState state{_id}; // no room for a path, so nothing to resume or allocate
+    return _nodes[0].process(context, state);
+}
+
+template<typename C, typename A, typename I>
+Status Tree<C, A, I>::process(TreeState &state, Context &context) const
+{
+    assert(state._tree_id == _id); // another tree's state used with this tree 
+    state.begin();
+    auto const status = _nodes[0].process(context, state);
+    state.end(status);
+    return status;
+}
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::process_batch(
+    Span<TreeState> states,
+    Span<Context> contexts,
+    Span<Status> statuses,
+    ThreadPool &pool,
+    size_t grain_size
+) const
+{
+    assert(states.size() == contexts.size()); // one context per state!
+    assert(states.size() == statuses.size()); // one status per state!
+    pool.parallel_for(states.size(), grain_size, [&](size_t begin, size_t end) {
+        auto const count = end - begin;
+        process_batch(states.subspan(begin, count), contexts.subspan(begin, count), statuses.subspan(begin, count));
+    });
+}
+
+template<typename C, typename A, typename I>
+Status Tree<C, A, I>::process_budgeted(TreeState &state, Context &context, Budget &budget) const
+{
+    state._budget = &budget;
+    struct Reset
+    {
+        ~Reset() { state._budget = nullptr; }
+        TreeState &state;
+    } reset{state};
+    return process(state, context);
+}
+
+template<typename C, typename A, typename I>
+size_t Tree<C, A, I>::process_round_robin(
+    Span<TreeState> states,
+    Span<Context> contexts,
+    Span<Status> statuses,
+    Budget &budget,
+    size_t first
+) const
+{
+    assert(states.size() == contexts.size()); // one context per state!
+    assert(states.size() == statuses.size()); // one status per state!
+    auto const count = states.size();
+    if (count == 0) {
+        return 0;
+    }
+    auto i = first % count;
+    for (size_t ticked = 0; ticked < count; ++ticked) {
+        statuses[i] = process_budgeted(states[i], contexts[i], budget);
+        if (budget.exhausted()) {
+            return i; // paused, possibly before even starting
+        }
+        i = (i + 1) % count;
+    }
+    return i;
+}
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::process_batch(Span<TreeState> states, Span<Context> contexts, Span<Status> statuses) const
+{
+    assert(states.size() == contexts.size()); // one context per state!
+    assert(states.size() == statuses.size()); // one status per state!
+    detail::BatchScores<C> scores{contexts};
+    process_grouped(
+        states.size(),
+        [&](size_t i) { return states[i].resume_index; },
+        [&](size_t i) { statuses[i] = process(states[i], contexts[i]); }
+    );
+}
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::process_batch(
+    Span<TreeState> states,
+    Span<Context> contexts,
+    Span<Status> statuses,
+    AsyncQueue &queue
+) const
+{
+    assert(states.size() == contexts.size()); // one context per state!
+    assert(states.size() == statuses.size()); // one status per state!
+    queue.drain();
+    detail::BatchScores<C> scores{contexts};
+    process_grouped(
+        states.size(),
+        [&](size_t i) { return states[i].resume_index; },
+        [&](size_t i) {
+            statuses[i] = states[i].parked() ? Status::RUNNING : process(states[i], contexts[i]);
+        }
+    );
+}
+
+template<typename C, typename A, typename I>
+template<typename ResumeIndex, typename Process>
+void Tree<C, A, I>::process_grouped(size_t count, ResumeIndex &&resume_index, Process &&process) const
+{
+    // Small trees stay in cache regardless of order, so reordering would only
+    // cost time. Usually the batch is also already grouped, e.g. all at the root.
+    bool grouped = true;
+    if (_nodes.size() >= batch_grouping_min_nodes) {
+        for (size_t i = 1; i < count && grouped; ++i) {
+            grouped = resume_index(i - 1) <= resume_index(i);
+        }
+    }
+    if (grouped) {
+        for (size_t i = 0; i < count; ++i) {
+            process(i);
+        }
+        return;
+    }
+
+    // Counting sort of the entities by the node they resume at. Entities inside
+    // a referenced subtree may resume past the end of this tree's nodes; those
+    // share the last bucket.
+    assert(count <= UINT32_MAX); // batch too large!
+    auto const last = _nodes.size() - 1;
+    std::vector<uint32_t> starts(_nodes.size() + 1);
+    for (size_t i = 0; i < count; ++i) {
+        ++starts[std::min(resume_index(i), last) + 1];
+    }
+    std::partial_sum(starts.begin(), starts.end(), starts.begin());
+    std::vector<uint32_t> order(count);
+    for (size_t i = 0; i < count; ++i) {
+        order[starts[std::min(resume_index(i), last)]++] = static_cast<uint32_t>(i);
+    }
+    for (auto i : order) {
+        process(i);
+    }
+}
+
+template<typename C, typename A, typename I>
+Status Tree<C, A, I>::process(TreeStatePool &pool, size_t entity, Context &context) const
+{
+    assert(pool._tree_id == _id); // another tree's state pool used with this tree
+    assert(entity < pool.size()); // out of range!
+    TreeState scratch{_id, _depth}; // no slots, so nothing cached across entities
+    pool.load(entity, scratch);
+    auto const status = process(scratch, context);
+    pool.store(entity, scratch);
+    return status;
+}
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::process_batch(TreeStatePool &pool, Span<Context> contexts, Span<Status> statuses) const
+{
+    assert(pool._tree_id == _id); // another tree's state pool used with this tree
+    assert(pool.size() == contexts.size()); // one context per state!
+    assert(pool.size() == statuses.size()); // one status per state!
+    TreeState scratch{_id, _depth}; // no slots, so nothing cached across entities
+    process_pool_range(pool, scratch, contexts, statuses, 0, pool.size());
+}
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::process_batch(
+    TreeStatePool &pool,
+    Span<Context> contexts,
+    Span<Status> statuses,
+    ThreadPool &threads,
+    size_t grain_size
+) const
+{
+    assert(pool._tree_id == _id); // another tree's state pool used with this tree
+    assert(pool.size() == contexts.size()); // one context per state!
+    assert(pool.size() == statuses.size()); // one status per state!
+    threads.parallel_for(pool.size(), grain_size, [&](size_t begin, size_t end) {
+        TreeState scratch{_id, _depth};
+        process_pool_range(pool, scratch, contexts, statuses, begin, end);
+    });
+}
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::process_pool_range(
+    TreeStatePool &pool,
+    TreeState &scratch,
+    Span<Context> contexts,
+    Span<Status> statuses,
+    size_t begin,
+    size_t end
+) const
+{
+    // The tree was checked once for the whole pool, so skip process(TreeState &)'s check.
+    detail::BatchScores<C> scores{contexts.subspan(begin, end - begin)};
+    process_grouped(
+        end - begin,
+        [&](size_t i) { return pool.resume_index(begin + i); },
+        [&](size_t i) {
+            auto const entity = begin + i;
+            pool.load(entity, scratch);
+            scratch.begin();
+            auto const status = _nodes[0].process(contexts[entity], scratch);
+            scratch.end(status);
+            pool.store(entity, scratch);
+            statuses[entity] = status;
+        }
+    );
+}
+
+template<typename C, typename A, typename I>
+template<typename OtherA, typename OtherI>
+StateMigration Tree<C, A, I>::migration_from(Tree<C, OtherA, OtherI> const &previous) const
+{
+    StateMigration migration;
+    migration._from = previous._id;
+    migration._to = _id;
+    migration._node_count = _nodes.size();
+    migration._depth = _depth;
+    migration._slot_count = _slot_count;
+    migration._from_slot_count = previous._slot_count;
+    migration._nodes.assign(previous._nodes.size(), StateMigration::Match{StateMigration::none, false});
+
+    // Pairs of nodes in the same place of both trees, from the root down.
+    std::vector<std::pair<size_t, size_t>> pending{{0, 0}};
+    while (!pending.empty()) {
+        auto const from = pending.back().first;
+        auto const to = pending.back().second;
+        pending.pop_back();
+        auto const &old_node = previous._nodes[from];
+        auto const &node = _nodes[to];
+        auto const &old_body = previous._bodies[from];
+        auto const &body = _bodies[to];
+        if (old_body.opcode != body.opcode || old_node._child_count != node._child_count) {
+            continue; // neither it nor anything below it matches
+        }
+        auto const opcode = body.opcode;
+        auto const subtree = opcode == detail::Opcode::SUBTREE;
+        migration._nodes[from] = {static_cast<uint32_t>(to), subtree};
+
+        // Leaves keep coroutine frames, and subtrees the slots of another tree.
+        auto const kept = opcode != detail::Opcode::CALL && opcode != detail::Opcode::LEAF && !subtree;
+        if (kept && body.slot_count > 0 && body.slot_count == old_body.slot_count) {
+            migration._slots.push_back({old_node._slot, node._slot, body.slot_count, opcode == detail::Opcode::PARALLEL});
+        }
+
+        auto old_child = from + 1;
+        auto child = to + 1;
+        for (size_t i = 0; i < node._child_count; ++i) {
+            pending.emplace_back(old_child, child);
+            old_child += previous._nodes[old_child]._descendent_count + 1;
+            child += _nodes[child]._descendent_count + 1;
+        }
+    }
+    return migration;
+}
+
+template<typename C, typename A, typename I>
+auto Tree<C, A, I>::optimized() const -> Tree
+{
+    static_assert(std::is_same<I, NoInstrumentation>::value, "instrumented trees can't be optimized");
+    Bodies bodies(_bodies.get_allocator());
+    bodies.reserve(_bodies.size());
+    add_optimized(0, bodies);
+    return {std::move(bodies)};
+}
+
+// Returns the first node from the given one down that does something: past
+// forwarders and pairs of inverters.
+template<typename C, typename A, typename I>
+size_t Tree<C, A, I>::skip_redundant(size_t index) const
+{
+    for (;;) {
+        auto const opcode = _bodies[index].opcode;
+        if (opcode == detail::Opcode::FORWARDER) {
+            ++index;
+        } else if (opcode == detail::Opcode::INVERTER) {
+            auto const child = skip_redundant(index + 1);
+            if (_bodies[child].opcode != detail::Opcode::INVERTER) {
+                return index;
+            }
+            index = child + 1;
+        } else {
+            return index;
+        }
+    }
+}
+
+// Collects the children of the node, with those of children of the merged
+// kind in their place.
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::add_children(size_t index, detail::Opcode merged, std::vector<size_t> &children) const
+{
+    auto child = index + 1;
+    for (size_t i = 0; i < _nodes[index]._child_count; ++i) {
+        auto const kept = skip_redundant(child);
+        if (_bodies[kept].opcode == merged) {
+            add_children(kept, merged, children);
+        } else {
+            children.push_back(kept);
+        }
+        child += _nodes[child]._descendent_count + 1;
+    }
+}
+
+template<typename C, typename A, typename I>
+void Tree<C, A, I>::add_optimized(size_t index, Bodies &bodies) const
+{
+    index = skip_redundant(index);
+    auto const &body = _bodies[index];
+    auto const opcode = body.opcode;
+    auto const merges = opcode == detail::Opcode::SEQUENCE || opcode == detail::Opcode::SELECTOR;
+    std::vector<size_t> children;
+    add_children(index, merges ? opcode : detail::Opcode::CALL, children);
+    if (opcode == detail::Opcode::SEQUENCE) {
+        std::stable_partition(children.begin(), children.end(), [this](size_t child) {
+            return _bodies[child].condition;
+        });
+    }
+    bodies.push_back(body);
+    bodies.back().child_count = static_cast<uint32_t>(children.size());
+    for (auto const child : children) {
+        add_optimized(child, bodies);
+    }
+}
+
+/*!
+ \brief A tree of #beehive::AnyContext that only takes contexts of type `C`, for
+    ticking it without wrapping each context by hand.
+
+    Every TypedTree shares the engine code of Tree<AnyContext>, so many agent
+    types cost no more engine code than one. Batches cost a temporary array of
+    AnyContext references.
+*/
+template<typename C, typename A = std::allocator<Node<AnyContext>>>
+class TypedTree
+{
+public:
+    using TreeType = Tree<AnyContext, A>; //!< The type of tree wrapped.
+
+    /*!
+     \brief Wraps the given tree, whose leaves must all take a `C`.
+    */
+    explicit TypedTree(TreeType tree)
+        : _tree(std::move(tree))
+    {}
+
+    /*!
+     \brief Returns the tree wrapped, such as to make states or save it.
+    */
+    TreeType const &tree() const
+    {
+        return _tree;
+    }
+
+    /*!
+     \brief See #beehive::Tree::process.
+    */
+    Status process(C &context) const
+    {
+        AnyContext any{context};
+        return _tree.process(any);
+    }
+
+    /*!
+     \brief See #beehive::Tree::process.
+    */
+    Status process(TreeState &state, C &context) const
+    {
+        AnyContext any{context};
+        return _tree.process(state, any);
+    }
+
+    /*!
+     \brief See #beehive::Tree::process_batch.
+    */
+    void process_batch(Span<TreeState> states, Span<C> contexts, Span<Status> statuses) const
+    {
+        std::vector<AnyContext> any(contexts.begin(), contexts.end());
+        _tree.process_batch(states, any, statuses);
+    }
+
+    /*!
+     \brief See #beehive::Tree::process_batch.
+    */
+    void process_batch(TreeStatePool &pool, Span<C> contexts, Span<Status> statuses) const
+    {
+        std::vector<AnyContext> any(contexts.begin(), contexts.end());
+        _tree.process_batch(pool, any, statuses);
+    }
+
+    /*!
+     \brief See #beehive::Tree::make_state.
+    */
+    TreeState make_state() const
+    {
+        return _tree.make_state();
+    }
+
+    /*!
+     \brief See #beehive::Tree::make_state_pool.
+    */
+    TreeStatePool make_state_pool(size_t size = 0) const
+    {
+        return _tree.make_state_pool(size);
+    }
+
+private:
+    TreeType _tree;
+};
+
+/*!
+ \brief Shares a tree between threads and replaces it while they tick it, such
+    as to reload a tree on a live server.
+
+    Readers pin the current tree with read() for as long as they use it, which
+    takes no lock. reload() publishes the new tree first and then waits until no
+    reader pins the old one before freeing it, so only the reloading thread waits.
+    Every pin updates a counter shared by all readers, so pin once per batch or
+    frame rather than once per entity.
+
+    States made by a replaced tree are moved over by #beehive::TreeHandle::Reader::update.
+*/
+template<typename C, typename A = std::allocator<Node<C>>>
+class TreeHandle
+{
+public:
+    using TreeType = Tree<C, A>; //!< The type of tree shared.
+
+private:
+    struct Version
+    {
+        TreeType tree;
+        StateMigration migration; // from the tree it replaced
+        uint64_t generation;
+    };
+
+public:
+    /*!
+     \brief A pinned tree, which stays alive until the reader is destroyed.
+    */
+    class Reader
+    {
+    public:
+        /*!
+         \brief Takes over the other reader's pin.
+        */
+        Reader(Reader &&other) noexcept
+            : _version(other._version)
+            , _readers(other._readers)
+        {
+            other._readers = nullptr;
+        }
+
+        Reader &operator=(Reader &&) = delete;
+
+        ~Reader()
+        {
+            if (_readers != nullptr) {
+                _readers->fetch_sub(1);
+            }
+        }
+
+        TreeType const &operator*() const { return _version->tree; } //!< Returns the pinned tree.
+        TreeType const *operator->() const { return &_version->tree; } //!< Returns the pinned tree.
+
+        /*!
+         \brief Returns how many times the handle had been reloaded when the tree was pinned.
+        */
+        uint64_t generation() const
+        {
+            return _version->generation;
+        }
+
+        /*!
+         \brief Makes the state one for the pinned tree. A state of the tree it
+            replaced is migrated, see #beehive::StateMigration; a state of an
+            older tree starts over.
+        */
+        void update(TreeState &state) const
+        {
+            if (state._tree_id == _version->tree._id) {
+                return;
+            }
+            if (_version->migration.applies_to(state)) {
+                _version->migration.migrate(state);
+            } else {
+                auto const trace = state._trace;
+                state = _version->tree.make_state();
+                state._trace = trace;
+            }
+        }
+
+        /*!
+         \brief Like update() above, for a pool of states. A pool of an older tree
+            keeps its size, with every entity starting over.
+        */
+        void update(TreeStatePool &pool) const
+        {
+            if (pool._tree_id == _version->tree._id) {
+                return;
+            }
+            if (_version->migration.applies_to(pool)) {
+                _version->migration.migrate(pool);
+            } else {
+                pool = _version->tree.make_state_pool(pool.size());
+            }
+        }
+
+    private:
+        friend class TreeHandle;
+
+        Reader(Version const *version, std::atomic<size_t> *readers)
+            : _version(version)
+            , _readers(readers)
+        {}
+
+        Version const *_version;
+        std::atomic<size_t> *_readers;
+    };
+
+    /*!
+     \brief Shares the given tree.
+    */
+    explicit TreeHandle(TreeType tree)
+        : _current(new Version{std::move(tree), {}, 0})
+    {}
+
+    TreeHandle(TreeHandle const &) = delete;
+    TreeHandle &operator=(TreeHandle const &) = delete;
+
+    ~TreeHandle()
+    {
+        assert(_readers[0].count == 0 && _readers[1].count == 0); // tree still pinned!
+        delete _current.load();
+    }
+
+    /*!
+     \brief Pins the current tree. Safe to call from any thread without locking.
+    */
+    Reader read() const
+    {
+        auto &readers = _readers[_epoch.load() & 1].count;
+        readers.fetch_add(1);
+        return {_current.load(), &readers};
+    }
+
+    /*!
+     \brief Replaces the tree, and frees the old one once no reader pins it.
+
+        Readers that pin the tree from now on get the new one. Must not be called
+        while the calling thread pins the tree, or it waits forever. Reloads from
+        several threads take turns.
+    */
+    void reload(TreeType tree);
+
+private:
+    struct alignas(64) Readers
+    {
+        std::atomic<size_t> count{};
+    };
+
+    std::atomic<Version *> _current;
+
+    // Readers count themselves under the parity of the epoch they saw. The
+    // reload flips it before waiting for each count to drain, so that readers
+    // arriving meanwhile count under the other one and can't hold it up.
+    std::atomic<uint64_t> _epoch{};
+    mutable Readers _readers[2];
+
+    std::mutex _reload_mutex;
+};
+
+template<typename C, typename A>
+void TreeHandle<C, A>::reload(TreeType tree)
+{
+    std::lock_guard<std::mutex> lock(_reload_mutex);
+    auto *old = _current.load();
+    auto migration = tree.migration_from(old->tree);
+    _current.store(new Version{std::move(tree), std::move(migration), old->generation + 1});
+
+    // A reader still using the old version counted itself before loading it,
+    // so under either parity; wait for both.
+    for (int i = 0; i < 2; ++i) {
+        auto const epoch = _epoch.fetch_add(1);
+        while (_readers[epoch & 1].count.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+    delete old;
+}
+
+/// @cond
+// The process functions stored in nodes. Each wraps the user's callable
+// directly so that a node costs one indirect call.
+template<typename C, typename F>
+struct DecoratorProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        assert(self.child_count() == 1); // invariant violation!
+        auto &child = *(&self + 1);
+        return detail::invoke(process, context, child, state);
+    }
+
+    F process;
+};
+
+template<typename C, typename F>
+struct CompositeProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        typename Generator<C>::Cursor cursor{0, self.child_count(), self.first_child(), &state, state._depth};
+        size_t offset = 0;
+        // decode_states() can't check the frames inside referenced subtrees,
+        // so a child past the end starts this composite over instead.
+        if (state.resume(self.index(), offset) && offset < cursor.count) {
+            for (; cursor.index < offset; ++cursor.index) {
+                cursor.next = cursor.next->next_sibling();
+            }
+        }
+        Generator<C> const generator{cursor};
+        auto status = detail::invoke(process, context, generator, state);
+        if (status == Status::RUNNING) {
+            // The running child's path is on the stack, add this composite above it.
+            state.push(self.index(), cursor.index == 0 ? 0 : cursor.index - 1);
+        } else {
+            state._depth = cursor.depth;
+        }
+        return status;
+    }
+
+    F process;
+};
+
+inline Status to_status(Status status)
+{
+    return status;
+}
+
+inline Status to_status(bool result)
+{
+    return result ? Status::SUCCESS : Status::FAILURE;
+}
+
+template<typename C, typename F>
+struct LeafProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &)
+    {
+        assert(self.child_count() == 0); // invariant violation!
+        (void)self; // only read by the assert
+        return to_status(detail::invoke(process, context));
+    }
+
+    F process;
+};
+
+// Keeps the leaf's status plus one, and the tick it ran in, in two slots
+// shared by the copies of the leaf. A status from an earlier tick is stale.
+template<typename C, typename P>
+struct MemoizedProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        auto const slot = state._slot_base + self._slot;
+        auto const stored = slot < state._slots.size();
+        if (stored && state._slots[slot + 1] == state._tick && state._slots[slot] != 0) {
+            return static_cast<Status>(state._slots[slot] - 1);
+        }
+        auto const status = process(context, self, state);
+        if (stored) {
+            state._slots[slot] = static_cast<uint32_t>(status) + 1;
+            state._slots[slot + 1] = state._tick;
+        }
+        return status;
+    }
+
+    P process;
+};
+
+template<typename C, typename F>
+struct VoidLeafProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &)
+    {
+        assert(self.child_count() == 0); // invariant violation!
+        (void)self; // only read by the assert
+        detail::invoke(process, context);
+        return Status::SUCCESS;
+    }
+
+    F process;
+};
+
+// Runs a shared tree in place. The reference keeps its own frame above the
+// subtree's path, so the subtree's frames are only read once it is reached.
+template<typename C, typename T>
+struct SubtreeProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        auto const depth = state._depth;
+        auto const slot_base = state._slot_base;
+        size_t offset = 0;
+        state.resume(self.index(), offset);
+        state._slot_base += self._slot; // slots are uint32, see Tree::Tree
+        auto const status = subtree->nodes()[0].process(context, state);
+        state._slot_base = slot_base;
+        if (status == Status::RUNNING) {
+            state.push(self.index(), 0);
+        } else {
+            state._depth = depth;
+        }
+        return status;
+    }
+
+    std::shared_ptr<T const> subtree;
+};
+
+// Caches the child's last SUCCESS or FAILURE in two slots: the status plus one,
+// and the state's version when it was cached. The cache holds until one of the
+// keys is invalidated after that version.
+template<typename C>
+struct ReactiveProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        assert(self.child_count() == 1); // invariant violation!
+        auto const &child = *(&self + 1);
+        auto const slot = state._slot_base + self._slot;
+        auto const cached = lookup(state, slot, keys);
+        if (cached != Status::RUNNING) {
+            return cached;
+        }
+        auto const status = child.process(context, state);
+        store(state, slot, status);
+        return status;
+    }
+
+    // Returns the cached status, or RUNNING if the child must run. Shared with
+    // CompiledTree, which runs reactive nodes in its own loop.
+    static Status lookup(TreeState const &state, size_t slot, uint64_t keys)
+    {
+        if (slot >= state._slots.size()) {
+            return Status::RUNNING; // a state without a cache
+        }
+        auto const cached = state._slots[slot];
+        auto const version = state._slots[slot + 1];
+        if (cached == 0) {
+            return Status::RUNNING;
+        }
+        for (size_t key = 0; key < 64 && (keys >> key) != 0; ++key) {
+            if (((keys >> key) & 1) && state._key_versions[key] > version) {
+                return Status::RUNNING;
+            }
+        }
+        return static_cast<Status>(cached - 1);
+    }
+
+    static void store(TreeState &state, size_t slot, Status status)
+    {
+        if (slot < state._slots.size()) {
+            state._slots[slot] = status == Status::RUNNING ? 0 : static_cast<uint32_t>(status) + 1;
+            state._slots[slot + 1] = state._version;
+        }
+    }
+
+    uint64_t keys;
+};
+
+// Looks the child's status up among the results already shared in the
+// process_batch_shared() call running on this thread, if any.
+template<typename C>
+struct SharedProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        assert(self.child_count() == 1); // invariant violation!
+        auto const &child = *(&self + 1);
+        auto *shared = detail::SharedResults<C>::current();
+        auto status = Status::RUNNING;
+        if (shared == nullptr || !shared->find(self, context, status)) {
+            return child.process(context, state);
+        }
+        if (status != Status::RUNNING) {
+            return status;
+        }
+        status = child.process(context, state);
+        // Looked up again, since the child may have added results of its own.
+        shared->store(self, context, status);
+        return status;
+    }
+};
+
+// Ticks every child that hasn't finished in the current run, then applies the
+// thresholds. Each child has a slot holding its status plus one once it has
+// finished, and a path in the state while it is RUNNING. To resume a child, its
+// path is laid out where the state's own path is read from, so the child picks
+// up as if it were the only one. Children run on a thread pool get a scratch
+// state of their own instead, with the entity's tick and a trace buffer of
+// their own that is appended to the entity's once they all finish. Nothing
+// under them may need slots, see BuilderBase::end.
+template<typename C>
+struct ParallelProcess
+{
+    using Frame = TreeState::Frame;
+
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        assert(self.child_count() > 0); // invariant violation!
+        size_t offset = 0;
+        auto const resuming = state.resume(self.index(), offset);
+        auto const count = self.child_count();
+        auto const slot = state._slot_base + self._slot;
+        auto const stored = slot < state._slots.size();
+        if (stored && state._paths.size() < state._slots.size()) {
+            state._paths.resize(state._slots.size());
+        }
+        if (stored && !resuming) {
+            reset(state, slot, count);
+        }
+
+        size_t successes = 0;
+        size_t failures = 0;
+        auto const count_status = [&](Status status) {
+            successes += status == Status::SUCCESS;
+            failures += status == Status::FAILURE;
+        };
+        auto const depth = state._depth;
+        if (threads == nullptr || count == 1) {
+            auto const *child = self.first_child();
+            for (size_t i = 0; i < count; ++i, child = child->next_sibling()) {
+                if (stored && state._slots[slot + i] != 0) {
+                    count_status(static_cast<Status>(state._slots[slot + i] - 1));
+                    continue;
+                }
+                auto *path = stored ? &state._paths[slot + i] : nullptr;
+                auto const status = tick(context, *child, state, path, depth);
+                if (stored && status != Status::RUNNING) {
+                    state._slots[slot + i] = static_cast<uint32_t>(status) + 1;
+                }
+                count_status(status);
+            }
+        } else {
+            std::vector<uint32_t> unstored;
+            if (!stored) {
+                unstored.resize(count);
+            }
+            auto *results = stored ? &state._slots[slot] : unstored.data();
+            std::vector<std::pair<Node<C> const *, size_t>> pending;
+            auto const *child = self.first_child();
+            for (size_t i = 0; i < count; ++i, child = child->next_sibling()) {
+                if (results[i] == 0) {
+                    pending.emplace_back(child, i);
+                }
+            }
+            std::vector<std::unique_ptr<TraceBuffer>> traces(state._trace != nullptr ? pending.size() : 0);
+            for (auto &trace : traces) {
+                trace.reset(new TraceBuffer{state._trace->capacity()});
+            }
+            threads->parallel_for(pending.size(), 1, [&](size_t begin, size_t end) {
+                TreeState scratch{state._tree_id, state._frames.size()};
+                scratch._tick = state._tick;
+                for (auto p = begin; p < end; ++p) {
+                    scratch._trace = traces.empty() ? nullptr : traces[p].get();
+                    auto const i = pending[p].second;
+                    auto *path = stored ? &state._paths[slot + i] : nullptr;
+                    auto const status = tick(context, *pending[p].first, scratch, path, 0);
+                    if (status != Status::RUNNING) {
+                        results[i] = static_cast<uint32_t>(status) + 1;
+                    }
+                }
+            });
+            for (auto &trace : traces) {
+                state._trace->append(*trace);
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (results[i] != 0) {
+                    count_status(static_cast<Status>(results[i] - 1));
+                }
+            }
+        }
+        state._depth = depth;
+
+        auto const running = count - successes - failures;
+        auto const needed_successes = std::min(success_threshold, count);
+        auto const needed_failures = std::min(failure_threshold, count);
+        auto status = Status::RUNNING;
+        if (successes >= needed_successes) {
+            status = Status::SUCCESS;
+        } else if (failures >= needed_failures || successes + running < needed_successes) {
+            status = Status::FAILURE;
+        }
+        if (status == Status::RUNNING) {
+            state.push(self.index(), 0);
+        } else if (stored) {
+            reset(state, slot, count); // stop the children still running
+        }
+        return status;
+    }
+
+    // Runs one child with its previous path, if any, and keeps its new path.
+    static Status tick(C &context, Node<C> const &child, TreeState &state, std::vector<Frame> *path, size_t depth)
+    {
+        state._cursor = 0;
+        if (path != nullptr && !path->empty()) {
+            assert(depth + path->size() <= state._frames.size()); // invariant violation!
+            std::copy(path->begin(), path->end(), state._frames.begin() + depth);
+            state._cursor = depth + path->size();
+        }
+        state._depth = depth;
+        auto const status = child.process(context, state);
+        if (path != nullptr) {
+            if (status == Status::RUNNING) {
+                path->assign(state._frames.begin() + depth, state._frames.begin() + state._depth);
+            } else {
+                path->clear();
+            }
+        }
+        state._cursor = 0;
+        state._depth = depth;
+        return status;
+    }
+
+    static void reset(TreeState &state, size_t slot, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            state._slots[slot + i] = 0;
+            state._paths[slot + i].clear();
+        }
+    }
+
+    size_t success_threshold;
+    size_t failure_threshold;
+    ThreadPool *threads;
+};
+
+// The decorators that keep per-entity values in slots. All but cooldown push
+// a frame of their own while the child is RUNNING, so that the next tick can
+// tell resuming the child from starting it over. Times are kept in two slots
+// as nanoseconds on the time source's clock.
+template<typename C, detail::Opcode Op>
+struct StatefulDecoratorProcess
+{
+    using Opcode = detail::Opcode;
+
+    static constexpr uint32_t slot_count =
+        Op == Opcode::REPEAT || Op == Opcode::RETRY ? 1 // runs so far
+        : Op == Opcode::RATE_LIMIT ? 3 // window start, starts in the window
+        : 2; // when the child last finished, or started
+
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        assert(self.child_count() == 1); // invariant violation!
+        auto const &child = *(&self + 1);
+        auto const slot = state._slot_base + self._slot;
+        auto const stored = slot < state._slots.size();
+        size_t offset = 0;
+        auto const resuming = Op != Opcode::COOLDOWN && state.resume(self.index(), offset);
+
+        auto status = Status::RUNNING;
+        switch (Op) {
+        case Opcode::REPEAT:
+        case Opcode::RETRY: {
+            auto const again = Op == Opcode::REPEAT ? Status::SUCCESS : Status::FAILURE;
+            uint64_t runs = stored && resuming ? state._slots[slot] : 0;
+            for (;;) {
+                status = child.process(context, state);
+                if (status != again || ++runs >= parameter) {
+                    break;
+                }
+                state._cursor = 0; // the next run starts from the beginning
+            }
+            if (stored) {
+                state._slots[slot] = status == Status::RUNNING ? static_cast<uint32_t>(runs) : 0;
+            }
+            break;
+        }
+        case Opcode::COOLDOWN: {
+            // Finish times are stored plus one, so that zero means never.
+            if (stored) {
+                auto const finished = load(state, slot);
+                if (finished != 0 && elapsed(finished - 1) < duration()) {
+                    return Status::FAILURE; // still cooling down, skip the subtree
+                }
+            }
+            status = child.process(context, state);
+            if (stored && status != Status::RUNNING) {
+                save(state, slot, now() + 1);
+            }
+            return status;
+        }
+        case Opcode::TIMEOUT:
+            if (stored && !resuming) {
+                save(state, slot, now());
+            } else if (stored && elapsed(load(state, slot)) >= duration()) {
+                state._cursor = 0; // abandon the child's path
+                return Status::FAILURE;
+            }
+            status = child.process(context, state);
+            break;
+        case Opcode::RATE_LIMIT:
+            if (stored && !resuming) {
+                auto &starts = state._slots[slot + 2];
+                auto const time = now();
+                if (starts == 0 || time - load(state, slot) >= duration()) {
+                    save(state, slot, time); // a new window
+                    starts = 0;
+                }
+                if (starts >= count) {
+                    return Status::FAILURE;
+                }
+                ++starts;
+            }
+            status = child.process(context, state);
+            break;
+        default:
+            assert(false); // not a stateful decorator!
+        }
+        if (status == Status::RUNNING) {
+            state.push(self.index(), 0);
+        }
+        return status;
+    }
+
+    int64_t duration() const
+    {
+        return static_cast<int64_t>(parameter);
+    }
+
+    int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock().time_since_epoch()).count();
+    }
+
+    int64_t elapsed(int64_t since) const
+    {
+        return now() - since;
+    }
+
+    static int64_t load(TreeState const &state, size_t slot)
+    {
+        return static_cast<int64_t>(state._slots[slot] | static_cast<uint64_t>(state._slots[slot + 1]) << 32);
+    }
+
+    static void save(TreeState &state, size_t slot, int64_t time)
+    {
+        state._slots[slot] = static_cast<uint32_t>(time);
+        state._slots[slot + 1] = static_cast<uint32_t>(static_cast<uint64_t>(time) >> 32);
+    }
+
+    uint64_t parameter; // the count of repeat() and retry(), or a duration in nanoseconds
+    uint32_t count; // the starts allowed by rate_limit()
+    TimeSource clock;
+};
+
+template<typename C, detail::Opcode Op>
+constexpr uint32_t StatefulDecoratorProcess<C, Op>::slot_count;
+
+// Scores the children on every tick and tries them from the highest score
+// down until one doesn't fail. A RUNNING child keeps running only while it
+// still scores highest; otherwise its path is abandoned for the new best.
+template<typename C, typename F>
+struct UtilityProcess
+{
+    static_assert(
+        !detail::is_batch_scorer<F>::value || detail::has_batch_score<F, C>::value,
+        "a batch_scored() scorer must also take a span of contexts"
+    );
+
+    static constexpr size_t inline_count = 16;
+
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        assert(self.child_count() > 0); // invariant violation!
+        auto const count = self.child_count();
+        float inline_scores[inline_count];
+        std::vector<float> heap_scores;
+        if (count > inline_count) {
+            heap_scores.resize(count);
+        }
+        Span<float> const scores{count > inline_count ? heap_scores.data() : inline_scores, count};
+        std::fill(scores.begin(), scores.end(), 0.0f);
+        score_children(context, self, scores, detail::is_batch_scorer<F>{});
+
+        size_t running = 0;
+        auto resuming = state.resume(self.index(), running);
+        auto const depth = state._depth;
+        for (;;) {
+            // Ties go to the first child; NaN scores, including those of the
+            // children already tried, are skipped.
+            auto best = count;
+            for (size_t i = 0; i < count; ++i) {
+                if (!std::isnan(scores[i]) && (best == count || scores[i] > scores[best])) {
+                    best = i;
+                }
+            }
+            if (best == count) {
+                return Status::FAILURE;
+            }
+            if (!resuming || best != running) {
+                state._cursor = 0; // start the child over
+            }
+            resuming = false;
+            auto const *child = self.first_child();
+            for (size_t i = 0; i < best; ++i) {
+                child = child->next_sibling();
+            }
+            auto const status = child->process(context, state);
+            if (status == Status::RUNNING) {
+                state.push(self.index(), best);
+                return status;
+            }
+            state._depth = depth;
+            if (status == Status::SUCCESS) {
+                return status;
+            }
+            scores[best] = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+
+    void score_children(C &context, Node<C> const &self, Span<float> scores, std::true_type)
+    {
+        auto *batch = detail::BatchScores<C>::current();
+        if (batch == nullptr || !batch->find(score, self, context, scores)) {
+            score_children(context, self, scores, std::false_type{});
+        }
+    }
+
+    void score_children(C &context, Node<C> const &, Span<float> scores, std::false_type)
+    {
+        score(static_cast<C const &>(context), scores);
+    }
+
+    F score;
+};
+
+template<typename C, typename F>
+constexpr size_t UtilityProcess<C, F>::inline_count;
+
+#if BEEHIVE_COROUTINES
+// Keeps the coroutine of a RUNNING action in the state's slot for this node, and
+// pushes its own frame like a subtree reference does. The next tick resumes the
+// coroutine only if the path still leads here; otherwise it was abandoned and
+// starts over.
+template<typename C, typename F>
+struct ActionProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        assert(self.child_count() == 0); // invariant violation!
+        size_t offset = 0;
+        auto const resuming = state.resume(self.index(), offset);
+        auto const slot = state._slot_base + self._slot;
+        auto const stored = slot < state._slots.size();
+        auto &frames = state._actions;
+        Action::Handle handle;
+        if (stored && frames.get(slot) != nullptr) {
+            if (resuming) {
+                handle = Action::Handle::from_address(frames.get(slot));
+            } else {
+                frames.destroy(slot);
+            }
+        }
+        if (!handle) {
+            detail::FrameAllocatorScope scope{allocator};
+            handle = detail::invoke(function, context).release();
+        }
+        handle.resume();
+        if (!handle.done()) {
+            if (stored) {
+                frames.set(slot, state._slots.size(), handle.address(), &destroy);
+            } else {
+                handle.destroy(); // a state without slots, so start over next time
+            }
+            state.push(self.index(), 0);
+            return Status::RUNNING;
+        }
+        if (stored) {
+            frames.release(slot);
+        }
+        auto const status = handle.promise().status;
+        auto const error = handle.promise().error;
+        handle.destroy();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return status;
+    }
+
+    static void destroy(void *address)
+    {
+        Action::Handle::from_address(address).destroy();
+    }
+
+    F function;
+    FrameAllocator *allocator;
+};
+#endif // BEEHIVE_COROUTINES
+
+// Starts an operation with a new ticket and pushes its own frame, like an
+// action. The next tick that comes back to the leaf returns the result if the
+// queue has delivered it, or waits again. A leaf the path didn't lead back to
+// starts over, and the abandoned operation's result is dropped on delivery.
+template<typename C, typename F>
+struct AsyncProcess
+{
+    Status operator()(C &context, Node<C> const &self, TreeState &state)
+    {
+        assert(self.child_count() == 0); // invariant violation!
+        size_t offset = 0;
+        auto const resuming = state.resume(self.index(), offset);
+        auto const slot = state._slot_base + self._slot;
+        if (slot >= state._slots.size()) {
+            return Status::FAILURE; // a state without slots can't wait
+        }
+        auto const &inbox = state._async.get(state._slots.size());
+        auto &result = inbox->results[slot];
+        auto &ticket = state._slots[slot];
+        if (resuming && ticket != 0 && ticket == result.ticket) {
+            if (!result.delivered) {
+                return wait(self, state);
+            }
+            auto const status = result.status;
+            --inbox->delivered;
+            result = {};
+            ticket = 0;
+            return status;
+        }
+        if (result.delivered) {
+            --inbox->delivered; // the result of an abandoned operation
+        }
+        if (++inbox->next_ticket == 0) {
+            ++inbox->next_ticket;
+        }
+        ticket = inbox->next_ticket;
+        result = {ticket, Status::FAILURE, false};
+        std::unique_ptr<detail::AsyncCompletion> completion{
+            new detail::AsyncCompletion{inbox, slot, ticket, Status::FAILURE, nullptr}
+        };
+        detail::invoke(start, context, AsyncCallback{*queue, std::move(completion)});
+        return wait(self, state);
+    }
+
+    static Status wait(Node<C> const &self, TreeState &state)
+    {
+        state._parked = true;
+        state.push(self.index(), 0);
+        return Status::RUNNING;
+    }
+
+    F start;
+    AsyncQueue *queue;
+};
+
+// Calls a fixed function without storing a pointer to it, so the shorthands
+// for the built-in composites and decorators can be inlined.
+template<typename F, F f>
+struct FunctionConstant
+{
+    template<typename... Args>
+    Status operator()(Args &&... args) const
+    {
+        return f(std::forward<Args>(args)...);
+    }
+};
+/// @endcond
+
+/*!
+ \brief Names the leaves, composites, decorators and shared subtrees that trees
+    are built from, so that a tree's structure can be saved to bytes and loaded
+    again without code. See #beehive::FunctionTable::serialize.
+
+    Build with the overloads of #beehive::BuilderBase::leaf, composite() and
+    decorator() that take a table and a name, so that each node remembers the
+    entry it was made from. The built-in composites and decorators, such as
+    sequence(), reactive(), parallel() or cooldown(), and the trees attached
+    with tree(), need no entries. Those overloads throw std::invalid_argument
+    for names the table doesn't have, or that name another kind of entry.
+*/
+template<typename C>
+class FunctionTable
+{
+public:
+    /*!
+     \brief Adds a leaf under the given name. See #beehive::BuilderBase::leaf.
+    */
+    template<typename L>
+    void add_leaf(std::string name, L &&leaf)
+    {
+        using Process = LeafProcess<C, typename std::decay<L>::type>;
+        add({std::move(name), Process{std::forward<L>(leaf)}, detail::Opcode::LEAF, 0, 0});
+    }
+
+    /*!
+     \brief Adds a memoized leaf under the given name, whose nodes in a tree all
+        share one cache. See #beehive::BuilderBase::memoized_leaf.
+    */
+    template<typename L>
+    void add_memoized_leaf(std::string name, L &&leaf)
+    {
+        using Process = MemoizedProcess<C, LeafProcess<C, typename std::decay<L>::type>>;
+        add({std::move(name), Process{{std::forward<L>(leaf)}}, detail::Opcode::LEAF, 0, 2});
+        _entries.back().memo = detail::memo_key();
+    }
+
+    /*!
+     \brief Adds a void leaf under the given name. See #beehive::BuilderBase::void_leaf.
+    */
+    template<typename L>
+    void add_void_leaf(std::string name, L &&leaf)
+    {
+        using Process = VoidLeafProcess<C, typename std::decay<L>::type>;
+        add({std::move(name), Process{std::forward<L>(leaf)}, detail::Opcode::LEAF, 0, 0});
+    }
+
+    /*!
+     \brief Adds a composite under the given name. See #beehive::BuilderBase::composite.
+    */
+    template<typename F>
+    void add_composite(std::string name, F &&composite)
+    {
+        using Process = CompositeProcess<C, typename std::decay<F>::type>;
+        add({std::move(name), Process{std::forward<F>(composite)}, detail::Opcode::COMPOSITE, 0, 0});
+    }
+
+    /*!
+     \brief Adds a decorator under the given name. See #beehive::BuilderBase::decorator.
+    */
+    template<typename F>
+    void add_decorator(std::string name, F &&decorator)
+    {
+        using Process = DecoratorProcess<C, typename std::decay<F>::type>;
+        add({std::move(name), Process{std::forward<F>(decorator)}, detail::Opcode::DECORATOR, 0, 0});
+    }
+
+    /*!
+     \brief Adds a utility selector's scorer under the given name.
+        See #beehive::BuilderBase::utility_selector.
+    */
+    template<typename F>
+    void add_utility_selector(std::string name, F &&score)
+    {
+        using Process = UtilityProcess<C, typename std::decay<F>::type>;
+        add({std::move(name), Process{std::forward<F>(score)}, detail::Opcode::UTILITY, 0, 0});
+    }
+
+    /*!
+     \brief Adds a shared subtree under the given name, which is used as a leaf.
+        See #beehive::BuilderBase::subtree_ref.
+    */
+    template<typename A>
+    void add_subtree(std::string name, std::shared_ptr<Tree<C, A> const> subtree)
+    {
+        assert(subtree); // null subtree!
+        auto const depth = 1 + subtree->_depth;
+        auto const slot_count = static_cast<uint32_t>(subtree->_slot_count);
+        add({std::move(name), SubtreeProcess<C, Tree<C, A>>{std::move(subtree)}, detail::Opcode::SUBTREE, depth, slot_count});
+    }
+
+#if BEEHIVE_COROUTINES
+    /*!
+     \brief Adds a coroutine action under the given name, which is used as a leaf.
+        See #beehive::BuilderBase::action.
+    */
+    template<typename F>
+    void add_action(std::string name, F &&function, FrameAllocator *allocator = nullptr)
+    {
+        using Process = ActionProcess<C, typename std::decay<F>::type>;
+        add({std::move(name), Process{std::forward<F>(function), allocator}, detail::Opcode::LEAF, 1, 1});
+    }
+#endif
+
+    /*!
+     \brief Adds an async leaf under the given name. See #beehive::BuilderBase::async_leaf.
+    */
+    template<typename F>
+    void add_async_leaf(std::string name, AsyncQueue &queue, F &&start)
+    {
+        using Process = AsyncProcess<C, typename std::decay<F>::type>;
+        add({std::move(name), Process{std::forward<F>(start), &queue}, detail::Opcode::LEAF, 1, 1});
+    }
+
+    /*!
+     \brief Returns true if an entry has the given name.
+    */
+    bool contains(std::string const &name) const {
+        return _index.count(name) != 0;
+    }
+
+    /*!
+     \brief Returns the number of entries.
+    */
+    size_t size() const {
+        return _entries.size();
+    }
+
+    /*!
+     \brief Sets the time source of the cooldown(), timeout() and rate_limit()
+        decorators of trees made by deserialize(). See #beehive::TimeSource.
+    */
+    void set_time_source(TimeSource now) {
+        _now = now;
+    }
+
+    /*!
+     \brief Saves the structure of a tree built with this table's entries.
+
+        The result starts with a small header and holds one fixed-size record
+        per node followed by the names of the entries used, so it can be
+        written to a file and later loaded straight from a memory mapping.
+        Values are stored in the machine's byte order. Thread pools given to
+        parallel() are not saved; the loaded parallels run their children one
+        after another. Nor are time sources, see set_time_source().
+
+        Throws std::invalid_argument if a node wasn't built from an entry of
+        this table, such as a leaf built from a lambda.
+    */
+    template<typename A>
+    std::vector<unsigned char> serialize(Tree<C, A> const &tree) const;
+
+    /*!
+     \brief Creates a tree from bytes made by serialize(), looking up the
+        entries by name in this table.
+
+        The names are resolved once each, then the nodes are made in a single
+        pass over the records. Throws std::runtime_error if the bytes are not a
+        valid tree or name an entry this table doesn't have.
+    */
+    Tree<C> deserialize(void const *data, size_t size) const;
+
+    /*!
+     \brief Like deserialize() above, with the bytes of a vector.
+    */
+    Tree<C> deserialize(std::vector<unsigned char> const &data) const {
+        return deserialize(data.data(), data.size());
+    }
+
+private:
+    template<typename Context, typename A>
+    friend class BuilderBase;
+
+    struct Entry
+    {
+        std::string name;
+        typename Node<C>::ProcessFunction process;
+        detail::Opcode opcode;
+        size_t subtree_depth;
+        uint32_t slot_count;
+        uint32_t memo{Node<C>::unmemoized}; // the key its nodes share, if memoized
+    };
+
+    // The layout of serialized trees: a Header, then Header::node_count
+    // Records, then Header::name_count Names pointing into a block of
+    // Header::names_size bytes of characters.
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t node_count;
+        uint32_t name_count;
+        uint32_t names_size;
+        uint32_t reserved;
+    };
+
+    struct Record
+    {
+        uint64_t parameter; // reactive keys, parallel thresholds, or a count or duration
+        uint32_t name; // index of the entry's name, or none
+        uint32_t child_count;
+        uint32_t count; // the starts allowed by rate_limit()
+        uint8_t opcode;
+        uint8_t flags; // see condition_flag
+        uint8_t reserved[2];
+    };
+
+    struct Name
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    static constexpr char magic[4] = {'B', 'H', 'V', 'T'};
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t none = UINT32_MAX;
+    static constexpr uint8_t condition_flag = 1; // see BuilderBase::condition
+
+    void add(Entry entry)
+    {
+        assert(!contains(entry.name)); // name already in use!
+        assert(_entries.size() < Node<C>::unregistered); // too many entries!
+        _index.emplace(entry.name, static_cast<uint32_t>(_entries.size()));
+        _entries.push_back(std::move(entry));
+    }
+
+    // The entry for a name given to the builder, which must be of one of the opcodes.
+    uint32_t find(std::string const &name, detail::Opcode opcode, detail::Opcode other) const
+    {
+        auto const it = _index.find(name);
+        if (it == _index.end()) {
+            throw std::invalid_argument("no FunctionTable entry named \"" + name + "\"");
+        }
+        auto const found = _entries[it->second].opcode;
+        if (found != opcode && found != other) {
+            throw std::invalid_argument(
+                "FunctionTable entry \"" + name + "\" is a " + detail::opcode_name(found) + ", not a " + detail::opcode_name(opcode)
+            );
+        }
+        return it->second;
+    }
+
+    template<detail::Opcode Op>
+    static void save_stateful(typename Node<C>::Body const &body, Record &record)
+    {
+        auto const *process = body.process.template target<StatefulDecoratorProcess<C, Op>>();
+        assert(process); // invariant violation!
+        record.parameter = process->parameter;
+        record.count = process->count;
+    }
+
+    template<detail::Opcode Op>
+    typename Node<C>::ProcessFunction load_stateful(Record const &record, uint32_t &slot_count) const
+    {
+        slot_count = StatefulDecoratorProcess<C, Op>::slot_count;
+        return StatefulDecoratorProcess<C, Op>{record.parameter, record.count, _now};
+    }
+
+    std::vector<Entry> _entries;
+    std::unordered_map<std::string, uint32_t> _index;
+    TimeSource _now{&std::chrono::steady_clock::now};
+};
+
+/// @cond
+template<typename C>
+constexpr char FunctionTable<C>::magic[4];
+
+template<typename C>
+constexpr uint32_t FunctionTable<C>::none;
+
+template<typename C>
+constexpr uint8_t FunctionTable<C>::condition_flag;
+/// @endcond
+
+template<typename C, typename A>
+class Builder;
+
+/*!
+ \brief A helper for building trees which can be instantiated as #beehive::Builder.
+*/
+template<typename C, typename A>
+class BuilderBase
+{
+public:
+    /// @cond
+    enum class Type
+    {
+        COMPOSITE,
+        DECORATOR,
+    };
+    /// @endcond
+
+    /*!
+     \brief Adds the given composite to the tree. Composites have one or more children.
+
+     \note The composite builder must call end() to signify end of child list.
+    */
+    template<typename F>
+    BuilderBase composite(F &&composite);
+
+    /*!
+     \brief Adds the given decorator to the tree. Decorators have exactly one child.
+    
+     \note The decorator builder must call end() to signify the end of the child list.
+    */
+    template<typename F>
+    BuilderBase decorator(F &&decorator);
+    
+    // Note: "no matching function for call to 'to_status'" errors here could indicate that you forgot to return something from your lambda.
+    /*!
+     \brief Adds the given leaf to the tree. Leaves have no children.
+
+        The leaf may return a Status, or a bool which translates true to
+        Status::SUCCESS and false to Status::FAILURE (and never Status::RUNNING).
+    */
+    template<typename L>
+    BuilderBase &leaf(L &&leaf);
+
+    /*!
+     \brief Convenience wrapper for a void function, or really a function returning any type other than bool or Status. This always returns Status::SUCCESS.
+    */
+    template<typename L>
+    BuilderBase &void_leaf(L &&leaf);
+
+    /*!
+     \brief Like leaf(), but runs the leaf at most once per tick of each entity.
+
+        Later visits in the same process() call return the status of the first,
+        which suits conditions that appear in several branches. Copies of the
+        leaf, made by tree(), share the cached status. Caching needs a state from
+        make_state(); with any other state the leaf runs every time. A new tick
+        makes cached statuses stale without clearing them.
+    */
+    template<typename L>
+    BuilderBase &memoized_leaf(L &&leaf);
+
+    /*!
+     \brief Like leaf(), for a check that is cheap to run, has no side effects,
+        and doesn't depend on what its siblings do.
+
+        Tree::optimized() moves such checks ahead of their siblings in sequences,
+        so that a failing check skips the siblings' work instead of following it.
+        A moved check runs before a RUNNING sibling starts instead of after it
+        finishes. Selectors keep their order, which is their priority.
+    */
+    template<typename L>
+    BuilderBase &condition(L &&leaf);
+
+    /*!
+     \brief Like condition(), for the leaf registered under the given name, so
+        that the tree can be serialized. See #beehive::FunctionTable.
+    */
+    BuilderBase &condition(FunctionTable<C> const &table, std::string const &name);
+
+    /*!
+     \brief Copies another tree as a subtree at the current node.
+    */
+    template<typename OtherAllocator>
+    BuilderBase &tree(Tree<C, OtherAllocator> const &subtree);
+
+    /*!
+     \brief Adds a node that runs the given tree in place, without copying it.
+
+        Many trees can share one subtree this way. The subtree resumes where
+        it left off like any other node.
+    */
+    template<typename OtherAllocator>
+    BuilderBase &subtree_ref(std::shared_ptr<Tree<C, OtherAllocator> const> subtree);
+
+#if BEEHIVE_COROUTINES
+    /*!
+     \brief Adds a leaf that runs a coroutine returning #beehive::Action.
+
+        The function takes the context and is called when the leaf starts. The
+        coroutine's frame is kept in the tree state while it is RUNNING, so the
+        next tick continues it right after its `co_await beehive::next_tick`.
+        If the tree doesn't come back to the leaf, the frame is destroyed the
+        next time the leaf starts over.
+
+        Frames come from `allocator` if given, such as a #beehive::FramePool,
+        or the global operator new. Keeping a frame needs a state from
+        make_state(); without one, or when processing a #beehive::TreeStatePool,
+        the coroutine starts over on every tick.
+    */
+    template<typename F>
+    BuilderBase &action(F &&function, FrameAllocator *allocator = nullptr);
+#endif
+
+    /*!
+     \brief Adds a leaf that starts an operation, such as a query to another
+        service, and waits for its result without being polled.
+
+        The function takes the context and a #beehive::AsyncCallback, and is
+        called when the leaf starts. The leaf returns RUNNING until the callback
+        is called, from any thread, and the result is delivered by draining
+        `queue`; the next tick then returns it. Until then the entity is
+        #beehive::TreeState::parked, so process_batch() with the queue skips it.
+        If the tree doesn't come back to the leaf, its next start begins a new
+        operation and the old one's result is dropped. A parked entity isn't
+        ticked, so decorators above the leaf, like timeout(), only act once it
+        wakes up or is ticked directly.
+
+        Waiting needs a state from make_state(); without one, or when processing
+        a #beehive::TreeStatePool, the leaf fails at once.
+    */
+    template<typename F>
+    BuilderBase &async_leaf(AsyncQueue &queue, F &&start);
+
+    /*!
+     \brief Adds the leaf, void leaf, action or shared subtree registered under the
+        given name, so that the tree can be serialized. See #beehive::FunctionTable.
+    */
+    BuilderBase &leaf(FunctionTable<C> const &table, std::string const &name);
+
+    /*!
+     \brief Adds the composite registered under the given name. See #beehive::FunctionTable.
+    */
+    BuilderBase composite(FunctionTable<C> const &table, std::string const &name);
+
+    /*!
+     \brief Adds the decorator registered under the given name. See #beehive::FunctionTable.
+    */
+    BuilderBase decorator(FunctionTable<C> const &table, std::string const &name);
+    
+    /*!
+     \brief Closes the composite or decorator branch.
+     
+        Each call to composite() or decorator() must have a corresponding end().
+    */
+    BuilderBase &end();
+
+    /*!
+     \brief Finalizes the tree by returning a copy. This will assert if done while
+        a decorator or composite branch is still 'open'.
+    */
+    virtual Tree<C, A> build() const &;
+    
+    /*!
+     \brief Finalizes the tree by returning a tree constructed with the builder's
+        root node. The builder is then invalid.
+    */
+    virtual Tree<C, A> build() &&;
+
+    /*!
+     \brief Shorthand for `composite(&sequence<C>)`.
+    */
+    BuilderBase sequence();
+    
+    /*!
+     \brief Shorthand for `composite(&selector<C>)`.
+    */
+    BuilderBase selector();
+
+    /*!
+     \brief Adds a composite that ticks all of its children, and resumes each
+        RUNNING child on later ticks until the parallel finishes.
+
+        It returns SUCCESS once `success_threshold` children have succeeded, and
+        FAILURE once `failure_threshold` children have failed or enough successes
+        are no longer possible. Otherwise it returns RUNNING. Both thresholds are
+        capped at the number of children, so by default all children must
+        succeed and the first failure fails. Children that are still running
+        when the parallel finishes are stopped.
+
+        Children run one after another, unless a #beehive::ThreadPool is given
+        to run them on at the same time. They must then be safe to run
+        concurrently on the same context, and nothing below them may keep
+        per-entity values: end() throws std::invalid_argument for reactive
+        caches, stateful decorators, nested parallels, memoized, action and
+        async leaves, and referenced subtrees holding any of them. Children on
+        the thread pool aren't counted against a budget, and their trace
+        events follow each other in child order. Remembering which children finished needs a state from
+        make_state(); without one, or when processing a
+        #beehive::TreeStatePool, every child is ticked from the start each time.
+    */
+    BuilderBase parallel(size_t success_threshold = SIZE_MAX, size_t failure_threshold = 1, ThreadPool *threads = nullptr);
+
+    /*!
+     \brief Adds a composite that picks its child by score on every tick.
+
+        `score` is called as `score(C const &context, Span<float> scores)` and
+        writes one score per child, which start at zero. Children are tried from
+        the highest score down, ties going to the first child, until one succeeds
+        or keeps running; children scored NaN are skipped. If every child fails,
+        so does the selector. A RUNNING child is resumed only while it still
+        scores highest; otherwise it is abandoned and the new best starts.
+
+        A scorer wrapped in #beehive::batch_scored also scores whole batches of
+        process_batch() at once, when the first entity reaches the selector.
+        It must then not read anything the nodes change during a tick.
+    */
+    template<typename F>
+    BuilderBase utility_selector(F &&score);
+
+    /*!
+     \brief Adds the utility selector registered under the given name. See #beehive::FunctionTable.
+    */
+    BuilderBase utility_selector(FunctionTable<C> const &table, std::string const &name);
+
+    /*!
+     \brief Shorthand for `decorator(&inverter<C>)`.
+    */
+    BuilderBase inverter();
+
+    /*!
+     \brief Shorthand for `decorator(&succeeder<C>)`.
+    */
+    BuilderBase succeeder();
+
+    /*!
+     \brief Adds a decorator that remembers its child's SUCCESS or FAILURE for each
+        entity, and returns it again without evaluating the child until one of the
+        given keys is invalidated. See #beehive::TreeState::invalidate.
+
+        The child must only depend on the parts of the context named by the keys,
+        and must not have side effects that need to happen on every tick. RUNNING
+        is never remembered. Caching needs a state from make_state(); without
+        one, or when processing a #beehive::TreeStatePool, the child always runs.
+    */
+    BuilderBase reactive(uint64_t keys);
+
+    /*!
+     \brief Adds a decorator whose child, during #beehive::Tree::process_batch_shared,
+        runs once for each distinct key in the batch, its SUCCESS or FAILURE
+        being returned to every other entity with the same key.
+
+        The child must only depend on the part of the context the key is made
+        from, and must not have side effects that need to happen for every
+        entity. RUNNING is never shared: each entity for which the child
+        returns RUNNING runs it itself. Outside process_batch_shared(), the
+        child always runs.
+    */
+    BuilderBase shared();
+
+    /*!
+     \brief Adds a decorator that runs its child again each time it succeeds,
+        until it has succeeded `count` times, then returns SUCCESS.
+
+        FAILURE is returned at once. The successes so far are kept for each
+        entity while the child is RUNNING, which needs a state from
+        make_state(); without one, the count starts over on the next tick.
+    */
+    BuilderBase repeat(size_t count);
+
+    /*!
+     \brief Adds a decorator that runs its child again each time it fails, up
+        to `attempts` runs in all, then returns FAILURE.
+
+        SUCCESS is returned at once. Failures are counted like the successes
+        of repeat().
+    */
+    BuilderBase retry(size_t attempts);
+
+    /*!
+     \brief Adds a decorator that returns FAILURE without running its child
+        until `period` has passed since the child last returned SUCCESS or
+        FAILURE.
+
+        The time is kept for each entity in its state from make_state(); without
+        one, the child always runs. Times are read with `now`.
+    */
+    BuilderBase cooldown(std::chrono::steady_clock::duration period, TimeSource now = &std::chrono::steady_clock::now);
+
+    /*!
+     \brief Adds a decorator that returns FAILURE instead of resuming its
+        RUNNING child once `limit` has passed since the child started.
+
+        The child's path is abandoned, so it starts over when next reached. The
+        start time is kept like the time of cooldown().
+    */
+    BuilderBase timeout(std::chrono::steady_clock::duration limit, TimeSource now = &std::chrono::steady_clock::now);
+
+    /*!
+     \brief Adds a decorator that lets its child start at most `count` times per
+        `period`, and returns FAILURE without running it otherwise.
+
+        A period starts when the child first starts after the previous period has
+        passed. Resuming a RUNNING child is not a start. The period and the
+        starts are kept like the time of cooldown().
+    */
+    BuilderBase rate_limit(size_t count, std::chrono::steady_clock::duration period, TimeSource now = &std::chrono::steady_clock::now);
+
+protected:
+    /// @cond
+    BuilderBase(BuilderBase &parent, size_t offset, Type type)
+        : _parent(parent)
+        , _offset(offset)
+        , _type(type)
+    {}
+
+    using Bodies = typename Tree<C, A>::Bodies;
+
+    typename Node<C>::Body &node() {
+        return nodes()[_offset];
+    }
+    
+    virtual Bodies &nodes() {
+        return _parent.nodes();
+    }
+
+private:
+    size_t add_child(typename Node<C>::ProcessFunction &&fn) {
+        node().add_child();
+        nodes().emplace_back(std::move(fn));
+        return nodes().size() - 1;
+    }
+
+    template<typename Process>
+    BuilderBase &_leaf(Process &&process);
+
+    template<typename Process>
+    BuilderBase _branch(Process &&process, Type type);
+
+    template<detail::Opcode Op>
+    BuilderBase _stateful(uint64_t parameter, uint32_t count, TimeSource now);
+
+    BuilderBase &_parent;
+    size_t _offset{};
+    Type _type{};
+    bool _threaded{}; // a parallel on a thread pool
+
+    /// @endcond
+};
+
+/*!
+ \brief Defines the tree structure and instantiates it.
+ 
+    This Builder pattern is inspired by arvidsson's implementation, BrainTree.
+ \sa #beehive::BuilderBase
+*/
+template<typename C, typename Allocator = std::allocator<Node<C>>>
+class Builder
+    : public BuilderBase<C, Allocator>
+{
+public:
+    /*!
+     \brief The context type.
+    */
+    using Context = C;
+
+    /*!
+     \brief Begins construction of a tree whose nodes are allocated with the given allocator.
+    */
+    explicit Builder(Allocator const &allocator = Allocator{})
+        : Builder(1, allocator)
+    {}
+
+    /*!
+     \brief Begins construction of a tree with room for the given total number of
+        nodes, so that adding them allocates once.
+
+        The count includes the root node that every builder adds, and every node of
+        the trees attached with tree().
+    */
+    explicit Builder(size_t node_count, Allocator const &allocator = Allocator{})
+        : BuilderBase<C, Allocator>(*this, 0, BuilderBase<C, Allocator>::Type::DECORATOR)
+        , _nodes(typename Bodies::allocator_type(allocator))
+    {
+        _nodes.reserve(node_count);
+        using Forwarder = FunctionConstant<decltype(&forwarder<C>), &forwarder<C>>;
+        _nodes.emplace_back(DecoratorProcess<C, Forwarder>{{}});
+        _nodes[0].opcode = detail::Opcode::FORWARDER;
+    }
+    
+    Builder(Builder const &) = delete; //!< Deleted copy constructor.
+    Builder(Builder &&) = default; //!< Move constructor.
+    Builder &operator=(Builder const &) = delete; //!< Deleted copy assignment operator.
+    Builder &operator=(Builder &&) = default; //!< Move assignment operator.
+
+    virtual Tree<C, Allocator> build() const & override
+    {
+        assert(_nodes[0].child_count > 0); // must have at least one leaf node added
+        return {_nodes};
+    }
+
+    virtual Tree<C, Allocator> build() && override
+    {
+        assert(_nodes[0].child_count > 0); // must have at least one leaf node added
+        return {std::move(_nodes)};
+    }
+
+private:
+    using typename BuilderBase<C, Allocator>::Bodies;
+
+    virtual Bodies &nodes() override {
+        return _nodes;
+    }
+    
+    Bodies _nodes;
+};
+
+/// @cond
+template<typename C, typename A>
+template<typename F>
+auto BuilderBase<C, A>::composite(F &&composite) -> BuilderBase
+{
+    using Process = CompositeProcess<C, typename std::decay<F>::type>;
+    auto branch = _branch(Process{std::forward<F>(composite)}, Type::COMPOSITE);
+    branch.node().opcode = detail::Opcode::COMPOSITE;
+    return branch;
+}
+
+template<typename C, typename A>
+template<typename F>
+auto BuilderBase<C, A>::utility_selector(F &&score) -> BuilderBase
+{
+    using Process = UtilityProcess<C, typename std::decay<F>::type>;
+    auto branch = _branch(Process{std::forward<F>(score)}, Type::COMPOSITE);
+    branch.node().opcode = detail::Opcode::UTILITY;
+    return branch;
+}
+
+template<typename C, typename A>
+template<typename F>
+auto BuilderBase<C, A>::decorator(F &&decorator) -> BuilderBase
+{
+    using Process = DecoratorProcess<C, typename std::decay<F>::type>;
+    auto branch = _branch(Process{std::forward<F>(decorator)}, Type::DECORATOR);
+    branch.node().opcode = detail::Opcode::DECORATOR;
+    return branch;
+}
+
+template<typename C, typename A>
+template<typename Process>
+auto BuilderBase<C, A>::_branch(Process &&process, Type type) -> BuilderBase
+{
+    assert((_type != Type::DECORATOR) || node().child_count == 0); // Decorators may only have one child!
+    auto child_offset = add_child(std::forward<Process>(process));
+    return {*this, child_offset, type};
+}
+
+template<typename C, typename A>
+template<typename Process>
+auto BuilderBase<C, A>::_leaf(Process &&process) -> BuilderBase &
+{
+    assert((_type != Type::DECORATOR) || node().child_count == 0); // Decorators may only have one child!
+    auto const child_offset = add_child(std::forward<Process>(process));
+    nodes()[child_offset].opcode = detail::Opcode::LEAF;
+    return *this;
+}
+
+template<typename C, typename A>
+template<typename L>
+auto BuilderBase<C, A>::leaf(L &&leaf) -> BuilderBase &
+{
+    using Process = LeafProcess<C, typename std::decay<L>::type>;
+    return _leaf(Process{std::forward<L>(leaf)});
+}
+
+template<typename C, typename A>
+template<typename L>
+auto BuilderBase<C, A>::void_leaf(L &&leaf) -> BuilderBase &
+{
+    using Process = VoidLeafProcess<C, typename std::decay<L>::type>;
+    return _leaf(Process{std::forward<L>(leaf)});
+}
+
+template<typename C, typename A>
+template<typename L>
+auto BuilderBase<C, A>::memoized_leaf(L &&leaf) -> BuilderBase &
+{
+    using Process = MemoizedProcess<C, LeafProcess<C, typename std::decay<L>::type>>;
+    _leaf(Process{{std::forward<L>(leaf)}});
+    auto &node = nodes().back();
+    node.opcode = detail::Opcode::LEAF;
+    node.slot_count = 2;
+    node.memo = detail::memo_key();
+    return *this;
+}
+
+template<typename C, typename A>
+template<typename L>
+auto BuilderBase<C, A>::condition(L &&leaf) -> BuilderBase &
+{
+    this->leaf(std::forward<L>(leaf));
+    nodes().back().condition = true;
+    return *this;
+}
+
+template<typename C, typename A>
+template<typename OtherAllocator>
+auto BuilderBase<C, A>::tree(Tree<C, OtherAllocator> const &subtree) -> BuilderBase &
+{
+    assert((_type != Type::DECORATOR) || node().child_count == 0); // Decorators may only have one child!
+    auto const &subtree_bodies = subtree._bodies;
+    copy(subtree_bodies.begin(), subtree_bodies.end(), back_inserter(nodes()));
+    node().add_child();
+    return *this;
+}
+
+template<typename C, typename A>
+template<typename OtherAllocator>
+auto BuilderBase<C, A>::subtree_ref(std::shared_ptr<Tree<C, OtherAllocator> const> subtree) -> BuilderBase &
+{
+    assert(subtree); // null subtree!
+    auto const depth = 1 + subtree->_depth;
+    auto const slot_count = subtree->_slot_count;
+    _leaf(SubtreeProcess<C, Tree<C, OtherAllocator>>{std::move(subtree)});
+    auto &node = nodes().back();
+    node.opcode = detail::Opcode::SUBTREE;
+    node.subtree_depth = static_cast<uint32_t>(depth);
+    node.slot_count = static_cast<uint32_t>(slot_count);
+    return *this;
+}
+
+#if BEEHIVE_COROUTINES
+template<typename C, typename A>
+template<typename F>
+auto BuilderBase<C, A>::action(F &&function, FrameAllocator *allocator) -> BuilderBase &
+{
+    using Process = ActionProcess<C, typename std::decay<F>::type>;
+    _leaf(Process{std::forward<F>(function), allocator});
+    auto &node = nodes().back();
+    node.subtree_depth = 1; // its own resume frame
+    node.slot_count = 1;
+    return *this;
+}
+#endif
+
+template<typename C, typename A>
+template<typename F>
+auto BuilderBase<C, A>::async_leaf(AsyncQueue &queue, F &&start) -> BuilderBase &
+{
+    using Process = AsyncProcess<C, typename std::decay<F>::type>;
+    _leaf(Process{std::forward<F>(start), &queue});
+    auto &node = nodes().back();
+    node.subtree_depth = 1; // its own resume frame
+    node.slot_count = 1;
+    return *this;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::leaf(FunctionTable<C> const &table, std::string const &name) -> BuilderBase &
+{
+    auto const function = table.find(name, detail::Opcode::LEAF, detail::Opcode::SUBTREE);
+    auto const &entry = table._entries[function];
+    _leaf(typename Node<C>::ProcessFunction{entry.process});
+    auto &node = nodes().back();
+    node.opcode = entry.opcode;
+    node.subtree_depth = static_cast<uint32_t>(entry.subtree_depth);
+    node.slot_count = entry.slot_count;
+    node.memo = entry.memo;
+    node.function = function;
+    return *this;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::condition(FunctionTable<C> const &table, std::string const &name) -> BuilderBase &
+{
+    leaf(table, name);
+    nodes().back().condition = true;
+    return *this;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::composite(FunctionTable<C> const &table, std::string const &name) -> BuilderBase
+{
+    auto const function = table.find(name, detail::Opcode::COMPOSITE, detail::Opcode::COMPOSITE);
+    auto branch = _branch(typename Node<C>::ProcessFunction{table._entries[function].process}, Type::COMPOSITE);
+    branch.node().opcode = detail::Opcode::COMPOSITE;
+    branch.node().function = function;
+    return branch;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::decorator(FunctionTable<C> const &table, std::string const &name) -> BuilderBase
+{
+    auto const function = table.find(name, detail::Opcode::DECORATOR, detail::Opcode::DECORATOR);
+    auto branch = _branch(typename Node<C>::ProcessFunction{table._entries[function].process}, Type::DECORATOR);
+    branch.node().opcode = detail::Opcode::DECORATOR;
+    branch.node().function = function;
+    return branch;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::utility_selector(FunctionTable<C> const &table, std::string const &name) -> BuilderBase
+{
+    auto const function = table.find(name, detail::Opcode::UTILITY, detail::Opcode::UTILITY);
+    auto branch = _branch(typename Node<C>::ProcessFunction{table._entries[function].process}, Type::COMPOSITE);
+    branch.node().opcode = detail::Opcode::UTILITY;
+    branch.node().function = function;
+    return branch;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::reactive(uint64_t keys) -> BuilderBase
+{
+    auto branch = _branch(ReactiveProcess<C>{keys}, Type::DECORATOR);
+    branch.node().opcode = detail::Opcode::REACTIVE;
+    branch.node().slot_count = 2;
+    return branch;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::shared() -> BuilderBase
+{
+    auto branch = _branch(SharedProcess<C>{}, Type::DECORATOR);
+    branch.node().opcode = detail::Opcode::SHARED;
+    return branch;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::parallel(size_t success_threshold, size_t failure_threshold, ThreadPool *threads) -> BuilderBase
+{
+    assert(success_threshold > 0 && failure_threshold > 0); // thresholds must be positive!
+    auto branch = _branch(ParallelProcess<C>{success_threshold, failure_threshold, threads}, Type::COMPOSITE);
+    branch.node().opcode = detail::Opcode::PARALLEL;
+    branch._threaded = threads != nullptr;
+    return branch;
+}
+
+template<typename C, typename A>
+template<detail::Opcode Op>
+auto BuilderBase<C, A>::_stateful(uint64_t parameter, uint32_t count, TimeSource now) -> BuilderBase
+{
+    using Process = StatefulDecoratorProcess<C, Op>;
+    auto branch = _branch(Process{parameter, count, now}, Type::DECORATOR);
+    branch.node().opcode = Op;
+    branch.node().slot_count = Process::slot_count;
+    return branch;
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::repeat(size_t count) -> BuilderBase
+{
+    assert(count > 0 && count <= UINT32_MAX); // count out of range!
+    return _stateful<detail::Opcode::REPEAT>(count, 0, nullptr);
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::retry(size_t attempts) -> BuilderBase
+{
+    assert(attempts > 0 && attempts <= UINT32_MAX); // count out of range!
+    return _stateful<detail::Opcode::RETRY>(attempts, 0, nullptr);
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::cooldown(std::chrono::steady_clock::duration period, TimeSource now) -> BuilderBase
+{
+    auto const nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+    return _stateful<detail::Opcode::COOLDOWN>(static_cast<uint64_t>(nanoseconds), 0, now);
+}
+
+template<typename C, typename A>
+auto BuilderBase<C, A>::timeout(std::chrono::steady_clock::duration limit, TimeSource now) -> BuilderBase
+{
+    auto const nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(limit).count();
+    return _stateful<detail::Opcode::TIMEOUT>(static_cast<uint64_t>(nanoseconds), 0, now);
 }
 
-/*!
- \brief A decorator is a composite that may only have a single child.
-*/
-template<typename C>
-using Decorator = std::function<Status(C &context, Node<C> const &child, TreeState &state)>;
-
-/*!
- \brief Decorator that just returns the result of the child. Not very useful...
-*/
-template<typename C>
-Status forwarder(C &context, Node<C> const &child, TreeState &state)
+template<typename C, typename A>
+auto BuilderBase<C, A>::rate_limit(size_t count, std::chrono::steady_clock::duration period, TimeSource now) -> BuilderBase
 {
-    return child.process(context, state);
+    assert(count > 0 && count <= UINT32_MAX); // count out of range!
+    auto const nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+    return _stateful<detail::Opcode::RATE_LIMIT>(static_cast<uint64_t>(nanoseconds), static_cast<uint32_t>(count), now);
 }
 
-/*!
- \brief Decorator that inverts the result of its child node.
-*/
-template<typename C>
-Status inverter(C &context, Node<C> const &child, TreeState &state)
+template<typename C, typename A>
+auto BuilderBase<C, A>::end() -> BuilderBase &
 {
-    const auto status = child.process(context, state);
-    if (status == Status::RUNNING)
-    {
-        return status;
+    assert(node().child_count > 0); // can't have composite/decorator without children!
+    if (node().opcode == detail::Opcode::PARALLEL) {
+        node().slot_count = node().child_count; // one per child
+        // Children on a thread pool run on scratch states, see ParallelProcess.
+        auto const &bodies = nodes();
+        for (auto i = _offset + 1; _threaded && i < bodies.size(); ++i) {
+            if (bodies[i].slot_count > 0) {
+                throw std::invalid_argument(
+                    std::string(detail::opcode_name(bodies[i].opcode)) + " needs slots, so it can't run under a parallel on a thread pool"
+                );
+            }
+        }
     }
-    return status == Status::FAILURE ? Status::SUCCESS : Status::FAILURE;
+    return _parent;
 }
 
-/*!
- \brief Decorator that returns success regardless of the child result.
-*/
-template<typename C>
-Status succeeder(C &context, Node<C> const &child, TreeState &state)
+template<typename C, typename A>
+auto BuilderBase<C, A>::build() const & -> Tree<C, A>
 {
-    child.process(context, state);
-    return Status::SUCCESS;
+    assert(false); // unterminated tree!
+    return {Bodies(_parent.nodes().get_allocator())};
 }
 
+template<typename C, typename A>
+auto BuilderBase<C, A>::build() && -> Tree<C, A>
+{
+    assert(false); // unterminated tree!
+    return {Bodies(_parent.nodes().get_allocator())};
+}
 
-template<typename ReturnType, typename ContextType>
-using BasicLeaf = std::function<ReturnType(ContextType &context)>; //!< Leaf nodes are the `process()` function taking the mutable context and must return a status.
+#define BH_IMPLEMENT_SHORTHAND(Type, Name, Op) \
+    template<typename Context, typename A> \
+    auto BuilderBase<Context, A>::Name() -> BuilderBase \
+    { \
+        using Function = FunctionConstant<decltype(&beehive::Name<Context>), &beehive::Name<Context>>; \
+        auto branch = Type(Function{}); \
+        branch.node().opcode = detail::Opcode::Op; \
+        return branch; \
+    }
 
-template<typename C>
-using Leaf = BasicLeaf<Status, C>; //!< A Leaf function takes a Context & and returns a Status.
+BH_IMPLEMENT_SHORTHAND(composite, sequence, SEQUENCE);
+BH_IMPLEMENT_SHORTHAND(composite, selector, SELECTOR);
+BH_IMPLEMENT_SHORTHAND(decorator, inverter, INVERTER);
+BH_IMPLEMENT_SHORTHAND(decorator, succeeder, SUCCEEDER);
 
-template<typename C>
-using BoolLeaf = BasicLeaf<bool, C>; //!< A Leaf function returning bool returns SUCCESS on true and FAILURE on false. It is not possible to return RUNNING from such a function.
+#undef BH_IMPLEMENT_SHORTHAND
+/// @endcond
 
+/// @cond
 template<typename C>
-using VoidLeaf = BasicLeaf<void, C>; //!< A Leaf function returning anything other than bool or Status can be added using #beehive::BuilderBase::void_leaf. The return value is ignored and SUCCESS is returned.
+template<typename A>
+std::vector<unsigned char> FunctionTable<C>::serialize(Tree<C, A> const &tree) const
+{
+    // Each entry used is named once, in order of first use.
+    std::vector<uint32_t> names(_entries.size(), none);
+    std::vector<uint32_t> used;
+    std::vector<Record> records;
+    records.reserve(tree._bodies.size());
+    for (size_t index = 0; index < tree._bodies.size(); ++index) {
+        auto const &body = tree._bodies[index];
+        Record record{};
+        record.name = none;
+        record.child_count = static_cast<uint32_t>(body.child_count);
+        record.opcode = static_cast<uint8_t>(body.opcode);
+        record.flags = body.condition ? condition_flag : 0;
+        switch (body.opcode) {
+        case detail::Opcode::SHARED:
+        case detail::Opcode::FORWARDER:
+        case detail::Opcode::INVERTER:
+        case detail::Opcode::SUCCEEDER:
+        case detail::Opcode::SEQUENCE:
+        case detail::Opcode::SELECTOR:
+            break;
+        case detail::Opcode::REACTIVE: {
+            auto const *reactive = body.process.template target<ReactiveProcess<C>>();
+            assert(reactive); // invariant violation!
+            record.parameter = reactive->keys;
+            break;
+        }
+        case detail::Opcode::PARALLEL: {
+            auto const *parallel = body.process.template target<ParallelProcess<C>>();
+            assert(parallel); // invariant violation!
+            // Thresholds are capped at the child count, which fits in 32 bits.
+            auto const clamp = [](size_t threshold) {
+                return static_cast<uint64_t>(std::min<size_t>(threshold, UINT32_MAX));
+            };
+            record.parameter = clamp(parallel->success_threshold) | clamp(parallel->failure_threshold) << 32;
+            break;
+        }
+        case detail::Opcode::REPEAT:
+            save_stateful<detail::Opcode::REPEAT>(body, record);
+            break;
+        case detail::Opcode::RETRY:
+            save_stateful<detail::Opcode::RETRY>(body, record);
+            break;
+        case detail::Opcode::COOLDOWN:
+            save_stateful<detail::Opcode::COOLDOWN>(body, record);
+            break;
+        case detail::Opcode::TIMEOUT:
+            save_stateful<detail::Opcode::TIMEOUT>(body, record);
+            break;
+        case detail::Opcode::RATE_LIMIT:
+            save_stateful<detail::Opcode::RATE_LIMIT>(body, record);
+            break;
+        default:
+            if (body.function >= _entries.size()) {
+                throw std::invalid_argument("node " + std::to_string(index) + " wasn't built from a FunctionTable entry");
+            }
+            if (names[body.function] == none) {
+                names[body.function] = static_cast<uint32_t>(used.size());
+                used.push_back(body.function);
+            }
+            record.name = names[body.function];
+            break;
+        }
+        records.push_back(record);
+    }
+
+    std::string characters;
+    std::vector<Name> name_records;
+    for (auto const function : used) {
+        auto const &name = _entries[function].name;
+        name_records.push_back({static_cast<uint32_t>(characters.size()), static_cast<uint32_t>(name.size())});
+        characters += name;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.node_count = static_cast<uint32_t>(records.size());
+    header.name_count = static_cast<uint32_t>(name_records.size());
+    header.names_size = static_cast<uint32_t>(characters.size());
+
+    std::vector<unsigned char> bytes(
+        sizeof(Header)
+        + records.size() * sizeof(Record)
+        + name_records.size() * sizeof(Name)
+        + characters.size()
+    );
+    auto *out = bytes.data();
+    auto const write = [&out](void const *data, size_t size) {
+        if (size != 0) {
+            std::memcpy(out, data, size);
+            out += size;
+        }
+    };
+    write(&header, sizeof(Header));
+    write(records.data(), records.size() * sizeof(Record));
+    write(name_records.data(), name_records.size() * sizeof(Name));
+    write(characters.data(), characters.size());
+    return bytes;
+}
 
-/*!
- \brief A leaf that always succeeds. Not very useful...
-*/
 template<typename C>
-Status noop(C &)
+Tree<C> FunctionTable<C>::deserialize(void const *data, size_t size) const
 {
-    return Status::SUCCESS;
-}
+    auto const *bytes = static_cast<unsigned char const *>(data);
+    Header header;
+    if (size < sizeof(Header)) {
+        throw std::runtime_error("serialized tree is truncated");
+    }
+    std::memcpy(&header, bytes, sizeof(Header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error("not a serialized tree");
+    }
+    if (header.version != version) {
+        throw std::runtime_error("unsupported serialized tree version");
+    }
+    uint64_t const records_offset = sizeof(Header);
+    auto const names_offset = records_offset + uint64_t{header.node_count} * sizeof(Record);
+    auto const characters_offset = names_offset + uint64_t{header.name_count} * sizeof(Name);
+    if (characters_offset + header.names_size != size) {
+        throw std::runtime_error("serialized tree has the wrong size");
+    }
+    if (header.node_count == 0) {
+        throw std::runtime_error("serialized tree has no nodes");
+    }
 
-size_t id() {
-    static size_t id{};
-    return ++id;
+    // Resolve each name once, so that the records map straight to entries.
+    std::vector<uint32_t> functions(header.name_count);
+    for (size_t i = 0; i < functions.size(); ++i) {
+        Name name;
+        std::memcpy(&name, bytes + names_offset + i * sizeof(Name), sizeof(Name));
+        if (uint64_t{name.offset} + name.size > header.names_size) {
+            throw std::runtime_error("serialized tree has a name out of range");
+        }
+        std::string const key(reinterpret_cast<char const *>(bytes + characters_offset + name.offset), name.size);
+        auto const it = _index.find(key);
+        if (it == _index.end()) {
+            throw std::runtime_error("no FunctionTable entry named \"" + key + "\"");
+        }
+        functions[i] = it->second;
+    }
+
+    using Function = typename Node<C>::ProcessFunction;
+    typename Tree<C>::Bodies bodies;
+    bodies.reserve(header.node_count);
+    uint64_t expected = 1; // nodes still to come in the root's subtree
+    for (size_t i = 0; i < header.node_count; ++i) {
+        Record record;
+        std::memcpy(&record, bytes + records_offset + i * sizeof(Record), sizeof(Record));
+        if (expected == 0) {
+            throw std::runtime_error("serialized tree has nodes outside of the root");
+        }
+        expected += record.child_count;
+        --expected;
+
+        auto const opcode = static_cast<detail::Opcode>(record.opcode);
+        auto const children = record.child_count;
+        auto const check = [](bool valid) {
+            if (!valid) {
+                throw std::runtime_error("serialized tree has an invalid node");
+            }
+        };
+        check((record.flags & ~condition_flag) == 0);
+        Function process;
+        size_t subtree_depth = 0;
+        uint32_t slot_count = 0;
+        auto function = Node<C>::unregistered;
+        auto memo = Node<C>::unmemoized;
+        switch (opcode) {
+        case detail::Opcode::FORWARDER:
+            check(children == 1);
+            process = DecoratorProcess<C, FunctionConstant<decltype(&forwarder<C>), &forwarder<C>>>{{}};
+            break;
+        case detail::Opcode::INVERTER:
+            check(children == 1);
+            process = DecoratorProcess<C, FunctionConstant<decltype(&inverter<C>), &inverter<C>>>{{}};
+            break;
+        case detail::Opcode::SUCCEEDER:
+            check(children == 1);
+            process = DecoratorProcess<C, FunctionConstant<decltype(&succeeder<C>), &succeeder<C>>>{{}};
+            break;
+        case detail::Opcode::SEQUENCE:
+            check(children > 0);
+            process = CompositeProcess<C, FunctionConstant<decltype(&sequence<C>), &sequence<C>>>{{}};
+            break;
+        case detail::Opcode::SELECTOR:
+            check(children > 0);
+            process = CompositeProcess<C, FunctionConstant<decltype(&selector<C>), &selector<C>>>{{}};
+            break;
+        case detail::Opcode::SHARED:
+            check(children == 1);
+            process = SharedProcess<C>{};
+            break;
+        case detail::Opcode::REACTIVE:
+            check(children == 1);
+            process = ReactiveProcess<C>{record.parameter};
+            slot_count = 2;
+            break;
+        case detail::Opcode::PARALLEL: {
+            auto const success_threshold = static_cast<uint32_t>(record.parameter);
+            auto const failure_threshold = static_cast<uint32_t>(record.parameter >> 32);
+            check(children > 0 && success_threshold > 0 && failure_threshold > 0);
+            process = ParallelProcess<C>{success_threshold, failure_threshold, nullptr};
+            slot_count = children;
+            break;
+        }
+        case detail::Opcode::REPEAT:
+            check(children == 1 && record.parameter > 0 && record.parameter <= UINT32_MAX);
+            process = load_stateful<detail::Opcode::REPEAT>(record, slot_count);
+            break;
+        case detail::Opcode::RETRY:
+            check(children == 1 && record.parameter > 0 && record.parameter <= UINT32_MAX);
+            process = load_stateful<detail::Opcode::RETRY>(record, slot_count);
+            break;
+        case detail::Opcode::COOLDOWN:
+            check(children == 1);
+            process = load_stateful<detail::Opcode::COOLDOWN>(record, slot_count);
+            break;
+        case detail::Opcode::TIMEOUT:
+            check(children == 1);
+            process = load_stateful<detail::Opcode::TIMEOUT>(record, slot_count);
+            break;
+        case detail::Opcode::RATE_LIMIT:
+            check(children == 1 && record.count > 0);
+            process = load_stateful<detail::Opcode::RATE_LIMIT>(record, slot_count);
+            break;
+        case detail::Opcode::LEAF:
+        case detail::Opcode::SUBTREE:
+        case detail::Opcode::COMPOSITE:
+        case detail::Opcode::DECORATOR:
+        case detail::Opcode::UTILITY: {
+            check(record.name < functions.size());
+            function = functions[record.name];
+            auto const &entry = _entries[function];
+            check(entry.opcode == opcode);
+            auto const branch = opcode == detail::Opcode::COMPOSITE || opcode == detail::Opcode::UTILITY;
+            check(branch ? children > 0 : children == (opcode == detail::Opcode::DECORATOR));
+            process = entry.process;
+            subtree_depth = entry.subtree_depth;
+            slot_count = entry.slot_count;
+            memo = entry.memo;
+            break;
+        }
+        default:
+            check(false);
+        }
+
+        bodies.emplace_back(std::move(process));
+        auto &body = bodies.back();
+        body.child_count = children;
+        body.subtree_depth = static_cast<uint32_t>(subtree_depth);
+        body.slot_count = slot_count;
+        body.memo = memo;
+        body.opcode = opcode;
+        body.condition = (record.flags & condition_flag) != 0;
+        body.function = function;
+    }
+    if (expected != 0) {
+        throw std::runtime_error("serialized tree is missing nodes");
+    }
+    return {std::move(bodies)};
 }
+/// @endcond
 
 /*!
- \brief The behavior tree class which passes the ContextType around. See #beehive::Builder for making one.
+ \brief A tree run by a flat interpreter instead of by recursive process() calls.
+    See #beehive::Tree::compile.
+
+    The nodes are compiled into one instruction per node, holding the opcode,
+    the child count and the distance to the next sibling. The built-in sequence,
+    selector, inverter, succeeder and reactive nodes run inside a single switch
+    loop that keeps its own stack, so only leaves and custom composites or
+    decorators are called indirectly, and a chain of built-in branches never
+    grows the native stack, however deep. The stack holds at most one frame per
+    level of the tree's depth, which the tree computes once; deep trees keep
+    theirs in a buffer per thread, so ticks don't allocate. Custom composites
+    and decorators, parallel() and subtree references run their subtree through
+    the recursive path as usual.
+
+    The results are the same as the source tree's, and states made by either
+    tree can be used with both.
 */
 template<typename ContextType, typename A = std::allocator<Node<ContextType>>>
-class Tree
+class CompiledTree
 {
 public:
     using Context = ContextType;
 
+    /*!
+     \brief Compiles a copy of the given tree.
+    */
+    explicit CompiledTree(Tree<Context, A> tree);
+
     /*!
      \brief Process with the given context reference.
     */
@@ -233,428 +6363,888 @@ public:
     Status process(TreeState &state, Context &context) const;
 
     /*!
-     \brief Retrieves the nodes, for debugging purposes.
+     \brief Like #beehive::Tree::process_budgeted. Only leaves and custom
+        branches count against the budget, since the built-in branches run
+        inside the interpreter.
     */
-    std::vector<Node<Context>, A> const &nodes() const {
-        return _nodes;
+    Status process_budgeted(TreeState &state, Context &context, Budget &budget) const;
+
+    /*!
+     \brief Creates a state object that can be passed to subsequent process() calls.
+    */
+    TreeState make_state() const {
+        return _tree.make_state();
     }
 
     /*!
-     \brief Creates a state object that can be passed to subsequent process() calls. 
-    */    
-    TreeState make_state() const {  
-        return {_id};
+     \brief Returns the source tree.
+    */
+    Tree<Context, A> const &tree() const {
+        return _tree;
     }
 
 private:
-    template<typename C, typename Allocator>
-    friend class BuilderBase;
+    struct Instruction
+    {
+        detail::Opcode opcode;
+        uint32_t child_count; // or, for REACTIVE, the index of its Reactive
+        uint32_t skip; // offset to the next sibling
+    };
 
-    template<typename C, typename Allocator>
-    friend class Builder;
-    
-    /*!
-     \brief Constructs a tree with the given nodes.
-        See #beehive::Builder.
-    */
-    Tree(std::vector<Node<Context>, A> nodes);
+    // What a reactive node needs, kept apart so instructions stay small.
+    struct Reactive
+    {
+        uint64_t keys;
+        uint32_t slot;
+    };
 
-    std::vector<Node<Context>, A> _nodes;
-    size_t _id{id()};
+    // A built-in branch that is waiting on a child.
+    struct Frame
+    {
+        uint32_t node;
+        uint32_t position; // children started so far
+        uint32_t next; // the next child to start
+        uint32_t depth; // the state's path depth on entry
+    };
+
+    static constexpr size_t inline_frame_count = 32;
+
+    // The frames of runs on trees deeper than inline_frame_count, reused by
+    // every run on the thread. A run started from inside another, such as by
+    // a leaf, takes the next buffer, so buffers in use never move.
+    class DeepFrames
+    {
+    public:
+        explicit DeepFrames(size_t count)
+            : _stack(stack())
+        {
+            if (_stack.used == _stack.buffers.size()) {
+                _stack.buffers.emplace_back();
+            }
+            auto &buffer = _stack.buffers[_stack.used];
+            if (buffer.size() < count) {
+                buffer.resize(count);
+            }
+            _frames = buffer.data();
+            ++_stack.used;
+        }
+
+        DeepFrames(DeepFrames const &) = delete;
+        DeepFrames &operator=(DeepFrames const &) = delete;
+
+        ~DeepFrames()
+        {
+            --_stack.used;
+        }
+
+        Frame *frames() const {
+            return _frames;
+        }
+
+    private:
+        struct Stack
+        {
+            std::vector<std::vector<Frame>> buffers;
+            size_t used{};
+        };
+
+        static Stack &stack()
+        {
+            static thread_local Stack stack;
+            return stack;
+        }
+
+        Stack &_stack;
+        Frame *_frames;
+    };
+
+    Status run(Context &context, TreeState &state) const;
+
+    Status run(Context &context, TreeState &state, Frame *frames) const;
+
+    Tree<Context, A> _tree;
+    std::vector<Instruction> _code;
+    std::vector<Reactive> _reactive;
 };
 
+template<typename C, typename A, typename I>
+CompiledTree<C, A> Tree<C, A, I>::compile() const
+{
+    static_assert(std::is_same<I, NoInstrumentation>::value, "instrumented trees can't be compiled");
+    return CompiledTree<C, A>{*this};
+}
+
 template<typename C, typename A>
-Tree<C, A>::Tree(std::vector<Node<Context>, A> nodes)
-    : _nodes(move(nodes))
+CompiledTree<C, A>::CompiledTree(Tree<Context, A> tree)
+    : _tree(std::move(tree))
 {
-    size_t i = 0;
-    for (auto &node : _nodes) {
-        node._index = i++; 
+    _code.reserve(_tree._nodes.size());
+    for (auto const &node : _tree._nodes) {
+        auto const &body = *node._body;
+        auto child_count = node._child_count;
+        if (body.opcode == detail::Opcode::REACTIVE) {
+            auto const *reactive = body.process.template target<ReactiveProcess<C>>();
+            assert(reactive); // invariant violation!
+            child_count = static_cast<uint32_t>(_reactive.size());
+            _reactive.push_back({reactive->keys, node._slot});
+        }
+        _code.push_back({
+            body.opcode,
+            child_count,
+            static_cast<uint32_t>(node._descendent_count + 1),
+        });
     }
 }
 
 template<typename C, typename A>
-Status Tree<C, A>::process(Context &context) const
+Status CompiledTree<C, A>::process(Context &context) const
 {
-    TreeState state{_id};
-    return _nodes[0].process(context, state);
+    TreeState state{_tree._id}; // no room for a path, so nothing to resume or allocate
+    return run(context, state);
 }
 
 template<typename C, typename A>
-Status Tree<C, A>::process(TreeState &state, Context &context) const
+Status CompiledTree<C, A>::process(TreeState &state, Context &context) const
 {
-    assert(state._tree_id == _id); // another tree's state used with this tree 
-    return _nodes.at(state.resume_index).process(context, state);
+    assert(state._tree_id == _tree._id); // another tree's state used with this tree
+    state.begin();
+    auto const status = run(context, state);
+    state.end(status);
+    return status;
 }
 
-/// @cond
-template<typename C>
-auto make_branch(Decorator<C> f) -> typename Node<C>::ProcessFunction;
+template<typename C, typename A>
+Status CompiledTree<C, A>::process_budgeted(TreeState &state, Context &context, Budget &budget) const
+{
+    state._budget = &budget;
+    struct Reset
+    {
+        ~Reset() { state._budget = nullptr; }
+        TreeState &state;
+    } reset{state};
+    return process(state, context);
+}
 
-template<typename C>
-auto make_branch(Composite<C> f) -> typename Node<C>::ProcessFunction;
+template<typename C, typename A>
+Status CompiledTree<C, A>::run(Context &context, TreeState &state) const
+{
+    // Only built-in branches take a frame, so the tree depth is always enough.
+    if (_tree._depth > inline_frame_count) {
+        DeepFrames const deep{_tree._depth};
+        return run(context, state, deep.frames());
+    }
+    Frame frames[inline_frame_count];
+    return run(context, state, frames);
+}
 
-template<typename C>
-auto make_leaf(Leaf<C> f) -> typename Node<C>::ProcessFunction;
+template<typename C, typename A>
+Status CompiledTree<C, A>::run(Context &context, TreeState &state, Frame *frames) const
+{
+    using detail::Opcode;
 
-template<typename C>
-auto make_leaf(VoidLeaf<C> f) -> typename Node<C>::ProcessFunction;
+    size_t top = 0;
 
-template<typename C>
-auto make_leaf(BoolLeaf<C> f) -> typename Node<C>::ProcessFunction;
-/// @endcond
+    uint32_t node = 0;
+    auto status = Status::FAILURE;
+    for (;;) {
+        // Enter the node, descending through built-in branches until a node
+        // finishes with a status.
+        auto const &instruction = _code[node];
+        switch (instruction.opcode) {
+        case Opcode::FORWARDER:
+        case Opcode::INVERTER:
+        case Opcode::SUCCEEDER:
+            frames[top++] = {node, 1, 0, 0};
+            ++node;
+            continue;
+        case Opcode::SEQUENCE:
+        case Opcode::SELECTOR: {
+            auto &frame = frames[top++];
+            frame = {node, 0, node + 1, static_cast<uint32_t>(state._depth)};
+            size_t offset = 0;
+            if (state.resume(node, offset)) {
+                for (; frame.position < offset; ++frame.position) {
+                    frame.next += _code[frame.next].skip;
+                }
+            }
+            node = frame.next;
+            frame.next += _code[node].skip;
+            ++frame.position;
+            continue;
+        }
+        case Opcode::REACTIVE: {
+            auto const &reactive = _reactive[instruction.child_count];
+            status = ReactiveProcess<C>::lookup(state, state._slot_base + reactive.slot, reactive.keys);
+            if (status != Status::RUNNING) {
+                break; // cached
+            }
+            frames[top++] = {node, 1, 0, 0};
+            ++node;
+            continue;
+        }
+        case Opcode::CALL:
+        case Opcode::LEAF:
+        case Opcode::COMPOSITE:
+        case Opcode::DECORATOR:
+        case Opcode::SUBTREE:
+        case Opcode::PARALLEL:
+        case Opcode::REPEAT:
+        case Opcode::RETRY:
+        case Opcode::COOLDOWN:
+        case Opcode::TIMEOUT:
+        case Opcode::RATE_LIMIT:
+        case Opcode::UTILITY:
+        case Opcode::SHARED:
+            status = _tree._nodes[node].process(context, state);
+            break;
+        }
 
-template<typename C, typename A>
-class Builder;
+        // Hand the status up until a composite has another child to start.
+        auto descend = false;
+        while (!descend) {
+            if (top == 0) {
+                return status;
+            }
+            auto &frame = frames[top - 1];
+            auto const &parent = _code[frame.node];
+            switch (parent.opcode) {
+            case Opcode::FORWARDER:
+                break;
+            case Opcode::INVERTER:
+                if (status != Status::RUNNING) {
+                    status = status == Status::FAILURE ? Status::SUCCESS : Status::FAILURE;
+                }
+                break;
+            case Opcode::SUCCEEDER:
+                status = Status::SUCCESS;
+                break;
+            case Opcode::REACTIVE: {
+                auto const &reactive = _reactive[parent.child_count];
+                ReactiveProcess<C>::store(state, state._slot_base + reactive.slot, status);
+                break;
+            }
+            case Opcode::SEQUENCE:
+            case Opcode::SELECTOR: {
+                auto const proceed = parent.opcode == Opcode::SEQUENCE ? Status::SUCCESS : Status::FAILURE;
+                // Run further calls in place; only built-in branches need the outer loop.
+                for (;;) {
+                    if (status == Status::RUNNING) {
+                        // The running child's path is on the stack, add this composite above it.
+                        state.push(frame.node, frame.position - 1);
+                        break;
+                    }
+                    // As with a Generator, forget the path of any earlier child.
+                    state._depth = frame.depth;
+                    if (status != proceed || frame.position == parent.child_count) {
+                        break;
+                    }
+                    node = frame.next;
+                    frame.next += _code[node].skip;
+                    ++frame.position;
+                    if (!detail::is_call(_code[node].opcode)) {
+                        descend = true;
+                        break;
+                    }
+                    status = _tree._nodes[node].process(context, state);
+                }
+                if (descend) {
+                    continue;
+                }
+                break;
+            }
+            case Opcode::CALL:
+            case Opcode::LEAF:
+            case Opcode::COMPOSITE:
+            case Opcode::DECORATOR:
+            case Opcode::SUBTREE:
+            case Opcode::PARALLEL:
+            case Opcode::REPEAT:
+            case Opcode::RETRY:
+            case Opcode::COOLDOWN:
+            case Opcode::TIMEOUT:
+            case Opcode::RATE_LIMIT:
+            case Opcode::UTILITY:
+            case Opcode::SHARED:
+                assert(false); // calls never take a frame!
+                break;
+            }
+            --top;
+        }
+    }
+}
 
 /*!
- \brief A helper for building trees which can be instantiated as #beehive::Builder.
+ \brief Instrumentation that counts the calls, statuses and time of every node.
+    See #beehive::Tree::instrumented.
+
+    Not thread-safe, so don't use it with process_batch() on a #beehive::ThreadPool.
 */
-template<typename C, typename A>
-class BuilderBase
+class Profiler
 {
 public:
-    /// @cond
-    enum class Type
-    {
-        COMPOSITE,
-        DECORATOR,
-    };
-    /// @endcond
-
-    /*!
-     \brief Adds the given composite to the tree. Composites have one or more children.
-
-     \note The composite builder must call end() to signify end of child list.
-    */
-    BuilderBase composite(Composite<C> composite);
+    using Clock = std::chrono::steady_clock; //!< The clock that times nodes.
 
     /*!
-     \brief Adds the given decorator to the tree. Decorators have exactly one child.
-    
-     \note The decorator builder must call end() to signify the end of the child list.
-    */
-    BuilderBase decorator(Decorator<C> decorator);
-    
-    // Note: "no known conversion" warnings here could indicate that you forgot to return something from your lambda.
-    /*!
-     \brief Adds the given leaf to the tree. Leaves have no children.
-    */
-    BuilderBase &leaf(Leaf<C> leaf);
-    
-    /*!
-     \brief Convenience wrapper so that bool functions can be used. Translates true
-        result to Status::SUCCESS, false to Status::FAILURE and never returns Status:RUNNING.
-    */
-    BuilderBase &leaf(BoolLeaf<C> leaf);
-
-    /*!
-     \brief Convenience wrapper for a void function, or really a function returning any type other than bool or Status. This always returns Status::SUCCESS.
+     \brief What the profiler recorded for one node.
     */
-    BuilderBase &void_leaf(VoidLeaf<C> leaf);
+    struct NodeStats
+    {
+        uint64_t calls{}; //!< The number of times the node was processed.
+        std::array<uint64_t, 3> statuses{}; //!< The number of times each Status, as an index, was returned.
+        Clock::duration time{}; //!< The total time spent in the node, including its children.
+    };
 
-    /*!
-     \brief Copies another tree as a subtree at the current node.
-    */
-    BuilderBase &tree(Tree<C> const &subtree);
-    
-    /*!
-     \brief Closes the composite or decorator branch.
-     
-        Each call to composite() or decorator() must have a corresponding end().
-    */
-    BuilderBase &end();
+    /// @cond
+    Clock::time_point enter(size_t) const
+    {
+        return Clock::now();
+    }
 
-    /*!
-     \brief Finalizes the tree by returning a copy. This will assert if done while
-        a decorator or composite branch is still 'open'.
-    */
-    virtual Tree<C> build() const &;
-    
-    /*!
-     \brief Finalizes the tree by returning a tree constructed with the builder's
-        root node. The builder is then invalid.
-    */
-    virtual Tree<C> build() &&;
+    void leave(size_t index, Status status, Clock::time_point entered)
+    {
+        auto const time = Clock::now() - entered;
+        if (index >= _stats.size()) {
+            _stats.resize(index + 1);
+        }
+        auto &stats = _stats[index];
+        ++stats.calls;
+        ++stats.statuses[static_cast<size_t>(status)];
+        stats.time += time;
+    }
+    /// @endcond
 
     /*!
-     \brief Shorthand for `composite(&sequence<C>)`.
-    */
-    BuilderBase sequence();
-    
-    /*!
-     \brief Shorthand for `composite(&selector<C>)`.
+     \brief Returns the stats of the node with the given #beehive::Node::index.
     */
-    BuilderBase selector();
+    NodeStats stats(size_t index) const
+    {
+        return index < _stats.size() ? _stats[index] : NodeStats{};
+    }
 
     /*!
-     \brief Shorthand for `decorator(&inverter<C>)`.
+     \brief Forgets everything recorded so far.
     */
-    BuilderBase inverter();
+    void reset()
+    {
+        _stats.clear();
+    }
 
     /*!
-     \brief Shorthand for `decorator(&succeeder<C>)`.
+     \brief Writes a table of the stats with one row per node of the given tree,
+        indented as the tree was built.
     */
-    BuilderBase succeeder();
+    template<typename Tree>
+    void dump(std::ostream &out, Tree const &tree) const;
 
-protected:
-    /// @cond
-    BuilderBase(BuilderBase &parent, size_t offset, Type type)
-        : _parent(parent)
-        , _offset(offset)
-        , _type(type)
-    {}
+private:
+    std::vector<NodeStats> _stats;
+};
 
-    Node<C> &node() {
-        return nodes()[_offset];
+template<typename Tree>
+void Profiler::dump(std::ostream &out, Tree const &tree) const
+{
+    auto const flags = out.flags();
+    auto const precision = out.precision();
+    out << std::setw(6) << "index"
+        << std::setw(12) << "calls"
+        << std::setw(12) << "success"
+        << std::setw(12) << "failure"
+        << std::setw(12) << "running"
+        << std::setw(12) << "time (us)"
+        << "  node\n";
+    out << std::fixed << std::setprecision(1);
+    std::vector<size_t> open; // children left to print of each enclosing branch
+    for (auto const &node : tree.nodes()) {
+        auto const stats = this->stats(node.index());
+        auto const time = std::chrono::duration<double, std::micro>(stats.time).count();
+        out << std::setw(6) << node.index()
+            << std::setw(12) << stats.calls
+            << std::setw(12) << stats.statuses[static_cast<size_t>(Status::SUCCESS)]
+            << std::setw(12) << stats.statuses[static_cast<size_t>(Status::FAILURE)]
+            << std::setw(12) << stats.statuses[static_cast<size_t>(Status::RUNNING)]
+            << std::setw(12) << time
+            << "  " << std::string(2 * open.size(), ' ') << detail::opcode_name(node._body->opcode) << '\n';
+        if (!open.empty()) {
+            --open.back();
+        }
+        if (node.child_count() > 0) {
+            open.push_back(node.child_count());
+        }
+        while (!open.empty() && open.back() == 0) {
+            open.pop_back();
+        }
     }
-    
-    virtual std::vector<Node<C>, A> &nodes() {
-        return _parent.nodes();
+    out.flags(flags);
+    out.precision(precision);
+}
+
+/*!
+ \brief Instrumentation that records every node returning, with its status, into
+    the #beehive::TraceBuffer of the entity being ticked. See #beehive::Tree::instrumented
+    and #beehive::TreeState::trace.
+
+    Entities without a buffer, like those of a #beehive::TreeStatePool, which are
+    ticked through scratch states, record nothing. Safe to use with
+    process_batch() on a #beehive::ThreadPool, since each buffer is written only
+    by the thread ticking its entity.
+*/
+class Tracer
+{
+public:
+    /// @cond
+    TraceBuffer *enter(size_t, TreeState const &state) const
+    {
+        return state._trace;
     }
 
-private:
-    size_t add_child(typename Node<C>::ProcessFunction &&fn) {
-        node().add_child();
-        nodes().emplace_back(std::move(fn));
-        return nodes().size() - 1;
+    void leave(size_t index, Status status, TraceBuffer *buffer, TreeState const &state) const
+    {
+        if (buffer != nullptr) {
+            buffer->push({state._tick, static_cast<uint32_t>(index), status});
+        }
     }
+    /// @endcond
+};
 
-    template<typename LeafType>
-    BuilderBase &_leaf(LeafType &&leaf);
+/// @cond
+namespace detail
+{
 
-    template<typename BranchType>
-    BuilderBase _branch(BranchType &&branch);
+// The start of a chunk of trace events, followed by the number of events. Each
+// event is then the ticks since the previous event, modulo 2^32, and its node
+// index times four plus its status, as variable-length integers.
+constexpr char trace_magic[4] = {'B', 'H', 'V', 'E'};
 
-    BuilderBase &_parent;
-    size_t _offset{};
-    Type _type{};
+} // namespace detail
+/// @endcond
 
-    /// @endcond
-};
+/*!
+ \brief Appends the events, as drained from a #beehive::TraceBuffer, to `out`
+    in a compact binary format that decode_trace() reads.
+
+    Events in tick order take two or three bytes each. Chunks can be written
+    one after another to the same file.
+*/
+inline void encode_trace(Span<TraceEvent const> events, std::vector<unsigned char> &out)
+{
+    using detail::write_varint;
+    out.insert(out.end(), std::begin(detail::trace_magic), std::end(detail::trace_magic));
+    write_varint(out, events.size());
+    uint32_t tick = 0;
+    for (auto const &event : events) {
+        write_varint(out, static_cast<uint32_t>(event.tick - tick));
+        write_varint(out, static_cast<uint64_t>(event.node) << 2 | static_cast<uint64_t>(event.status));
+        tick = event.tick;
+    }
+}
 
 /*!
- \brief Defines the tree structure and instantiates it.
- 
-    This Builder pattern is inspired by arvidsson's implementation, BrainTree.
- \sa #beehive::BuilderBase
+ \brief Appends the events of one chunk made by encode_trace() to `events` and
+    returns the number of bytes read.
+
+    Throws std::runtime_error if the chunk is malformed.
 */
-template<typename C, typename Allocator = std::allocator<Node<C>>>
-class Builder
-    : public BuilderBase<C, Allocator>
+inline size_t decode_trace(void const *data, size_t size, std::vector<TraceEvent> &events)
 {
-public:
-    /*!
-     \brief The context type.
-    */
-    using Context = C;
+    auto const *bytes = static_cast<unsigned char const *>(data);
+    if (size < sizeof(detail::trace_magic) || std::memcmp(bytes, detail::trace_magic, sizeof(detail::trace_magic)) != 0) {
+        throw std::runtime_error("not a trace");
+    }
+    detail::VarintReader reader{bytes + sizeof(detail::trace_magic), bytes + size, "trace"};
+    auto const count = reader.read(size); // every event takes at least two bytes
+    uint32_t tick = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        tick += static_cast<uint32_t>(reader.read(UINT32_MAX));
+        auto const value = reader.read((uint64_t{UINT32_MAX} << 2) | static_cast<uint64_t>(Status::SUCCESS));
+        if ((value & 3) > static_cast<uint64_t>(Status::SUCCESS)) {
+            throw std::runtime_error("trace has an invalid status");
+        }
+        events.push_back({tick, static_cast<uint32_t>(value >> 2), static_cast<Status>(value & 3)});
+    }
+    return static_cast<size_t>(reader.position - bytes);
+}
 
-    /*!
-     \brief Begins construction of a tree.
-    */
-    Builder()
-        : BuilderBase<C, Allocator>(*this, 0, BuilderBase<C, Allocator>::Type::DECORATOR)
+/*!
+ \brief Writes the path of each tick in the events through the given tree: the
+    nodes that returned during the tick, in tree order and indented as the tree
+    was built, with what they last returned.
+
+    The tree must have the nodes the events were recorded with, like the tree
+    that was instrumented, or one loaded from the same saved tree.
+*/
+template<typename Tree>
+void dump_trace(std::ostream &out, Tree const &tree, Span<TraceEvent const> events)
+{
+    static char const *const status_names[] = {"failure", "running", "success"};
+    auto const &nodes = tree.nodes();
+    std::vector<size_t> depths;
+    std::vector<size_t> open; // children left to visit of each enclosing branch
+    for (auto const &node : nodes) {
+        depths.push_back(open.size());
+        if (!open.empty()) {
+            --open.back();
+        }
+        if (node.child_count() > 0) {
+            open.push_back(node.child_count());
+        }
+        while (!open.empty() && open.back() == 0) {
+            open.pop_back();
+        }
+    }
+
+    std::vector<size_t> returns(nodes.size());
+    std::vector<Status> statuses(nodes.size());
+    for (size_t begin = 0; begin < events.size();) {
+        auto const tick = events[begin].tick;
+        auto end = begin;
+        for (; end < events.size() && events[end].tick == tick; ++end) {
+            auto const &event = events[end];
+            if (event.node < nodes.size()) {
+                ++returns[event.node];
+                statuses[event.node] = event.status;
+            }
+        }
+        out << "tick " << tick << '\n';
+        for (size_t index = 0; index < nodes.size(); ++index) {
+            if (returns[index] == 0) {
+                continue;
+            }
+            out << std::setw(6) << index
+                << "  " << std::left << std::setw(7) << status_names[static_cast<size_t>(statuses[index])] << std::right
+                << "  " << std::string(2 * depths[index], ' ') << detail::opcode_name(nodes[index]._body->opcode);
+            if (returns[index] > 1) {
+                out << " (x" << returns[index] << ')';
+            }
+            out << '\n';
+            returns[index] = 0;
+        }
+        begin = end;
+    }
+}
+
+/*!
+ \brief Trees whose structure is fixed at compile time.
+
+    Each node is its own type holding its children by value, so processing the
+    tree is a set of direct, inlinable calls with no #beehive::Node, Generator or
+    type-erased functions involved. Nesting mistakes, like a decorator with two
+    children or a composite with none, fail to compile.
+
+    \code
+    using namespace beehive::static_tree;
+    auto tree = make_tree<ZombieState>(
+        sequence(
+            leaf([](ZombieState &zombie) { return zombie.is_hungry; }),
+            leaf(&ZombieState::has_food),
+            inverter(leaf(EnemiesAroundChecker{})),
+            void_leaf(&ZombieState::eat_food)
+        )
+    );
+    \endcode
+*/
+namespace static_tree
+{
+
+/// @cond
+template<typename T>
+struct IsNodeType : std::false_type {};
+
+template<typename T>
+using IsNode = IsNodeType<typename std::decay<T>::type>;
+
+template<size_t... Counts>
+constexpr size_t slot_offset(size_t index)
+{
+    size_t const counts[] = {0, Counts...};
+    size_t offset = 0;
+    for (size_t i = 0; i < index; ++i) {
+        offset += counts[i + 1];
+    }
+    return offset;
+}
+
+// Each composite owns one slot in the tree state, holding 1 + the index of the
+// child that returned RUNNING, or 0. Nodes are processed with `resuming` set when
+// their parent is resuming into them; otherwise their slots are stale and ignored.
+template<Status Continue, typename... Children>
+struct CompositeNode
+{
+    static_assert(sizeof...(Children) > 0, "a composite needs at least one child");
+    static_assert(sizeof...(Children) < UINT16_MAX, "too many children");
+
+    static constexpr size_t slot_count = 1 + slot_offset<Children::slot_count...>(sizeof...(Children));
+
+    template<size_t Slot, typename C, typename Slots>
+    Status process(C &context, Slots &slots, bool resuming) const
     {
-        auto root = make_branch(Decorator<C>(&forwarder<C>));
-        _nodes.emplace_back(std::move(root));
+        bool const resumed = resuming && slots[Slot] != 0;
+        size_t const resume = resumed ? slots[Slot] - 1 : 0;
+        return process_from<Slot, 0>(context, slots, resumed, resume, std::true_type{});
     }
-    
-    Builder(Builder const &) = delete; //!< Deleted copy constructor.
-    Builder(Builder &&) = default; //!< Move constructor.
-    Builder &operator=(Builder const &) = delete; //!< Deleted copy assignment operator.
-    Builder &operator=(Builder &&) = default; //!< Move assignment operator.
 
-    virtual Tree<C> build() const & override
+    template<size_t Slot, size_t I, typename C, typename Slots>
+    Status process_from(C &context, Slots &slots, bool resuming, size_t resume, std::true_type) const
     {
-        assert(_nodes[0].child_count() > 0); // must have at least one leaf node added
-        return {_nodes};
+        if (I >= resume) {
+            constexpr auto child_slot = Slot + 1 + slot_offset<Children::slot_count...>(I);
+            auto const status = std::get<I>(children).template process<child_slot>(context, slots, resuming && I == resume);
+            if (status == Status::RUNNING) {
+                slots[Slot] = static_cast<typename Slots::value_type>(I + 1);
+                return status;
+            }
+            if (status != Continue) {
+                slots[Slot] = 0;
+                return status;
+            }
+        }
+        return process_from<Slot, I + 1>(
+            context, slots, resuming, resume,
+            std::integral_constant<bool, (I + 1 < sizeof...(Children))>{}
+        );
     }
 
-    virtual Tree<C> build() && override
+    template<size_t Slot, size_t I, typename C, typename Slots>
+    Status process_from(C &, Slots &slots, bool, size_t, std::false_type) const
     {
-        assert(_nodes[0].child_count() > 0); // must have at least one leaf node added
-        return {std::move(_nodes)};
+        slots[Slot] = 0;
+        return Continue;
     }
 
-private:
-    virtual std::vector<Node<C>, Allocator> &nodes() override {
-        return _nodes;
+    std::tuple<Children...> children;
+};
+
+template<typename C, typename Child, size_t Slot, typename Slots>
+struct ChildProcess
+{
+    Status operator()() const
+    {
+        return child.template process<Slot>(context, slots, resuming);
     }
-    
-    std::vector<Node<C>, Allocator> _nodes;
+
+    Child const &child;
+    C &context;
+    Slots &slots;
+    bool resuming;
 };
 
-/// @cond
-template<typename C>
-auto make_branch(Decorator<C> f) -> typename Node<C>::ProcessFunction
+template<typename F, typename Child>
+struct DecoratorNode
 {
-    return [process = move(f)](C &context, Node<C> const &self, TreeState &state)
+    static constexpr size_t slot_count = Child::slot_count;
+
+    template<size_t Slot, typename C, typename Slots>
+    Status process(C &context, Slots &slots, bool resuming) const
     {
-        assert(self.child_count() == 1); // invariant violation!
-        auto &child = *(&self + 1);
-        return process(context, child, state);
-    };
-}
+        ChildProcess<C, Child, Slot, Slots> const process_child{child, context, slots, resuming};
+        return detail::invoke(function, context, process_child);
+    }
 
-template<typename C>
-auto make_branch(Composite<C> f) -> typename Node<C>::ProcessFunction
+    mutable F function;
+    Child child;
+};
+
+struct Invert
 {
-    return [process = move(f)](C &context, Node<C> const &self, TreeState &state)
+    template<typename C, typename Child>
+    Status operator()(C &, Child const &process_child) const
     {
-        auto i = 0;
-        auto *child = self.first_child();
-        if (self.index() == state.resume_index) {
-            for (; i < state.offset; ++i) {
-                child = child->next_sibling();
-            }
-        }
-        auto generator = [&self, &i, &child]() -> Node<C> const * {
-            if (i++ == self.child_count()) {
-                return nullptr;
-            }
-            auto c = child;
-            child = child->next_sibling();
-            return c;
-        };
-        auto status = process(context, generator, state);
+        auto const status = process_child();
         if (status == Status::RUNNING) {
-            state.resume_index = self.index();
-            state.offset = i - 1;
-        } else {
-            state.resume_index = 0;
-            state.offset = 0;
+            return status;
         }
-        return status;
-    };
-}
+        return status == Status::FAILURE ? Status::SUCCESS : Status::FAILURE;
+    }
+};
 
-template<typename C>
-auto make_leaf(Leaf<C> f) -> typename Node<C>::ProcessFunction
+struct Succeed
 {
-    return [process = move(f)](C &context, Node<C> const &self, TreeState &state)
+    template<typename C, typename Child>
+    Status operator()(C &, Child const &process_child) const
     {
-        assert(self.child_count() == 0); // invariant violation!
-        return process(context);
-    };
-}
+        process_child();
+        return Status::SUCCESS;
+    }
+};
 
-template<typename C>
-auto make_leaf(VoidLeaf<C> f) -> typename Node<C>::ProcessFunction
+template<typename F>
+struct LeafNode
 {
-    return make_leaf(Leaf<C>{[void_process = move(f)](C &context)
+    static constexpr size_t slot_count = 0;
+
+    template<size_t Slot, typename C, typename Slots>
+    Status process(C &context, Slots &, bool) const
     {
-        void_process(context);
-        return Status::SUCCESS;
-    }});
-}
+        return to_status(detail::invoke(function, context));
+    }
 
-template<typename C>
-auto make_leaf(BoolLeaf<C> f) -> typename Node<C>::ProcessFunction
+    mutable F function;
+};
+
+template<typename F>
+struct VoidLeafNode
 {
-    return make_leaf(Leaf<C>{[bool_process = move(f)](C &context)
+    static constexpr size_t slot_count = 0;
+
+    template<size_t Slot, typename C, typename Slots>
+    Status process(C &context, Slots &, bool) const
     {
-        const bool result = bool_process(context);
-        return result ? Status::SUCCESS : Status::FAILURE;
-    }});
-}
+        detail::invoke(function, context);
+        return Status::SUCCESS;
+    }
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::composite(Composite<C> composite) -> BuilderBase
-{
-    return _branch(std::move(composite));
-}
+    mutable F function;
+};
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::decorator(Decorator<C> decorator) -> BuilderBase
-{
-    return _branch(std::move(decorator));
-}
+template<Status Continue, typename... Children>
+struct IsNodeType<CompositeNode<Continue, Children...>> : std::true_type {};
 
-template<typename C, typename A>
-template<typename BranchType>
-auto BuilderBase<C, A>::_branch(BranchType &&branch) -> BuilderBase
+template<typename F, typename Child>
+struct IsNodeType<DecoratorNode<F, Child>> : std::true_type {};
+
+template<typename F>
+struct IsNodeType<LeafNode<F>> : std::true_type {};
+
+template<typename F>
+struct IsNodeType<VoidLeafNode<F>> : std::true_type {};
+
+template<typename... Children>
+struct AllNodes : std::true_type {};
+
+template<typename Child, typename... Children>
+struct AllNodes<Child, Children...>
+    : std::integral_constant<bool, IsNode<Child>::value && AllNodes<Children...>::value>
+{};
+/// @endcond
+
+/*!
+ \brief A tree built by #beehive::static_tree::make_tree.
+*/
+template<typename C, typename Root>
+class Tree
 {
-    assert((_type != Type::DECORATOR) || node().child_count() == 0); // Decorators may only have one child!
-    auto type = std::is_same<
-        typename std::decay<BranchType>::type,
-        Decorator<C>
-    >::value ? Type::DECORATOR : Type::COMPOSITE;
-    auto child_offset = add_child(make_branch(move(branch)));
-    return {*this, child_offset, type};
-}
+public:
+    using Context = C; //!< The context type.
 
-template<typename C, typename A>
-template<typename LeafType>
-auto BuilderBase<C, A>::_leaf(LeafType &&leaf) -> BuilderBase &
+    /*!
+     \brief Resume state for one entity: one slot per composite in the tree.
+    */
+    using State = std::array<uint16_t, Root::slot_count>;
+
+    /*!
+     \brief Wraps the given root node.
+    */
+    explicit Tree(Root root)
+        : _root(std::move(root))
+    {}
+
+    /*!
+     \brief Creates a state object that can be passed to subsequent process() calls.
+    */
+    State make_state() const
+    {
+        return {};
+    }
+
+    /*!
+     \brief Process with the given context reference.
+    */
+    Status process(Context &context) const
+    {
+        State state{};
+        return process(state, context);
+    }
+
+    /*!
+     \brief Process with the given state and context reference. Composites that
+        returned RUNNING last time resume where they left off, at every level.
+    */
+    Status process(State &state, Context &context) const
+    {
+        return _root.template process<0>(context, state, true);
+    }
+
+private:
+    Root _root;
+};
+
+/*!
+ \brief Creates a tree with the given root node for contexts of type C.
+*/
+template<typename C, typename Root>
+Tree<C, typename std::decay<Root>::type> make_tree(Root &&root)
 {
-    assert((_type != Type::DECORATOR) || node().child_count() == 0); // Decorators may only have one child!
-    add_child(make_leaf(move(leaf)));
-    return *this;
+    static_assert(IsNode<Root>::value, "the root must be a node, such as leaf(f) or sequence(...)");
+    return Tree<C, typename std::decay<Root>::type>{std::forward<Root>(root)};
 }
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::leaf(Leaf<C> leaf) -> BuilderBase &
+/*!
+ \brief Composite that returns success if all children return success. See #beehive::sequence.
+*/
+template<typename... Children>
+CompositeNode<Status::SUCCESS, typename std::decay<Children>::type...> sequence(Children &&... children)
 {
-    return _leaf(std::move(leaf));
+    static_assert(AllNodes<Children...>::value, "children must be nodes, such as leaf(f) or sequence(...)");
+    return {std::tuple<typename std::decay<Children>::type...>{std::forward<Children>(children)...}};
 }
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::leaf(BoolLeaf<C> leaf) -> BuilderBase &
+/*!
+ \brief Composite that returns success on the first successful child. See #beehive::selector.
+*/
+template<typename... Children>
+CompositeNode<Status::FAILURE, typename std::decay<Children>::type...> selector(Children &&... children)
 {
-    return _leaf(std::move(leaf));
+    static_assert(AllNodes<Children...>::value, "children must be nodes, such as leaf(f) or sequence(...)");
+    return {std::tuple<typename std::decay<Children>::type...>{std::forward<Children>(children)...}};
 }
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::void_leaf(VoidLeaf<C> leaf) -> BuilderBase &
+/*!
+ \brief Adds a custom decorator. `decorator` is called as `decorator(context, child)`,
+    where `child()` processes the child node and returns its status.
+*/
+template<typename F, typename Child>
+DecoratorNode<typename std::decay<F>::type, typename std::decay<Child>::type> decorator(F &&decorator, Child &&child)
 {
-    return _leaf(std::move(leaf));
+    static_assert(IsNode<Child>::value, "the child must be a node, such as leaf(f) or sequence(...)");
+    return {std::forward<F>(decorator), std::forward<Child>(child)};
 }
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::tree(Tree<C> const &subtree) -> BuilderBase &
+/*!
+ \brief Decorator that inverts the result of its child node. See #beehive::inverter.
+*/
+template<typename Child>
+DecoratorNode<Invert, typename std::decay<Child>::type> inverter(Child &&child)
 {
-    assert((_type != Type::DECORATOR) || node().child_count() == 0); // Decorators may only have one child!
-    auto const &subtree_nodes = subtree.nodes();
-    copy(subtree_nodes.begin(), subtree_nodes.end(), back_inserter(nodes()));
-    node().add_child();
-    return *this;
+    return decorator(Invert{}, std::forward<Child>(child));
 }
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::end() -> BuilderBase &
+/*!
+ \brief Decorator that returns success regardless of the child result. See #beehive::succeeder.
+*/
+template<typename Child>
+DecoratorNode<Succeed, typename std::decay<Child>::type> succeeder(Child &&child)
 {
-    assert(node().child_count() > 0); // can't have composite/decorator without children!
-    return _parent;
+    return decorator(Succeed{}, std::forward<Child>(child));
 }
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::build() const & -> Tree<C>
+/*!
+ \brief Adds a leaf returning Status or bool, as #beehive::BuilderBase::leaf.
+*/
+template<typename F>
+LeafNode<typename std::decay<F>::type> leaf(F &&leaf)
 {
-    assert(false); // unterminated tree!
-    return {{}};
+    return {std::forward<F>(leaf)};
 }
 
-template<typename C, typename A>
-auto BuilderBase<C, A>::build() && -> Tree<C>
+/*!
+ \brief Adds a leaf whose result is ignored, as #beehive::BuilderBase::void_leaf.
+*/
+template<typename F>
+VoidLeafNode<typename std::decay<F>::type> void_leaf(F &&leaf)
 {
-    assert(false); // unterminated tree!
-    return {{}};
+    return {std::forward<F>(leaf)};
 }
 
-#define BH_IMPLEMENT_SHORTHAND(Type, Name) \
-    template<typename Context, typename A> \
-    auto BuilderBase<Context, A>::Name() -> BuilderBase \
-    { \
-        return _branch(Type<Context>{&beehive::Name<Context>}); \
-    }
-
-BH_IMPLEMENT_SHORTHAND(Composite, sequence);
-BH_IMPLEMENT_SHORTHAND(Composite, selector);
-BH_IMPLEMENT_SHORTHAND(Decorator, inverter);
-BH_IMPLEMENT_SHORTHAND(Decorator, succeeder);
-
-#undef BH_IMPLEMENT_SHORTHAND
-/// @endcond
+} // namespace static_tree
 
 } // namespace beehive
 
@@ -0,0 +1,1106 @@
+#include <beehive/beehive.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <numeric>
+#include <string>
+#include <unordered_map>
+
+namespace
+{
+
+using namespace beehive;
+
+using Counter = int;
+
+Status count_leaf(Counter &counter)
+{
+    ++counter;
+    return Status::SUCCESS;
+}
+
+// Root -> sequence -> `width` two-leaf sequences.
+Tree<Counter> make_wide_tree(int width)
+{
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 0; i < width; ++i) {
+        root.sequence()
+            .leaf(&count_leaf)
+            .leaf(&count_leaf)
+        .end();
+    }
+    root.end();
+    return std::move(builder).build();
+}
+
+template<typename B>
+void add_deep_branch(B &parent, int depth)
+{
+    auto branch = parent.sequence();
+    branch.leaf(&count_leaf);
+    if (depth > 1) {
+        add_deep_branch(branch, depth - 1);
+    }
+    branch.end();
+}
+
+// Root -> chain of `depth` nested sequences, each with a leaf before the next level.
+Tree<Counter> make_deep_tree(int depth)
+{
+    Builder<Counter> builder;
+    add_deep_branch(builder, depth);
+    return std::move(builder).build();
+}
+
+template<typename T>
+void run_tree(benchmark::State &state, T const &tree, size_t node_count)
+{
+    Counter counter{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(counter));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(node_count));
+    state.SetComplexityN(static_cast<int64_t>(node_count));
+}
+
+// Time per node should stay flat as the tree gets wider or deeper.
+void BM_WideTree(benchmark::State &state)
+{
+    auto tree = make_wide_tree(static_cast<int>(state.range(0)));
+    run_tree(state, tree, tree.nodes().size());
+}
+BENCHMARK(BM_WideTree)->RangeMultiplier(4)->Range(4, 4096)->Complexity(benchmark::oN);
+
+void BM_DeepTree(benchmark::State &state)
+{
+    auto tree = make_deep_tree(static_cast<int>(state.range(0)));
+    run_tree(state, tree, tree.nodes().size());
+}
+BENCHMARK(BM_DeepTree)->RangeMultiplier(4)->Range(4, 1024)->Complexity(benchmark::oN);
+
+// The same trees on the flat interpreter.
+void BM_WideCompiledTree(benchmark::State &state)
+{
+    auto tree = make_wide_tree(static_cast<int>(state.range(0))).compile();
+    run_tree(state, tree, tree.tree().nodes().size());
+}
+BENCHMARK(BM_WideCompiledTree)->RangeMultiplier(4)->Range(4, 4096)->Complexity(benchmark::oN);
+
+void BM_DeepCompiledTree(benchmark::State &state)
+{
+    auto tree = make_deep_tree(static_cast<int>(state.range(0))).compile();
+    run_tree(state, tree, tree.tree().nodes().size());
+}
+BENCHMARK(BM_DeepCompiledTree)->RangeMultiplier(4)->Range(4, 1024)->Complexity(benchmark::oN);
+
+} // namespace
+
+namespace
+{
+
+// A sequence of `length` leaves whose last leaf keeps running, so each tick
+// either resumes at the last leaf or, without a state, starts over.
+Tree<Counter> make_running_tree(int length)
+{
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 1; i < length; ++i) {
+        root.leaf(&count_leaf);
+    }
+    root.leaf([](Counter &) { return Status::RUNNING; });
+    root.end();
+    return std::move(builder).build();
+}
+
+void BM_ResumeRunning(benchmark::State &state)
+{
+    auto tree = make_running_tree(static_cast<int>(state.range(0)));
+    auto tree_state = tree.make_state();
+    Counter counter{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, counter));
+    }
+}
+BENCHMARK(BM_ResumeRunning)->RangeMultiplier(4)->Range(4, 1024);
+
+void BM_RestartRunning(benchmark::State &state)
+{
+    auto tree = make_running_tree(static_cast<int>(state.range(0)));
+    Counter counter{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(counter));
+    }
+}
+BENCHMARK(BM_RestartRunning)->RangeMultiplier(4)->Range(4, 1024);
+
+// The cost of each way of writing a leaf, on a sequence of 64 of them.
+template<typename L>
+void run_leaves(benchmark::State &state, L const &leaf)
+{
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 0; i < 64; ++i) {
+        root.leaf(leaf);
+    }
+    root.end();
+    auto tree = std::move(builder).build();
+    Counter counter{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(counter));
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+void BM_StatusLeaf(benchmark::State &state)
+{
+    run_leaves(state, [](Counter &counter) {
+        ++counter;
+        return Status::SUCCESS;
+    });
+}
+BENCHMARK(BM_StatusLeaf);
+
+void BM_BoolLeaf(benchmark::State &state)
+{
+    run_leaves(state, [](Counter &counter) { return ++counter != 0; });
+}
+BENCHMARK(BM_BoolLeaf);
+
+void BM_VoidLeaf(benchmark::State &state)
+{
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 0; i < 64; ++i) {
+        root.void_leaf([](Counter &counter) { ++counter; });
+    }
+    root.end();
+    auto tree = std::move(builder).build();
+    Counter counter{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(counter));
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+BENCHMARK(BM_VoidLeaf);
+
+void BM_FunctionPointerLeaf(benchmark::State &state)
+{
+    run_leaves(state, &count_leaf);
+}
+BENCHMARK(BM_FunctionPointerLeaf);
+
+void BM_StdFunctionLeaf(benchmark::State &state)
+{
+    run_leaves(state, Leaf<Counter>{&count_leaf});
+}
+BENCHMARK(BM_StdFunctionLeaf);
+
+void BM_StdFunctionBoolLeaf(benchmark::State &state)
+{
+    run_leaves(state, BoolLeaf<Counter>{[](Counter &counter) { return ++counter != 0; }});
+}
+BENCHMARK(BM_StdFunctionBoolLeaf);
+
+// Building a tree out of `count` copies of a 16-leaf subtree, against building
+// the same structure directly, and running the result.
+Tree<Counter> make_leaf_subtree()
+{
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 0; i < 16; ++i) {
+        root.leaf(&count_leaf);
+    }
+    root.end();
+    return std::move(builder).build();
+}
+
+void BM_BuildFromSubtrees(benchmark::State &state)
+{
+    auto const subtree = make_leaf_subtree();
+    for (auto _ : state) {
+        Builder<Counter> builder;
+        auto root = builder.sequence();
+        for (int i = 0; i < state.range(0); ++i) {
+            root.tree(subtree);
+        }
+        root.end();
+        benchmark::DoNotOptimize(std::move(builder).build());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildFromSubtrees)->RangeMultiplier(8)->Range(8, 512);
+
+void BM_BuildDirectly(benchmark::State &state)
+{
+    for (auto _ : state) {
+        Builder<Counter> builder;
+        auto root = builder.sequence();
+        for (int i = 0; i < state.range(0); ++i) {
+            auto branch = root.sequence();
+            for (int j = 0; j < 16; ++j) {
+                branch.leaf(&count_leaf);
+            }
+            branch.end();
+        }
+        root.end();
+        benchmark::DoNotOptimize(std::move(builder).build());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildDirectly)->RangeMultiplier(8)->Range(8, 512);
+
+// The same, with the node count known up front and the nodes in an arena.
+template<typename B>
+void build_directly(B &builder, int64_t count)
+{
+    auto root = builder.sequence();
+    for (int i = 0; i < count; ++i) {
+        auto branch = root.sequence();
+        for (int j = 0; j < 16; ++j) {
+            branch.leaf(&count_leaf);
+        }
+        branch.end();
+    }
+    root.end();
+}
+
+void BM_BuildReserved(benchmark::State &state)
+{
+    auto const node_count = static_cast<size_t>(2 + 17 * state.range(0));
+    for (auto _ : state) {
+        Builder<Counter> builder{node_count};
+        build_directly(builder, state.range(0));
+        benchmark::DoNotOptimize(std::move(builder).build());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildReserved)->RangeMultiplier(8)->Range(8, 512);
+
+void BM_BuildInArena(benchmark::State &state)
+{
+    using Allocator = ArenaAllocator<Node<Counter>>;
+    auto const node_count = static_cast<size_t>(2 + 17 * state.range(0));
+    for (auto _ : state) {
+        Arena arena(node_count * (sizeof(Node<Counter>) + sizeof(Node<Counter>::Body)));
+        Builder<Counter, Allocator> builder{node_count, Allocator{arena}};
+        build_directly(builder, state.range(0));
+        benchmark::DoNotOptimize(std::move(builder).build());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildInArena)->RangeMultiplier(8)->Range(8, 512);
+
+// The same structure loaded from bytes saved with a function table.
+void BM_Deserialize(benchmark::State &state)
+{
+    FunctionTable<Counter> table;
+    table.add_leaf("count", &count_leaf);
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 0; i < state.range(0); ++i) {
+        auto branch = root.sequence();
+        for (int j = 0; j < 16; ++j) {
+            branch.leaf(table, "count");
+        }
+        branch.end();
+    }
+    root.end();
+    auto const bytes = table.serialize(std::move(builder).build());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.deserialize(bytes));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["bytes"] = static_cast<double>(bytes.size());
+}
+BENCHMARK(BM_Deserialize)->RangeMultiplier(8)->Range(8, 512);
+
+void BM_BuildFromSubtreeRefs(benchmark::State &state)
+{
+    auto const subtree = std::make_shared<Tree<Counter> const>(make_leaf_subtree());
+    for (auto _ : state) {
+        Builder<Counter> builder;
+        auto root = builder.sequence();
+        for (int i = 0; i < state.range(0); ++i) {
+            root.subtree_ref(subtree);
+        }
+        root.end();
+        benchmark::DoNotOptimize(std::move(builder).build());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildFromSubtreeRefs)->RangeMultiplier(8)->Range(8, 512);
+
+void BM_ProcessSubtreeRefs(benchmark::State &state)
+{
+    auto const subtree = std::make_shared<Tree<Counter> const>(make_leaf_subtree());
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 0; i < state.range(0); ++i) {
+        root.subtree_ref(subtree);
+    }
+    root.end();
+    auto tree = std::move(builder).build();
+    run_tree(state, tree, state.range(0) * subtree->nodes().size());
+}
+BENCHMARK(BM_ProcessSubtreeRefs)->RangeMultiplier(8)->Range(8, 512);
+
+void BM_ProcessSubtrees(benchmark::State &state)
+{
+    auto const subtree = make_leaf_subtree();
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 0; i < state.range(0); ++i) {
+        root.tree(subtree);
+    }
+    root.end();
+    auto tree = std::move(builder).build();
+    run_tree(state, tree, tree.nodes().size());
+}
+BENCHMARK(BM_ProcessSubtrees)->RangeMultiplier(8)->Range(8, 512);
+
+// The same tree without the forwarder each copy brings, and with the copied
+// sequences merged into the root. Items are the nodes before optimizing.
+void BM_ProcessSubtreesOptimized(benchmark::State &state)
+{
+    auto const subtree = make_leaf_subtree();
+    Builder<Counter> builder;
+    auto root = builder.sequence();
+    for (int i = 0; i < state.range(0); ++i) {
+        root.tree(subtree);
+    }
+    root.end();
+    auto const unoptimized = std::move(builder).build();
+    run_tree(state, unoptimized.optimized(), unoptimized.nodes().size());
+}
+BENCHMARK(BM_ProcessSubtreesOptimized)->RangeMultiplier(8)->Range(8, 512);
+
+} // namespace
+
+namespace
+{
+
+struct Entity
+{
+    int ticks_left{};
+};
+
+// Entities alternate between finishing at once and running for a few ticks,
+// so the batch is a mix of states waiting at the root and mid-sequence.
+Tree<Entity> make_entity_tree()
+{
+    return Builder<Entity>{}
+        .sequence()
+            .leaf([](Entity &entity) { return entity.ticks_left >= 0; })
+            .leaf([](Entity &entity) {
+                return entity.ticks_left-- > 0 ? Status::RUNNING : Status::SUCCESS;
+            })
+            .leaf([](Entity &entity) {
+                entity.ticks_left = 3;
+                return true;
+            })
+        .end()
+        .build();
+}
+
+struct Entities
+{
+    Entities(Tree<Entity> const &tree, size_t count)
+        : contexts(count)
+        , statuses(count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            contexts[i].ticks_left = static_cast<int>(i % 5);
+            states.push_back(tree.make_state());
+        }
+    }
+
+    std::vector<TreeState> states;
+    std::vector<Entity> contexts;
+    std::vector<Status> statuses;
+};
+
+void BM_ProcessEach(benchmark::State &state)
+{
+    auto tree = make_entity_tree();
+    Entities entities(tree, static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        for (size_t i = 0; i < entities.states.size(); ++i) {
+            entities.statuses[i] = tree.process(entities.states[i], entities.contexts[i]);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ProcessEach)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+void BM_ProcessBatch(benchmark::State &state)
+{
+    auto tree = make_entity_tree();
+    Entities entities(tree, static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        tree.process_batch(entities.states, entities.contexts, entities.statuses);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ProcessBatch)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+// Snapshotting a batch of states mid-run, as when migrating entities, and
+// restoring them into the states of another tree with the same structure.
+void BM_EncodeStates(benchmark::State &state)
+{
+    auto tree = make_entity_tree();
+    Entities entities(tree, static_cast<size_t>(state.range(0)));
+    tree.process_batch(entities.states, entities.contexts, entities.statuses);
+    std::vector<unsigned char> bytes;
+    for (auto _ : state) {
+        bytes.clear();
+        tree.encode_states(entities.states, bytes);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["bytes_per_entity"] = static_cast<double>(bytes.size()) / state.range(0);
+}
+BENCHMARK(BM_EncodeStates)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+void BM_DecodeStates(benchmark::State &state)
+{
+    auto tree = make_entity_tree();
+    Entities entities(tree, static_cast<size_t>(state.range(0)));
+    tree.process_batch(entities.states, entities.contexts, entities.statuses);
+    std::vector<unsigned char> bytes;
+    tree.encode_states(entities.states, bytes);
+    auto other = make_entity_tree();
+    Entities restored(other, static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(other.decode_states(bytes.data(), bytes.size(), restored.states));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DecodeStates)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+// Moving a batch of running states over to a reloaded copy of the tree.
+void BM_MigrateStates(benchmark::State &state)
+{
+    auto tree = make_entity_tree();
+    auto reloaded = make_entity_tree();
+    auto const migration = reloaded.migration_from(tree);
+    Entities entities(tree, static_cast<size_t>(state.range(0)));
+    tree.process_batch(entities.states, entities.contexts, entities.statuses);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto states = entities.states;
+        state.ResumeTiming();
+        for (auto &tree_state : states) {
+            migration.migrate(tree_state);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MigrateStates)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+// Pinning a shared tree for each tick, from several threads at once.
+void BM_TreeHandleRead(benchmark::State &state)
+{
+    static TreeHandle<Entity> handle{make_entity_tree()};
+    Entity entity;
+    auto tree_state = handle.read()->make_state();
+    for (auto _ : state) {
+        auto const tree = handle.read();
+        benchmark::DoNotOptimize(tree->process(tree_state, entity));
+    }
+}
+BENCHMARK(BM_TreeHandleRead)->ThreadRange(1, 8);
+
+// 5k entities sharing a frame budget of range(0) microseconds, ticked in turns.
+void BM_ProcessRoundRobin(benchmark::State &state)
+{
+    auto tree = make_entity_tree();
+    Entities entities(tree, 5000);
+    auto const limit = std::chrono::microseconds{state.range(0)};
+    size_t next = 0;
+    size_t processed = 0;
+    for (auto _ : state) {
+        Budget budget{limit};
+        next = tree.process_round_robin(entities.states, entities.contexts, entities.statuses, budget, next);
+        processed += budget.nodes_processed();
+        benchmark::ClobberMemory();
+    }
+    state.counters["nodes_per_frame"] = benchmark::Counter(
+        static_cast<double>(processed) / static_cast<double>(state.iterations())
+    );
+}
+BENCHMARK(BM_ProcessRoundRobin)->RangeMultiplier(4)->Range(16, 1024)->UseRealTime();
+
+// Same batch with the states kept in a compact pool instead of one TreeState each.
+void BM_ProcessBatchPool(benchmark::State &state)
+{
+    auto tree = make_entity_tree();
+    Entities entities(tree, static_cast<size_t>(state.range(0)));
+    auto pool = tree.make_state_pool(entities.contexts.size());
+    for (auto _ : state) {
+        tree.process_batch(pool, entities.contexts, entities.statuses);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["bytes_per_entity"] = static_cast<double>(pool.bytes_per_entity());
+}
+BENCHMARK(BM_ProcessBatchPool)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+} // namespace
+
+namespace
+{
+
+// Thread count comes from the benchmark argument; items per second should grow
+// close to linearly up to the number of cores.
+void BM_ProcessBatchParallel(benchmark::State &state)
+{
+    auto tree = make_entity_tree();
+    Entities entities(tree, 1 << 16);
+    ThreadPool pool(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        tree.process_batch(entities.states, entities.contexts, entities.statuses, pool);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(entities.states.size()));
+}
+BENCHMARK(BM_ProcessBatchParallel)
+    ->RangeMultiplier(2)
+    ->Range(1, 32)
+    ->UseRealTime();
+
+// Stands in for an expensive, independent query such as a path search.
+Status sense(Counter &)
+{
+    uint64_t hash = 14695981039346656037u;
+    for (int i = 0; i < 20000; ++i) {
+        benchmark::DoNotOptimize(hash = (hash ^ static_cast<uint64_t>(i)) * 1099511628211u);
+    }
+    return Status::SUCCESS;
+}
+
+// A parallel of eight sensing leaves, one after another (0) or on a pool of n threads.
+void BM_ParallelSensing(benchmark::State &state)
+{
+    auto const thread_count = static_cast<size_t>(state.range(0));
+    std::unique_ptr<ThreadPool> pool;
+    if (thread_count > 0) {
+        pool.reset(new ThreadPool(thread_count));
+    }
+    Builder<Counter> builder;
+    auto parallel = builder.parallel(SIZE_MAX, 1, pool.get());
+    for (int i = 0; i < 8; ++i) {
+        parallel.leaf(&sense);
+    }
+    parallel.end();
+    auto const tree = std::move(builder).build();
+    auto tree_state = tree.make_state();
+    Counter counter{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, counter));
+    }
+}
+BENCHMARK(BM_ParallelSensing)
+    ->Arg(0)
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->UseRealTime();
+
+} // namespace
+
+namespace
+{
+
+struct Zombie
+{
+    bool is_hungry{true};
+    bool has_food{true};
+    bool enemies_around{false};
+    int meals{};
+};
+
+bool zombie_is_hungry(Zombie &zombie) { return zombie.is_hungry; }
+bool zombie_has_food(Zombie &zombie) { return zombie.has_food; }
+bool zombie_enemies_around(Zombie &zombie) { return zombie.enemies_around; }
+void zombie_eat(Zombie &zombie) { ++zombie.meals; }
+
+// The same tree built both ways.
+void BM_ZombieTree(benchmark::State &state)
+{
+    auto tree = Builder<Zombie>{}
+        .sequence()
+            .leaf([](Zombie &zombie) { return zombie_is_hungry(zombie); })
+            .leaf([](Zombie &zombie) { return zombie_has_food(zombie); })
+            .inverter()
+                .leaf([](Zombie &zombie) { return zombie_enemies_around(zombie); })
+            .end()
+            .void_leaf([](Zombie &zombie) { zombie_eat(zombie); })
+        .end()
+        .build();
+    Zombie zombie;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(zombie));
+    }
+}
+BENCHMARK(BM_ZombieTree);
+
+void BM_ZombieProfiledTree(benchmark::State &state)
+{
+    auto tree = Builder<Zombie>{}
+        .sequence()
+            .leaf([](Zombie &zombie) { return zombie_is_hungry(zombie); })
+            .leaf([](Zombie &zombie) { return zombie_has_food(zombie); })
+            .inverter()
+                .leaf([](Zombie &zombie) { return zombie_enemies_around(zombie); })
+            .end()
+            .void_leaf([](Zombie &zombie) { zombie_eat(zombie); })
+        .end()
+        .build()
+        .instrumented(Profiler{});
+    Zombie zombie;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(zombie));
+    }
+}
+BENCHMARK(BM_ZombieProfiledTree);
+
+// Traced ticks, drained every 64 ticks as a background thread would.
+void BM_ZombieTracedTree(benchmark::State &state)
+{
+    auto tree = Builder<Zombie>{}
+        .sequence()
+            .leaf([](Zombie &zombie) { return zombie_is_hungry(zombie); })
+            .leaf([](Zombie &zombie) { return zombie_has_food(zombie); })
+            .inverter()
+                .leaf([](Zombie &zombie) { return zombie_enemies_around(zombie); })
+            .end()
+            .void_leaf([](Zombie &zombie) { zombie_eat(zombie); })
+        .end()
+        .build()
+        .instrumented(Tracer{});
+    TraceBuffer buffer{1024};
+    std::vector<TraceEvent> events(buffer.capacity());
+    auto tree_state = tree.make_state();
+    tree_state.trace(&buffer);
+    Zombie zombie;
+    size_t ticks = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, zombie));
+        if (++ticks % 64 == 0) {
+            benchmark::DoNotOptimize(buffer.drain(events));
+        }
+    }
+}
+BENCHMARK(BM_ZombieTracedTree);
+
+// A costly condition that only changes now and then, cached or evaluated every tick.
+bool zombie_senses_food(Zombie &zombie)
+{
+    auto smell = 0;
+    for (auto i = 0; i < 64; ++i) {
+        benchmark::DoNotOptimize(smell += i);
+    }
+    return zombie.has_food && smell > 0;
+}
+
+void BM_ZombiePlainCondition(benchmark::State &state)
+{
+    auto tree = Builder<Zombie>{}
+        .sequence()
+            .leaf([](Zombie &zombie) { return zombie_senses_food(zombie); })
+            .void_leaf([](Zombie &zombie) { zombie_eat(zombie); })
+        .end()
+        .build();
+    auto tree_state = tree.make_state();
+    Zombie zombie;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, zombie));
+    }
+}
+BENCHMARK(BM_ZombiePlainCondition);
+
+void BM_ZombieReactiveCondition(benchmark::State &state)
+{
+    uint64_t const FOOD = 1;
+    auto tree = Builder<Zombie>{}
+        .sequence()
+            .reactive(FOOD)
+                .leaf([](Zombie &zombie) { return zombie_senses_food(zombie); })
+            .end()
+            .void_leaf([](Zombie &zombie) { zombie_eat(zombie); })
+        .end()
+        .build();
+    auto tree_state = tree.make_state();
+    Zombie zombie;
+    size_t tick = 0;
+    for (auto _ : state) {
+        if (++tick % 16 == 0) {
+            tree_state.invalidate(FOOD);
+        }
+        benchmark::DoNotOptimize(tree.process(tree_state, zombie));
+    }
+}
+BENCHMARK(BM_ZombieReactiveCondition);
+
+// The same conditions read from a string-keyed map and from a blackboard.
+void BM_ZombieStringMap(benchmark::State &state)
+{
+    using Memory = std::unordered_map<std::string, float>;
+    auto tree = Builder<Memory>{}
+        .sequence()
+            .leaf([](Memory &memory) { return memory["hunger"] > 0.5f; })
+            .leaf([](Memory &memory) { return memory["food"] > 0; })
+            .inverter()
+                .leaf([](Memory &memory) { return memory["enemies"] > 0; })
+            .end()
+            .void_leaf([](Memory &memory) { memory["meals"] += 1; })
+        .end()
+        .build();
+    Memory memory{{"hunger", 1.f}, {"food", 1.f}, {"enemies", 0.f}, {"meals", 0.f}};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(memory));
+    }
+}
+BENCHMARK(BM_ZombieStringMap);
+
+void BM_ZombieBlackboard(benchmark::State &state)
+{
+    BlackboardSchema schema;
+    schema.add<float>("hunger", 1.f);
+    schema.add<float>("food", 1.f);
+    schema.add<float>("enemies");
+    schema.add<float>("meals");
+    auto tree = Builder<Blackboard>{}
+        .sequence()
+            .leaf(with_key(schema.key<float>("hunger"), [](float hunger) { return hunger > 0.5f; }))
+            .leaf(with_key(schema.key<float>("food"), [](float food) { return food > 0; }))
+            .inverter()
+                .leaf(with_key(schema.key<float>("enemies"), [](float enemies) { return enemies > 0; }))
+            .end()
+            .void_leaf(with_key(schema.key<float>("meals"), [](float &meals) { meals += 1; }))
+        .end()
+        .build();
+    auto blackboard = schema.make_blackboard();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(blackboard));
+    }
+}
+BENCHMARK(BM_ZombieBlackboard);
+
+// A cooldown kept in a per-agent map by hand, against the cooldown() decorator
+// keeping it in the state's slots. Either way, the subtree behind it mostly
+// doesn't run.
+struct CooldownAgent
+{
+    std::unordered_map<size_t, std::chrono::steady_clock::time_point> ready_at;
+    int searches{};
+};
+
+void BM_CooldownInContext(benchmark::State &state)
+{
+    auto tree = Builder<CooldownAgent>{}
+        .sequence()
+            .leaf([](CooldownAgent &agent) {
+                auto const now = std::chrono::steady_clock::now();
+                auto &ready_at = agent.ready_at[1];
+                if (now < ready_at) {
+                    return false;
+                }
+                ready_at = now + std::chrono::milliseconds{1};
+                return true;
+            })
+            .leaf([](CooldownAgent &agent) { return ++agent.searches > 0; })
+        .end()
+        .build();
+    auto tree_state = tree.make_state();
+    CooldownAgent agent;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, agent));
+    }
+}
+BENCHMARK(BM_CooldownInContext);
+
+void BM_CooldownDecorator(benchmark::State &state)
+{
+    auto tree = Builder<CooldownAgent>{}
+        .cooldown(std::chrono::milliseconds{1})
+            .leaf([](CooldownAgent &agent) { return ++agent.searches > 0; })
+        .end()
+        .build();
+    auto tree_state = tree.make_state();
+    CooldownAgent agent;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, agent));
+    }
+}
+BENCHMARK(BM_CooldownDecorator);
+
+// A costly condition checked at the start of four branches, as when the same
+// check is composed into several subtrees with tree().
+struct PathAgent
+{
+    std::array<float, 64> costs{};
+    int acted{};
+};
+
+bool path_clear(PathAgent &agent)
+{
+    float total = 0.0f;
+    for (auto const cost : agent.costs) {
+        total += cost * cost;
+    }
+    return total < 1.0f;
+}
+
+template<typename L>
+Tree<PathAgent> make_path_tree(L &&add_check)
+{
+    Builder<PathAgent> check_builder;
+    add_check(check_builder);
+    auto const check = std::move(check_builder).build();
+    Builder<PathAgent> builder;
+    auto root = builder.selector();
+    for (int i = 0; i < 4; ++i) {
+        root.sequence()
+            .tree(check)
+            .leaf([i](PathAgent &agent) { return ++agent.acted > 0 && i == 3; })
+        .end();
+    }
+    root.end();
+    return std::move(builder).build();
+}
+
+void BM_RepeatedCondition(benchmark::State &state)
+{
+    auto tree = make_path_tree([](Builder<PathAgent> &builder) { builder.leaf(&path_clear); });
+    auto tree_state = tree.make_state();
+    PathAgent agent;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, agent));
+    }
+}
+BENCHMARK(BM_RepeatedCondition);
+
+void BM_MemoizedCondition(benchmark::State &state)
+{
+    auto tree = make_path_tree([](Builder<PathAgent> &builder) { builder.memoized_leaf(&path_clear); });
+    auto tree_state = tree.make_state();
+    PathAgent agent;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, agent));
+    }
+}
+BENCHMARK(BM_MemoizedCondition);
+
+struct NeedsAgent
+{
+    std::array<float, 4> needs;
+    int acted{};
+};
+
+// Picks the most pressing need with a condition in front of each action.
+void BM_NestedSelectorChoice(benchmark::State &state)
+{
+    auto builder = Builder<NeedsAgent>{};
+    auto selector = builder.selector();
+    for (size_t i = 0; i < 4; ++i) {
+        selector.sequence()
+            .leaf([i](NeedsAgent &agent) {
+                return std::max_element(agent.needs.begin(), agent.needs.end()) == agent.needs.begin() + i;
+            })
+            .leaf([](NeedsAgent &agent) { return ++agent.acted > 0; })
+        .end();
+    }
+    selector.end();
+    auto tree = std::move(builder).build();
+    auto tree_state = tree.make_state();
+    NeedsAgent agent{{0.25f, 0.5f, 0.125f, 1.0f}};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, agent));
+    }
+}
+BENCHMARK(BM_NestedSelectorChoice);
+
+struct NeedsScorer
+{
+    void operator()(NeedsAgent const &agent, Span<float> scores) const
+    {
+        std::copy(agent.needs.begin(), agent.needs.end(), scores.begin());
+    }
+
+    void operator()(Span<NeedsAgent const> agents, Span<float> scores) const
+    {
+        for (size_t i = 0; i < 4; ++i) {
+            for (size_t j = 0; j < agents.size(); ++j) {
+                scores[i * agents.size() + j] = agents[j].needs[i];
+            }
+        }
+    }
+};
+
+Tree<NeedsAgent> make_utility_tree()
+{
+    auto builder = Builder<NeedsAgent>{};
+    auto selector = builder.utility_selector(batch_scored(NeedsScorer{}));
+    for (size_t i = 0; i < 4; ++i) {
+        selector.leaf([](NeedsAgent &agent) { return ++agent.acted > 0; });
+    }
+    selector.end();
+    return std::move(builder).build();
+}
+
+void BM_UtilitySelector(benchmark::State &state)
+{
+    auto tree = make_utility_tree();
+    auto tree_state = tree.make_state();
+    NeedsAgent agent{{0.25f, 0.5f, 0.125f, 1.0f}};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(tree_state, agent));
+    }
+}
+BENCHMARK(BM_UtilitySelector);
+
+void BM_UtilitySelectorBatch(benchmark::State &state)
+{
+    auto tree = make_utility_tree();
+    auto const count = static_cast<size_t>(state.range(0));
+    std::vector<NeedsAgent> agents(count, NeedsAgent{{0.25f, 0.5f, 0.125f, 1.0f}});
+    std::vector<TreeState> states(count, tree.make_state());
+    std::vector<Status> statuses(count);
+    for (auto _ : state) {
+        tree.process_batch(states, agents, statuses);
+        benchmark::DoNotOptimize(statuses.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_UtilitySelectorBatch)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+// A squad in one of 16 cells, each with a costly check that only depends on the cell.
+struct SquadAgent
+{
+    std::array<float, 256> const *cell;
+    int acted{};
+};
+
+Tree<SquadAgent> make_squad_tree()
+{
+    return Builder<SquadAgent>{}
+        .sequence()
+            .shared()
+                .leaf([](SquadAgent &agent) {
+                    return std::accumulate(agent.cell->begin(), agent.cell->end(), 0.0f) > 0.0f;
+                })
+            .end()
+            .leaf([](SquadAgent &agent) { return ++agent.acted > 0; })
+        .end()
+        .build();
+}
+
+void run_squad_batch(benchmark::State &state, bool shared)
+{
+    auto tree = make_squad_tree();
+    std::vector<std::array<float, 256>> cells(16);
+    for (size_t i = 0; i < cells.size(); ++i) {
+        cells[i].fill(static_cast<float>(i) - 4.0f);
+    }
+    auto const count = static_cast<size_t>(state.range(0));
+    std::vector<SquadAgent> agents;
+    for (size_t i = 0; i < count; ++i) {
+        agents.push_back({&cells[i % cells.size()]});
+    }
+    std::vector<TreeState> states(count, tree.make_state());
+    std::vector<Status> statuses(count);
+    auto const cell = [](SquadAgent const &agent) { return agent.cell; };
+    for (auto _ : state) {
+        if (shared) {
+            tree.process_batch_shared(states, agents, statuses, cell);
+        } else {
+            tree.process_batch(states, agents, statuses);
+        }
+        benchmark::DoNotOptimize(statuses.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_SquadBatch(benchmark::State &state)
+{
+    run_squad_batch(state, false);
+}
+BENCHMARK(BM_SquadBatch)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+void BM_SquadBatchShared(benchmark::State &state)
+{
+    run_squad_batch(state, true);
+}
+BENCHMARK(BM_SquadBatchShared)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+// Entities waiting on a slow query, polled every tick or parked until it finishes.
+struct QueryAgent
+{
+    int polls{};
+};
+
+void BM_PollingWait(benchmark::State &state)
+{
+    auto tree = Builder<QueryAgent>{}
+        .sequence()
+            .leaf([](QueryAgent &agent) { return ++agent.polls > 0 ? Status::RUNNING : Status::SUCCESS; })
+        .end()
+        .build();
+    auto const count = static_cast<size_t>(state.range(0));
+    std::vector<QueryAgent> agents(count);
+    std::vector<TreeState> states(count, tree.make_state());
+    std::vector<Status> statuses(count);
+    for (auto _ : state) {
+        tree.process_batch(states, agents, statuses);
+        benchmark::DoNotOptimize(statuses.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PollingWait)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+void BM_ParkedWait(benchmark::State &state)
+{
+    AsyncQueue queue;
+    std::vector<AsyncCallback> pending;
+    auto tree = Builder<QueryAgent>{}
+        .sequence()
+            .async_leaf(queue, [&pending](QueryAgent &, AsyncCallback done) { pending.push_back(std::move(done)); })
+        .end()
+        .build();
+    auto const count = static_cast<size_t>(state.range(0));
+    std::vector<QueryAgent> agents(count);
+    std::vector<TreeState> states(count, tree.make_state());
+    std::vector<Status> statuses(count);
+    tree.process_batch(states, agents, statuses, queue);
+    for (auto _ : state) {
+        tree.process_batch(states, agents, statuses, queue);
+        benchmark::DoNotOptimize(statuses.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ParkedWait)->RangeMultiplier(8)->Range(512, 1 << 15);
+
+void BM_ZombieStaticTree(benchmark::State &state)
+{
+    using namespace beehive::static_tree;
+    auto tree = make_tree<Zombie>(
+        sequence(
+            leaf([](Zombie &zombie) { return zombie_is_hungry(zombie); }),
+            leaf([](Zombie &zombie) { return zombie_has_food(zombie); }),
+            inverter(leaf([](Zombie &zombie) { return zombie_enemies_around(zombie); })),
+            void_leaf([](Zombie &zombie) { zombie_eat(zombie); })
+        )
+    );
+    Zombie zombie;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.process(zombie));
+    }
+}
+BENCHMARK(BM_ZombieStaticTree);
+
+} // namespace
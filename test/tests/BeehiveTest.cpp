@@ -1,7 +1,15 @@
 #include <beehive/beehive.hpp>
 
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 struct ZombieState
 {
@@ -28,19 +36,18 @@ TEST(BeehiveTest, NodeChildTest)
 {
     using namespace beehive;
     
-    auto dummyProcessor = [](int &, Node<int> const &, TreeState &) { return Status::SUCCESS; };
-    std::vector<Node<int>> v {
-        {dummyProcessor}, // root       // 0
-            {dummyProcessor},           // 1
-                {dummyProcessor},       // 2
-                {dummyProcessor},       // 3
-            {dummyProcessor},           // 4
-            {dummyProcessor},           // 5
-                {dummyProcessor},       // 6
-                    {dummyProcessor},   // 7
-                {dummyProcessor},       // 8
-            {dummyProcessor},           // 9
-    };
+    // Nodes stored depth first, indented by their depth:
+    // 0
+    //     1
+    //         2
+    //         3
+    //     4
+    //     5
+    //         6
+    //             7
+    //         8
+    //     9
+    std::vector<Node<int>> v(10);
     for (auto i = 0; i < 4; ++i) v[0].add_child();
     for (auto i = 0; i < 2; ++i) v[1].add_child();
     for (auto i = 0; i < 2; ++i) v[5].add_child();
@@ -107,6 +114,55 @@ TEST(BeehiveTest, TreeNodesTest)
     EXPECT_EQ(nodes[1].descendent_count(), 7);
 }
 
+TEST(BeehiveTest, DescendentCountTest)
+{
+    using namespace beehive;
+
+    auto dummy = [](int &) {
+        return true;
+    };
+
+    auto subtree = Builder<int>{} // 0
+        .selector() // 1
+            .leaf(dummy) // 2
+            .inverter() // 3
+                .leaf(dummy) // 4
+            .end()
+        .end()
+        .build();
+
+    auto tree = Builder<int>{} // 0
+        .sequence() // 1
+            .tree(subtree) // 2..6
+            .sequence() // 7
+                .sequence() // 8
+                    .leaf(dummy) // 9
+                .end()
+            .end()
+            .leaf(dummy) // 10
+        .end()
+        .build();
+
+    // Stored counts must match what a walk of the children would produce.
+    auto &nodes = tree.nodes();
+    ASSERT_EQ(11, nodes.size());
+    for (auto &node : nodes) {
+        size_t count = node.child_count();
+        auto *child = node.first_child();
+        for (size_t i = 0; i < node.child_count(); ++i) {
+            count += child->descendent_count();
+            child = child->next_sibling();
+        }
+        EXPECT_EQ(count, node.descendent_count());
+    }
+    EXPECT_EQ(10, nodes[0].descendent_count());
+    EXPECT_EQ(4, nodes[2].descendent_count());
+    EXPECT_EQ(2, nodes[7].descendent_count());
+    EXPECT_EQ(nodes[2].next_sibling(), &nodes[7]);
+    EXPECT_EQ(nodes[7].next_sibling(), &nodes[10]);
+    EXPECT_EQ(nodes[10].next_sibling(), nodes.data() + nodes.size());
+}
+
 TEST(BeehiveTest, ExampleTest)
 {
     using namespace beehive;
@@ -168,6 +224,281 @@ TEST(BeehiveTest, ResumeRunningTest)
     EXPECT_EQ(visited[2], 1);
 }
 
+TEST(BeehiveTest, NestedResumeTest)
+{
+    using namespace beehive;
+
+    using VisitCountArray = std::array<int, 5>;
+    auto visit = [](size_t i, Status status) {
+        return [i, status](VisitCountArray &visited) {
+            ++visited[i];
+            return status;
+        };
+    };
+    auto visit_running_once = [](size_t i) {
+        return [i](VisitCountArray &visited) {
+            return ++visited[i] > 1 ? Status::SUCCESS : Status::RUNNING;
+        };
+    };
+
+    // RUNNING two composites deep resumes at the running leaf, then carries on
+    // through the outer sequence.
+    auto tree = Builder<VisitCountArray>{}
+        .sequence() // 1
+            .leaf(visit(0, Status::SUCCESS))
+            .selector() // 3
+                .leaf(visit(1, Status::FAILURE))
+                .sequence() // 5
+                    .leaf(visit(2, Status::SUCCESS))
+                    .leaf(visit_running_once(3))
+                .end()
+            .end()
+            .leaf(visit(4, Status::SUCCESS))
+        .end()
+        .build();
+
+    auto state = tree.make_state();
+    VisitCountArray visited{};
+    EXPECT_EQ(Status::RUNNING, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 1, 1, 1, 0}), visited);
+    EXPECT_EQ(5, state.resume_index);
+    EXPECT_EQ(1, state.offset);
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 1, 1, 2, 1}), visited);
+    EXPECT_EQ(0, state.resume_index);
+
+    // Finished trees start over from the top.
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{2, 2, 2, 3, 2}), visited);
+
+    // Decorators above a resumed composite still see its result.
+    tree = Builder<VisitCountArray>{}
+        .inverter()
+            .sequence()
+                .leaf(visit(0, Status::SUCCESS))
+                .leaf(visit_running_once(1))
+            .end()
+        .end()
+        .build();
+    state = tree.make_state();
+    visited = {};
+    EXPECT_EQ(Status::RUNNING, tree.process(state, visited));
+    EXPECT_EQ(Status::FAILURE, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 2, 0, 0, 0}), visited);
+
+    // A RUNNING child swallowed by a succeeder is not resumed later.
+    tree = Builder<VisitCountArray>{}
+        .sequence()
+            .succeeder()
+                .sequence()
+                    .leaf(visit(0, Status::SUCCESS))
+                    .leaf(visit_running_once(1))
+                .end()
+            .end()
+            .leaf(visit_running_once(2))
+        .end()
+        .build();
+    state = tree.make_state();
+    visited = {};
+    EXPECT_EQ(Status::RUNNING, tree.process(state, visited));
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 1, 2, 0, 0}), visited);
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{2, 2, 3, 0, 0}), visited);
+}
+
+TEST(BeehiveTest, CompiledTreeTest)
+{
+    using namespace beehive;
+
+    struct Agent
+    {
+        int seed{};
+        std::vector<int> visits;
+    };
+
+    // Each leaf returns a status that depends on the agent and how often the
+    // leaf has run, so that every node sees every status eventually.
+    auto leaf = [](int id) {
+        return [id](Agent &agent) {
+            agent.visits.push_back(id);
+            return static_cast<Status>((agent.seed * 7 + id * 3 + agent.visits.size()) % 3);
+        };
+    };
+    auto custom_sequence = [](Agent &agent, Generator<Agent> next_child, TreeState &state) {
+        while (auto const *child = next_child()) {
+            auto status = child->process(agent, state);
+            if (status != Status::SUCCESS) {
+                return status;
+            }
+        }
+        return Status::SUCCESS;
+    };
+
+    auto tree = Builder<Agent>{}
+        .selector()
+            .sequence()
+                .leaf(leaf(0))
+                .inverter()
+                    .selector()
+                        .leaf(leaf(1))
+                        .leaf(leaf(2))
+                    .end()
+                .end()
+                .composite(custom_sequence)
+                    .leaf(leaf(3))
+                    .sequence()
+                        .leaf(leaf(4))
+                        .leaf(leaf(5))
+                    .end()
+                .end()
+            .end()
+            .succeeder()
+                .sequence()
+                    .leaf(leaf(6))
+                    .leaf(leaf(7))
+                .end()
+            .end()
+        .end()
+        .build();
+    auto const compiled = tree.compile();
+
+    for (int seed = 0; seed < 20; ++seed) {
+        Agent agent, expected_agent;
+        agent.seed = expected_agent.seed = seed;
+        auto state = compiled.make_state();
+        auto expected_state = tree.make_state();
+        for (int tick = 0; tick < 8; ++tick) {
+            ASSERT_EQ(tree.process(expected_state, expected_agent), compiled.process(state, agent));
+            ASSERT_EQ(expected_agent.visits, agent.visits);
+            ASSERT_EQ(expected_state.resume_index, state.resume_index);
+            ASSERT_EQ(expected_state.offset, state.offset);
+        }
+        ASSERT_EQ(tree.process(expected_agent), compiled.process(agent));
+        ASSERT_EQ(expected_agent.visits, agent.visits);
+    }
+
+    // States are interchangeable between the two.
+    Agent agent;
+    auto state = tree.make_state();
+    while (tree.process(state, agent) != Status::RUNNING || state.resume_index == 0) {}
+    auto expected_state = state;
+    auto expected_agent = agent;
+    EXPECT_EQ(tree.process(expected_state, expected_agent), compiled.process(state, agent));
+    EXPECT_EQ(expected_agent.visits, agent.visits);
+
+    // Chains of built-in branches don't use the native stack.
+    Builder<Agent> deep_builder;
+    std::vector<BuilderBase<Agent, std::allocator<Node<Agent>>>> branches;
+    branches.reserve(1001); // each branch refers to its parent
+    branches.push_back(deep_builder.sequence());
+    for (int i = 0; i < 1000; ++i) {
+        branches.push_back(branches.back().sequence());
+    }
+    branches.back().leaf([](Agent &) { return Status::RUNNING; });
+    while (!branches.empty()) {
+        branches.back().end();
+        branches.pop_back();
+    }
+    auto const deep = std::move(deep_builder).build().compile();
+    state = deep.make_state();
+    EXPECT_EQ(Status::RUNNING, deep.process(state, agent));
+    EXPECT_EQ(1001, state.resume_index);
+    EXPECT_EQ(Status::RUNNING, deep.process(state, agent));
+
+    // So do reactive nodes, which still cache.
+    Builder<Agent> reactive_builder;
+    branches.clear();
+    branches.push_back(reactive_builder.sequence());
+    for (int i = 0; i < 1000; ++i) {
+        branches.push_back(i % 2 == 0 ? branches.back().reactive(1) : branches.back().sequence());
+    }
+    branches.back().leaf([](Agent &agent) {
+        ++agent.visits[0];
+        return true;
+    });
+    while (!branches.empty()) {
+        branches.back().end();
+        branches.pop_back();
+    }
+    auto const reactive = std::move(reactive_builder).build().compile();
+    state = reactive.make_state();
+    agent.visits[0] = 0;
+    EXPECT_EQ(Status::SUCCESS, reactive.process(state, agent));
+    EXPECT_EQ(Status::SUCCESS, reactive.process(state, agent));
+    EXPECT_EQ(1, agent.visits[0]);
+    state.invalidate(1);
+    EXPECT_EQ(Status::SUCCESS, reactive.process(state, agent));
+    EXPECT_EQ(2, agent.visits[0]);
+}
+
+TEST(BeehiveTest, InstrumentationTest)
+{
+    using namespace beehive;
+
+    auto tree = Builder<int>{}
+        .selector()
+            .inverter()
+                .leaf([](int &ticks) { return ticks-- > 0 ? Status::RUNNING : Status::SUCCESS; })
+            .end()
+            .void_leaf([](int &) {})
+        .end()
+        .build();
+
+    // Instrumentation sees every node enter and leave, innermost first.
+    struct Recorder
+    {
+        size_t enter(size_t)
+        {
+            return calls->size();
+        }
+
+        void leave(size_t index, Status status, size_t entered)
+        {
+            calls->push_back({index, status, entered});
+        }
+
+        std::shared_ptr<std::vector<std::tuple<size_t, Status, size_t>>> calls;
+    };
+    auto const recorded = tree.instrumented(Recorder{std::make_shared<std::vector<std::tuple<size_t, Status, size_t>>>()});
+    auto ticks = 0;
+    EXPECT_EQ(Status::SUCCESS, recorded.process(ticks));
+    auto const &calls = *recorded.instrumentation().calls;
+    ASSERT_EQ(5, calls.size());
+    EXPECT_EQ(std::make_tuple(3, Status::SUCCESS, 0), calls[0]);
+    EXPECT_EQ(std::make_tuple(2, Status::FAILURE, 0), calls[1]);
+    EXPECT_EQ(std::make_tuple(4, Status::SUCCESS, 2), calls[2]);
+    EXPECT_EQ(std::make_tuple(1, Status::SUCCESS, 0), calls[3]);
+    EXPECT_EQ(std::make_tuple(0, Status::SUCCESS, 0), calls[4]);
+
+    // The profiler counts calls and statuses per node, and states are shared
+    // with the uninstrumented tree.
+    auto const profiled = tree.instrumented(Profiler{});
+    auto state = tree.make_state();
+    ticks = 2;
+    EXPECT_EQ(Status::RUNNING, profiled.process(state, ticks));
+    EXPECT_EQ(Status::RUNNING, profiled.process(state, ticks));
+    EXPECT_EQ(Status::SUCCESS, profiled.process(state, ticks));
+    auto const &profiler = profiled.instrumentation();
+    EXPECT_EQ(3, profiler.stats(0).calls);
+    EXPECT_EQ(3, profiler.stats(3).calls);
+    EXPECT_EQ(2, profiler.stats(3).statuses[static_cast<size_t>(Status::RUNNING)]);
+    EXPECT_EQ(1, profiler.stats(2).statuses[static_cast<size_t>(Status::FAILURE)]);
+    EXPECT_EQ(1, profiler.stats(4).calls);
+    EXPECT_LE(profiler.stats(3).time, profiler.stats(0).time);
+
+    // The dump has a header and a row per node, indented by depth.
+    std::ostringstream out;
+    profiler.dump(out, profiled);
+    auto const dump = out.str();
+    EXPECT_EQ(6, std::count(dump.begin(), dump.end(), '\n'));
+    EXPECT_NE(std::string::npos, dump.find("  forwarder\n"));
+    EXPECT_NE(std::string::npos, dump.find("    selector\n"));
+    EXPECT_NE(std::string::npos, dump.find("      inverter\n"));
+    EXPECT_NE(std::string::npos, dump.find("        leaf\n"));
+    EXPECT_NE(std::string::npos, dump.find("      leaf\n"));
+}
+
 TEST(BeehiveTest, SequenceTest)
 {
     using namespace beehive;
@@ -444,6 +775,108 @@ TEST(BeehiveTest, TreeNodeTest)
     EXPECT_EQ(visited[2], 1);
 }
 
+TEST(BeehiveTest, SubtreeRefTest)
+{
+    using namespace beehive;
+
+    using VisitCountArray = std::array<int, 4>;
+
+    // The shared subtree runs for one tick, two composites deep.
+    auto const combat = std::make_shared<Tree<VisitCountArray> const>(Builder<VisitCountArray>{}
+        .sequence()
+            .leaf([](VisitCountArray &visited) {
+                ++visited[1];
+                return true;
+            })
+            .selector()
+                .leaf([](VisitCountArray &) { return false; })
+                .leaf([](VisitCountArray &visited) {
+                    return ++visited[2] % 2 == 1 ? Status::RUNNING : Status::SUCCESS;
+                })
+            .end()
+        .end()
+        .build());
+
+    auto tree = Builder<VisitCountArray>{}
+        .sequence()
+            .leaf([](VisitCountArray &visited) {
+                ++visited[0];
+                return true;
+            })
+            .subtree_ref(combat)
+            .subtree_ref(combat)
+            .leaf([](VisitCountArray &visited) {
+                ++visited[3];
+                return true;
+            })
+        .end()
+        .build();
+
+    // Only the references are part of the tree.
+    EXPECT_EQ(6, tree.nodes().size());
+    EXPECT_EQ(3, combat.use_count());
+
+    // Each reference resumes inside the subtree, and only the reference that
+    // was running resumes.
+    auto state = tree.make_state();
+    VisitCountArray visited{};
+    EXPECT_EQ(Status::RUNNING, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 1, 1, 0}), visited);
+    EXPECT_EQ(Status::RUNNING, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 2, 3, 0}), visited);
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 2, 4, 1}), visited);
+    EXPECT_EQ(0, state.resume_index);
+
+    // References survive copies into other trees, and batches can resume
+    // past the end of the outer tree's nodes.
+    Builder<VisitCountArray> padding_builder;
+    auto padding_sequence = padding_builder.sequence();
+    for (int i = 0; i < 64; ++i) {
+        padding_sequence.leaf(&noop<VisitCountArray>);
+    }
+    padding_sequence.end();
+    auto const padding = std::move(padding_builder).build();
+    auto const big_combat = std::make_shared<Tree<VisitCountArray> const>(Builder<VisitCountArray>{}
+        .sequence()
+            .tree(padding)
+            .tree(padding)
+            .tree(*combat)
+        .end()
+        .build());
+    auto const outer = Builder<VisitCountArray>{}
+        .sequence()
+            .tree(padding)
+            .tree(tree)
+        .end()
+        .build();
+    auto const big = Builder<VisitCountArray>{}
+        .sequence()
+            .tree(padding)
+            .subtree_ref(big_combat)
+        .end()
+        .build();
+    EXPECT_EQ(Status::RUNNING, outer.process(visited));
+
+    std::vector<TreeState> states;
+    std::vector<VisitCountArray> agents(5);
+    for (size_t i = 0; i < agents.size(); ++i) {
+        states.push_back(big.make_state());
+        agents[i][2] = static_cast<int>(i % 2);
+    }
+    std::vector<Status> statuses(agents.size());
+    big.process_batch(states, agents, statuses);
+    for (size_t i = 0; i < agents.size(); ++i) {
+        EXPECT_EQ(i % 2 == 0 ? Status::RUNNING : Status::SUCCESS, statuses[i]);
+    }
+    EXPECT_LT(big.nodes().size(), states[0].resume_index); // an index into big_combat
+    big.process_batch(states, agents, statuses);
+    for (size_t i = 0; i < agents.size(); ++i) {
+        EXPECT_EQ(i % 2 == 0 ? Status::SUCCESS : Status::RUNNING, statuses[i]);
+        EXPECT_EQ(i % 2 == 0 ? 1 : 2, agents[i][1]);
+    }
+}
+
 TEST(BeehiveTest, TreeCopyTest)
 {
     using namespace beehive;
@@ -595,3 +1028,2032 @@ TEST(BeehiveTest, CustomAllocatorTest)
 
 }
 
+TEST(BeehiveTest, ArenaBuilderTest)
+{
+    using namespace beehive;
+    using Allocator = ArenaAllocator<Node<int>>;
+
+    auto const subtree = Builder<int>{}
+        .leaf([](int &count) { return ++count > 0; })
+        .build();
+    auto const shared = std::make_shared<Tree<int> const>(subtree);
+
+    // The allocator is used from the first node to the finished tree.
+    Arena arena;
+    Builder<int, Allocator> builder{8, Allocator{arena}};
+    builder
+        .sequence()
+            .leaf([](int &count) { return ++count > 0; })
+            .tree(subtree)
+            .subtree_ref(shared)
+            .inverter()
+                .leaf([](int &) { return false; })
+            .end()
+        .end();
+    auto const tree = std::move(builder).build();
+    static_assert(std::is_same<decltype(tree), Tree<int, Allocator> const>::value, "allocator dropped");
+    EXPECT_EQ(8, tree.nodes().size());
+    EXPECT_TRUE(tree.nodes().get_allocator() == Allocator{arena});
+
+    // The nodes, and their bodies with the callables, went into one block.
+    auto const node_bytes = sizeof(Node<int>) + sizeof(Node<int>::Body);
+    EXPECT_EQ(1, arena.block_count());
+    EXPECT_EQ(8 * node_bytes, arena.bytes_allocated());
+
+    int count = 0;
+    EXPECT_EQ(Status::SUCCESS, tree.process(count));
+    EXPECT_EQ(3, count);
+
+    // Copies stay in the arena, and arena trees can be attached elsewhere.
+    auto const copy = tree;
+    EXPECT_EQ(16 * node_bytes, arena.bytes_allocated());
+    auto const outer = Builder<int>{}
+        .sequence()
+            .tree(copy)
+            .subtree_ref(std::make_shared<Tree<int, Allocator> const>(tree))
+        .end()
+        .build();
+    EXPECT_EQ(Status::SUCCESS, outer.process(count));
+    EXPECT_EQ(9, count);
+
+    // Requests bigger than a block get their own.
+    Arena small(16);
+    Allocator{small}.allocate(4);
+    EXPECT_EQ(1, small.block_count());
+    Allocator{small}.allocate(1);
+    EXPECT_EQ(2, small.block_count());
+}
+
+
+TEST(BeehiveTest, InlineFunctionTest)
+{
+    using namespace beehive;
+
+    auto counter = std::make_shared<int>(0);
+    InlineFunction<int(int)> f = [counter](int x) {
+        return ++*counter + x;
+    };
+    EXPECT_TRUE(static_cast<bool>(f));
+    EXPECT_EQ(11, f(10));
+    EXPECT_EQ(2, counter.use_count());
+
+    // Copies share captured state the same way copies of the lambda would.
+    auto g = f;
+    EXPECT_EQ(3, counter.use_count());
+    EXPECT_EQ(12, g(10));
+
+    auto h = std::move(f);
+    EXPECT_FALSE(static_cast<bool>(f));
+    EXPECT_EQ(3, counter.use_count());
+    EXPECT_EQ(13, h(10));
+
+    g = nullptr;
+    h = {};
+    EXPECT_EQ(1, counter.use_count());
+
+    // Targets that don't fit inline are allowed on the heap when opted in.
+    std::array<int, 16> big{};
+    big[15] = 42;
+    InlineFunction<int(), sizeof(void *), true> heap = [big]() {
+        return big[15];
+    };
+    auto heap_copy = heap;
+    EXPECT_EQ(42, heap());
+    EXPECT_EQ(42, heap_copy());
+
+    // Leaf callables are stored directly in the node instead of behind
+    // another std::function.
+    auto tree = Builder<int>{}
+        .sequence()
+            .leaf([](int &x) { return ++x > 0; })
+            .void_leaf([](int &x) { ++x; })
+        .end()
+        .build();
+    int x = 0;
+    EXPECT_EQ(Status::SUCCESS, tree.process(x));
+    EXPECT_EQ(2, x);
+}
+
+TEST(BeehiveTest, ProcessBatchTest)
+{
+    using namespace beehive;
+
+    struct Agent
+    {
+        size_t id{};
+        bool busy{};
+        int first_visits{};
+        int second_visits{};
+    };
+
+    // Pad the tree out so that the batch is large enough to be regrouped.
+    Builder<Agent> padding_builder;
+    auto padding_sequence = padding_builder.sequence();
+    for (int i = 0; i < 64; ++i) {
+        padding_sequence.leaf(&noop<Agent>);
+    }
+    padding_sequence.end();
+    auto padding = std::move(padding_builder).build();
+
+    std::vector<size_t> visit_order;
+    auto tree = Builder<Agent>{}
+        .sequence()
+            .leaf([](Agent &agent) {
+                ++agent.first_visits;
+                return true;
+            })
+            .leaf([&visit_order](Agent &agent) {
+                visit_order.push_back(agent.id);
+                ++agent.second_visits;
+                return agent.busy ? Status::RUNNING : Status::SUCCESS;
+            })
+            .tree(padding)
+        .end()
+        .build();
+
+    constexpr size_t count = 7;
+    std::vector<Agent> agents(count);
+    std::vector<TreeState> states;
+    for (size_t i = 0; i < count; ++i) {
+        agents[i].id = i;
+        agents[i].busy = i % 2 == 0;
+        states.push_back(tree.make_state());
+    }
+    std::vector<Status> statuses(count);
+
+    // Everyone starts at the root.
+    tree.process_batch(states, agents, statuses);
+    for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(i % 2 == 0 ? Status::RUNNING : Status::SUCCESS, statuses[i]);
+        EXPECT_EQ(1, agents[i].first_visits);
+        EXPECT_EQ(1, agents[i].second_visits);
+    }
+
+    // Busy agents now resume at the sequence, the others start over. Either
+    // way, each agent's status must land in its own slot.
+    for (size_t i = 0; i < count; i += 4) {
+        agents[i].busy = false;
+    }
+    std::vector<size_t> resume_indices;
+    for (auto const &state : states) {
+        resume_indices.push_back(state.resume_index);
+    }
+    visit_order.clear();
+    tree.process_batch(states, agents, statuses);
+    for (size_t i = 0; i < count; ++i) {
+        auto const was_busy = i % 2 == 0;
+        auto const still_busy = was_busy && i % 4 != 0;
+        EXPECT_EQ(still_busy ? Status::RUNNING : Status::SUCCESS, statuses[i]);
+        EXPECT_EQ(was_busy ? 1 : 2, agents[i].first_visits);
+        EXPECT_EQ(2, agents[i].second_visits);
+    }
+
+    // Agents resuming at the same node ran next to each other.
+    ASSERT_EQ(count, visit_order.size());
+    std::set<size_t> finished_groups;
+    for (size_t i = 1; i < count; ++i) {
+        auto const previous = resume_indices[visit_order[i - 1]];
+        auto const current = resume_indices[visit_order[i]];
+        if (previous != current) {
+            EXPECT_TRUE(finished_groups.insert(previous).second);
+            EXPECT_EQ(0u, finished_groups.count(current));
+        }
+    }
+    EXPECT_EQ(1u, finished_groups.size()); // some resume at the sequence, the rest at the root
+}
+
+TEST(BeehiveTest, ThreadPoolTest)
+{
+    using namespace beehive;
+
+    ThreadPool pool(4);
+    EXPECT_EQ(4, pool.thread_count());
+
+    // Every item is visited exactly once, whatever the grain size.
+    for (size_t grain_size : {1, 7, 64, 5000}) {
+        std::vector<std::atomic<int>> visits(1000);
+        pool.parallel_for(visits.size(), grain_size, [&](size_t begin, size_t end) {
+            EXPECT_LE(end - begin, grain_size);
+            for (auto i = begin; i < end; ++i) {
+                ++visits[i];
+            }
+        });
+        for (auto &count : visits) {
+            EXPECT_EQ(1, count);
+        }
+    }
+
+    pool.parallel_for(0, 1, [](size_t, size_t) {
+        FAIL() << "empty ranges have nothing to run";
+    });
+
+    // Nested calls run on the calling worker instead of deadlocking.
+    std::atomic<int> total{};
+    pool.parallel_for(8, 1, [&](size_t, size_t) {
+        pool.parallel_for(10, 1, [&](size_t begin, size_t end) {
+            total += static_cast<int>(end - begin);
+        });
+    });
+    EXPECT_EQ(80, total);
+
+    EXPECT_THROW(pool.parallel_for(100, 1, [](size_t begin, size_t) {
+        if (begin == 42) {
+            throw std::runtime_error("leaf failed");
+        }
+    }), std::runtime_error);
+}
+
+TEST(BeehiveTest, ParallelProcessBatchTest)
+{
+    using namespace beehive;
+
+    struct Agent
+    {
+        int ticks_left{};
+        int visits{};
+    };
+
+    auto tree = Builder<Agent>{}
+        .sequence()
+            .leaf([](Agent &agent) {
+                ++agent.visits;
+                return true;
+            })
+            .leaf([](Agent &agent) {
+                return agent.ticks_left-- > 0 ? Status::RUNNING : Status::SUCCESS;
+            })
+        .end()
+        .build();
+
+    constexpr size_t count = 10000;
+    std::vector<Agent> agents(count), expected_agents(count);
+    std::vector<TreeState> states, expected_states;
+    for (size_t i = 0; i < count; ++i) {
+        agents[i].ticks_left = expected_agents[i].ticks_left = static_cast<int>(i % 3);
+        states.push_back(tree.make_state());
+        expected_states.push_back(tree.make_state());
+    }
+    std::vector<Status> statuses(count), expected_statuses(count);
+
+    ThreadPool pool(3);
+    for (int tick = 0; tick < 3; ++tick) {
+        tree.process_batch(states, agents, statuses, pool, 100);
+        tree.process_batch(expected_states, expected_agents, expected_statuses);
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(expected_statuses[i], statuses[i]);
+            ASSERT_EQ(expected_agents[i].visits, agents[i].visits);
+            ASSERT_EQ(expected_agents[i].ticks_left, agents[i].ticks_left);
+        }
+    }
+}
+
+TEST(BeehiveTest, TreeStatePoolTest)
+{
+    using namespace beehive;
+
+    struct Agent
+    {
+        int ticks_left{};
+        int visits{};
+    };
+
+    // Agents run two composites deep, so pooled state must keep a whole path.
+    auto tree = Builder<Agent>{}
+        .sequence()
+            .selector()
+                .leaf([](Agent &) { return false; })
+                .sequence()
+                    .leaf([](Agent &agent) {
+                        ++agent.visits;
+                        return true;
+                    })
+                    .leaf([](Agent &agent) {
+                        return agent.ticks_left-- > 0 ? Status::RUNNING : Status::SUCCESS;
+                    })
+                .end()
+            .end()
+            .leaf(&noop<Agent>)
+        .end()
+        .build();
+
+    constexpr size_t count = 1000;
+    std::vector<Agent> agents(count), expected_agents(count);
+    std::vector<TreeState> expected_states;
+    for (size_t i = 0; i < count; ++i) {
+        agents[i].ticks_left = expected_agents[i].ticks_left = static_cast<int>(i % 4);
+        expected_states.push_back(tree.make_state());
+    }
+    std::vector<Status> statuses(count), expected_statuses(count);
+
+    auto pool = tree.make_state_pool(count);
+    EXPECT_EQ(count, pool.size());
+    // Depth plus an index and offset for each of the four branch levels, 16 bits each.
+    EXPECT_EQ(9 * sizeof(uint16_t), pool.bytes_per_entity());
+
+    ThreadPool threads(3);
+    for (int tick = 0; tick < 4; ++tick) {
+        if (tick % 2 == 0) {
+            tree.process_batch(pool, agents, statuses);
+        } else {
+            tree.process_batch(pool, agents, statuses, threads, 100);
+        }
+        tree.process_batch(expected_states, expected_agents, expected_statuses);
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(expected_statuses[i], statuses[i]);
+            ASSERT_EQ(expected_states[i].resume_index, pool.resume_index(i));
+            ASSERT_EQ(expected_agents[i].visits, agents[i].visits);
+        }
+    }
+
+    // A single entity can be ticked on its own, reset, or grown into.
+    agents[3].ticks_left = 1;
+    EXPECT_EQ(Status::RUNNING, tree.process(pool, 3, agents[3]));
+    EXPECT_EQ(4, pool.resume_index(3));
+    pool.reset(3);
+    EXPECT_EQ(0, pool.resume_index(3));
+    pool.resize(count + 1);
+    EXPECT_EQ(0, pool.resume_index(count));
+    EXPECT_EQ(expected_states[1].resume_index, pool.resume_index(1));
+    EXPECT_EQ(Status::SUCCESS, tree.process(pool, count, agents[0]));
+}
+
+TEST(BeehiveTest, ReactiveTest)
+{
+    using namespace beehive;
+
+    struct Context
+    {
+        bool hungry;
+        int evaluations;
+        int running_ticks;
+    };
+
+    uint64_t const HUNGER = 1 << 0;
+    uint64_t const WEATHER = 1 << 3;
+
+    auto const eat = std::make_shared<Tree<Context> const>(Builder<Context>{}
+        .reactive(HUNGER)
+            .leaf([](Context &context) {
+                ++context.evaluations;
+                return context.hungry;
+            })
+        .end()
+        .build());
+
+    auto tree = Builder<Context>{}
+        .selector()
+            .subtree_ref(eat)
+            .reactive(WEATHER)
+                .leaf([](Context &context) {
+                    return ++context.running_ticks % 2 == 1 ? Status::RUNNING : Status::FAILURE;
+                })
+            .end()
+        .end()
+        .build();
+
+    auto state = tree.make_state();
+    Context context{false, 0, 0};
+
+    // The first tick evaluates; later ticks reuse the cached FAILURE.
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(1, context.evaluations);
+
+    // RUNNING is never cached.
+    EXPECT_EQ(Status::FAILURE, tree.process(state, context));
+    EXPECT_EQ(1, context.evaluations);
+    EXPECT_EQ(2, context.running_ticks);
+
+    // Now both results are cached.
+    EXPECT_EQ(Status::FAILURE, tree.process(state, context));
+    EXPECT_EQ(1, context.evaluations);
+    EXPECT_EQ(2, context.running_ticks);
+
+    // An unrelated key leaves the cache alone.
+    context.hungry = true;
+    state.invalidate(WEATHER);
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(1, context.evaluations);
+    EXPECT_EQ(3, context.running_ticks);
+
+    EXPECT_EQ(Status::FAILURE, tree.process(state, context));
+    EXPECT_EQ(1, context.evaluations);
+    EXPECT_EQ(4, context.running_ticks);
+
+    // A matching key evaluates again.
+    state.invalidate(HUNGER);
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, context));
+    EXPECT_EQ(2, context.evaluations);
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, context));
+    EXPECT_EQ(2, context.evaluations);
+
+    // Each state has its own cache.
+    auto other_state = tree.make_state();
+    EXPECT_EQ(Status::SUCCESS, tree.process(other_state, context));
+    EXPECT_EQ(3, context.evaluations);
+
+    // Without a state there is no cache.
+    EXPECT_EQ(Status::SUCCESS, tree.process(context));
+    EXPECT_EQ(Status::SUCCESS, tree.process(context));
+    EXPECT_EQ(5, context.evaluations);
+
+    // The compiled tree shares the cache layout.
+    auto const compiled = Builder<Context>{}
+        .sequence()
+            .reactive(HUNGER)
+                .leaf([](Context &context) {
+                    ++context.evaluations;
+                    return context.hungry;
+                })
+            .end()
+        .end()
+        .build()
+        .compile();
+    auto compiled_state = compiled.make_state();
+    EXPECT_EQ(Status::SUCCESS, compiled.process(compiled_state, context));
+    EXPECT_EQ(Status::SUCCESS, compiled.process(compiled_state, context));
+    EXPECT_EQ(6, context.evaluations);
+}
+
+TEST(BeehiveTest, BlackboardTest)
+{
+    using namespace beehive;
+
+    struct Position
+    {
+        float x, y;
+    };
+
+    BlackboardSchema schema;
+    auto const hungry = schema.add<bool>("hungry", true);
+    auto const position = schema.add<Position>("position");
+    auto const meals = schema.add<int>("meals");
+    EXPECT_TRUE(schema.contains("position"));
+    EXPECT_FALSE(schema.contains("food"));
+
+    // Values are packed in the order added, each at its own alignment.
+    EXPECT_EQ(0, hungry.offset());
+    EXPECT_EQ(alignof(Position), position.offset());
+    EXPECT_EQ(position.offset() + sizeof(Position), meals.offset());
+    EXPECT_EQ(meals.offset() + sizeof(int), schema.size());
+    EXPECT_EQ(meals.offset(), schema.key<int>("meals").offset());
+
+    // Names are added once, and looked up with the type they were added with.
+    EXPECT_THROW(schema.add<int>("meals"), std::invalid_argument);
+    EXPECT_THROW(schema.key<int>("food"), std::invalid_argument);
+    EXPECT_THROW(schema.key<float>("meals"), std::invalid_argument);
+    EXPECT_EQ(meals.offset() + sizeof(int), schema.size());
+
+    struct Agent : Blackboard
+    {
+        using Blackboard::Blackboard;
+        int ticks{};
+    };
+
+    // The adapter works with both leaf signatures.
+    BoolLeaf<Agent> const is_hungry = with_key(schema.key<bool>("hungry"), [](bool hungry) {
+        return hungry;
+    });
+    Leaf<Agent> const walk = with_key(position, [](Position &position) {
+        position.x += 1;
+        return position.x < 2 ? Status::RUNNING : Status::SUCCESS;
+    });
+
+    auto tree = Builder<Agent>{}
+        .sequence()
+            .leaf(is_hungry)
+            .leaf(walk)
+            .void_leaf(with_key(meals, [](int &meals) { ++meals; }))
+            .void_leaf([](Agent &agent) { ++agent.ticks; })
+        .end()
+        .build();
+
+    Agent agent{schema};
+    EXPECT_TRUE(agent[hungry]);
+    EXPECT_EQ(0, agent.get(meals));
+    auto state = tree.make_state();
+    EXPECT_EQ(Status::RUNNING, tree.process(state, agent));
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, agent));
+    EXPECT_EQ(2, agent[position].x);
+    EXPECT_EQ(1, agent[meals]);
+    EXPECT_EQ(1, agent.ticks);
+
+    agent.set(hungry, false);
+    EXPECT_EQ(Status::FAILURE, tree.process(state, agent));
+    EXPECT_EQ(1, agent[meals]);
+
+    // Blackboards are values.
+    auto const copy = agent;
+    agent.set(meals, 5);
+    EXPECT_EQ(1, copy[meals]);
+    EXPECT_EQ(0, schema.make_blackboard().get(position).y);
+}
+
+TEST(BeehiveTest, BudgetTest)
+{
+    using namespace beehive;
+
+    using Counts = std::array<int, 6>;
+
+    auto const counter = [](size_t i) {
+        return [i](Counts &counts) {
+            ++counts[i];
+            return true;
+        };
+    };
+    auto const tree = Builder<Counts>{}
+        .sequence()
+            .leaf(counter(0))
+            .inverter()
+                .inverter()
+                    .leaf(counter(1))
+                .end()
+            .end()
+            .selector()
+                .leaf([](Counts &) { return false; })
+                .leaf(counter(2))
+            .end()
+            .leaf(counter(3))
+            .leaf(counter(4))
+            .leaf(counter(5))
+        .end()
+        .build();
+
+    // Each tick stops before the first node past the budget, and the next one
+    // continues there, so every leaf runs exactly once.
+    auto state = tree.make_state();
+    Counts counts{};
+    Budget first{4};
+    EXPECT_EQ(Status::RUNNING, tree.process_budgeted(state, counts, first));
+    EXPECT_TRUE(first.exhausted());
+    EXPECT_EQ(4, first.nodes_processed());
+    EXPECT_EQ((Counts{1, 0, 0, 0, 0, 0}), counts);
+
+    // Stopping under decorators works as well as directly under a composite,
+    // and even a budget of one always makes progress.
+    Budget second{1};
+    EXPECT_EQ(Status::RUNNING, tree.process_budgeted(state, counts, second));
+    EXPECT_EQ((Counts{1, 1, 0, 0, 0, 0}), counts);
+    Budget third{1};
+    EXPECT_EQ(Status::RUNNING, tree.process_budgeted(state, counts, third));
+    EXPECT_EQ((Counts{1, 1, 0, 0, 0, 0}), counts);
+    Budget fourth{1};
+    EXPECT_EQ(Status::RUNNING, tree.process_budgeted(state, counts, fourth));
+    EXPECT_EQ((Counts{1, 1, 1, 1, 0, 0}), counts);
+
+    // An unbudgeted tick finishes the job.
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, counts));
+    EXPECT_EQ((Counts{1, 1, 1, 1, 1, 1}), counts);
+    Budget plenty{100};
+    EXPECT_EQ(Status::SUCCESS, tree.process_budgeted(state, counts, plenty));
+    EXPECT_FALSE(plenty.exhausted());
+    EXPECT_EQ(12, plenty.nodes_processed());
+
+    // The compiled tree stops at the same leaves.
+    auto const compiled = tree.compile();
+    auto compiled_state = compiled.make_state();
+    Counts compiled_counts{};
+    Budget leaves{2};
+    EXPECT_EQ(Status::RUNNING, compiled.process_budgeted(compiled_state, compiled_counts, leaves));
+    EXPECT_EQ((Counts{1, 1, 0, 0, 0, 0}), compiled_counts);
+    EXPECT_EQ(Status::SUCCESS, compiled.process(compiled_state, compiled_counts));
+    EXPECT_EQ((Counts{1, 1, 1, 1, 1, 1}), compiled_counts);
+
+    // Round robin shares one budget between entities and picks up where it
+    // stopped.
+    std::vector<TreeState> states(3, tree.make_state());
+    std::vector<Counts> contexts(3);
+    std::vector<Status> statuses(3);
+    Budget frame{20};
+    auto next = tree.process_round_robin(states, contexts, statuses, frame);
+    EXPECT_EQ(1, next);
+    EXPECT_EQ(Status::SUCCESS, statuses[0]);
+    EXPECT_EQ(Status::RUNNING, statuses[1]);
+    EXPECT_EQ((Counts{}), contexts[2]);
+    Budget next_frame{20};
+    next = tree.process_round_robin(states, contexts, statuses, next_frame, next);
+    EXPECT_EQ(0, next);
+    EXPECT_EQ((Counts{1, 1, 1, 1, 1, 1}), contexts[1]);
+    EXPECT_EQ((Counts{1, 1, 1, 1, 1, 1}), contexts[2]);
+    EXPECT_EQ((Counts{2, 1, 1, 1, 1, 1}), contexts[0]);
+
+    // Time limits stop ticks too.
+    Budget expired{std::chrono::nanoseconds{0}};
+    EXPECT_EQ(Status::RUNNING, tree.process_budgeted(state, counts, expired));
+    EXPECT_TRUE(expired.exhausted());
+}
+
+TEST(BeehiveTest, ParallelTest)
+{
+    using namespace beehive;
+
+    using Counts = std::array<std::atomic<int>, 5>;
+
+    // Returns RUNNING `ticks` times, then `result`.
+    auto const runs_for = [](size_t counter, int ticks, Status result) {
+        return [counter, ticks, result](Counts &counts) {
+            return ++counts[counter] <= ticks ? Status::RUNNING : result;
+        };
+    };
+
+    auto const make_tree = [&](size_t success_threshold, size_t failure_threshold, ThreadPool *threads) {
+        return Builder<Counts>{}
+            .parallel(success_threshold, failure_threshold, threads)
+                .leaf(runs_for(0, 2, Status::SUCCESS))
+                .leaf(runs_for(1, 0, Status::SUCCESS))
+                .sequence()
+                    .leaf(runs_for(2, 0, Status::SUCCESS))
+                    .leaf(runs_for(3, 1, Status::SUCCESS))
+                .end()
+                .leaf(runs_for(4, 1, Status::FAILURE))
+            .end()
+            .build();
+    };
+    auto const counts_of = [](Counts const &counts) {
+        std::array<int, 5> values;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            values[i] = counts[i];
+        }
+        return values;
+    };
+
+    ThreadPool threads(4);
+    for (auto *pool : {static_cast<ThreadPool *>(nullptr), &threads}) {
+        // Every child is ticked, and RUNNING children resume where they were.
+        auto tree = make_tree(3, 2, pool);
+        auto state = tree.make_state();
+        Counts counts{};
+        EXPECT_EQ(Status::RUNNING, tree.process(state, counts));
+        EXPECT_EQ((std::array<int, 5>{1, 1, 1, 1, 1}), counts_of(counts));
+        EXPECT_EQ(Status::RUNNING, tree.process(state, counts));
+        EXPECT_EQ((std::array<int, 5>{2, 1, 1, 2, 2}), counts_of(counts));
+        EXPECT_EQ(Status::SUCCESS, tree.process(state, counts));
+        EXPECT_EQ((std::array<int, 5>{3, 1, 1, 2, 2}), counts_of(counts));
+
+        // The first failure fails, and the children still running are stopped.
+        auto strict = make_tree(SIZE_MAX, 1, pool);
+        auto strict_state = strict.make_state();
+        Counts strict_counts{};
+        EXPECT_EQ(Status::RUNNING, strict.process(strict_state, strict_counts));
+        EXPECT_EQ(Status::FAILURE, strict.process(strict_state, strict_counts));
+        EXPECT_EQ((std::array<int, 5>{2, 1, 1, 2, 2}), counts_of(strict_counts));
+        EXPECT_EQ(Status::FAILURE, strict.process(strict_state, strict_counts));
+        EXPECT_EQ((std::array<int, 5>{3, 2, 2, 3, 3}), counts_of(strict_counts));
+
+        // A single success can be enough.
+        auto eager = make_tree(1, SIZE_MAX, pool);
+        auto eager_state = eager.make_state();
+        Counts eager_counts{};
+        EXPECT_EQ(Status::SUCCESS, eager.process(eager_state, eager_counts));
+    }
+
+    // Children on a thread pool are traced in child order, with the entity's
+    // tick, while the pool runs them out of order.
+    auto const threaded = make_tree(3, 2, &threads);
+    auto const traced = threaded.instrumented(Tracer{});
+    TraceBuffer buffer{64};
+    auto traced_state = threaded.make_state();
+    traced_state.trace(&buffer);
+    Counts traced_counts{};
+    EXPECT_EQ(Status::RUNNING, traced.process(traced_state, traced_counts));
+    std::vector<TraceEvent> events(64);
+    events.resize(buffer.drain(events));
+    ASSERT_EQ(8, threaded.nodes().size());
+    std::vector<uint32_t> nodes;
+    for (auto const &event : events) {
+        EXPECT_EQ(1, event.tick);
+        nodes.push_back(event.node);
+    }
+    EXPECT_EQ((std::vector<uint32_t>{2, 3, 5, 6, 4, 7, 1, 0}), nodes);
+
+    // Nothing below them may keep per-entity values, since they would start
+    // over on every tick.
+    auto const make_stateful = [](ThreadPool *pool) {
+        return Builder<Counts>{}
+            .parallel(SIZE_MAX, 1, pool)
+                .leaf([](Counts &) { return true; })
+                .repeat(2)
+                    .leaf([](Counts &) { return true; })
+                .end()
+            .end()
+            .build();
+    };
+    EXPECT_NO_THROW(make_stateful(nullptr));
+    EXPECT_THROW(make_stateful(&threads), std::invalid_argument);
+
+    // Without a state, all children start over on every tick.
+    auto tree = make_tree(3, 2, nullptr);
+    Counts counts{};
+    EXPECT_EQ(Status::RUNNING, tree.process(counts));
+    EXPECT_EQ(Status::RUNNING, tree.process(counts));
+    EXPECT_EQ((std::array<int, 5>{2, 2, 2, 2, 2}), counts_of(counts));
+}
+
+TEST(BeehiveTest, SerializationTest)
+{
+    using namespace beehive;
+
+    using Counts = std::array<int, 4>;
+    FunctionTable<Counts> table;
+    table.add_leaf("first", [](Counts &counts) { return ++counts[0] > 0; });
+    table.add_leaf("fail", [](Counts &) { return false; });
+    table.add_void_leaf("second", [](Counts &counts) { ++counts[1]; });
+    table.add_composite("all", &sequence<Counts>);
+    table.add_decorator("not", &inverter<Counts>);
+    table.add_subtree("third", std::make_shared<Tree<Counts> const>(
+        Builder<Counts>{}.void_leaf([](Counts &counts) { ++counts[2]; }).build()
+    ));
+    EXPECT_EQ(6, table.size());
+    EXPECT_TRUE(table.contains("not"));
+    EXPECT_FALSE(table.contains("missing"));
+
+    auto const tree = Builder<Counts>{}
+        .selector()
+            .decorator(table, "not")
+                .leaf(table, "first")
+            .end()
+            .composite(table, "all")
+                .reactive(1)
+                    .leaf(table, "second")
+                .end()
+                .parallel(2, 1)
+                    .leaf(table, "third")
+                    .inverter()
+                        .leaf(table, "fail")
+                    .end()
+                .end()
+                .leaf(table, "first")
+            .end()
+        .end()
+        .build();
+
+    auto const bytes = table.serialize(tree);
+    auto const loaded = table.deserialize(bytes);
+    ASSERT_EQ(tree.nodes().size(), loaded.nodes().size());
+    for (size_t i = 0; i < tree.nodes().size(); ++i) {
+        EXPECT_EQ(tree.nodes()[i].child_count(), loaded.nodes()[i].child_count());
+        EXPECT_EQ(tree.nodes()[i].descendent_count(), loaded.nodes()[i].descendent_count());
+    }
+    EXPECT_EQ(bytes, table.serialize(loaded));
+
+    // Both run the same way, including the reactive cache.
+    Counts counts{};
+    auto state = tree.make_state();
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, counts));
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, counts));
+    EXPECT_EQ((Counts{4, 1, 2, 0}), counts);
+    Counts loaded_counts{};
+    auto loaded_state = loaded.make_state();
+    EXPECT_EQ(Status::SUCCESS, loaded.process(loaded_state, loaded_counts));
+    EXPECT_EQ(Status::SUCCESS, loaded.process(loaded_state, loaded_counts));
+    EXPECT_EQ(counts, loaded_counts);
+
+    // Loaded conditions still move ahead of their siblings when optimized.
+    auto const checked = table.deserialize(table.serialize(Builder<Counts>{}
+        .sequence()
+            .leaf(table, "second")
+            .condition(table, "fail")
+        .end()
+        .build())).optimized();
+    Counts checked_counts{};
+    EXPECT_EQ(Status::FAILURE, checked.process(checked_counts));
+    EXPECT_EQ(0, checked_counts[1]);
+
+    // Only nodes from the table can be saved.
+    auto const unregistered = Builder<Counts>{}.leaf([](Counts &) { return true; }).build();
+    EXPECT_THROW(table.serialize(unregistered), std::invalid_argument);
+
+    // So are names the table doesn't have, or has for another kind of node.
+    Builder<Counts> misnamed;
+    EXPECT_THROW(misnamed.leaf(table, "missing"), std::invalid_argument);
+    EXPECT_THROW(misnamed.leaf(table, "all"), std::invalid_argument);
+    EXPECT_THROW(misnamed.composite(table, "first"), std::invalid_argument);
+
+    // Bad or unresolvable bytes are rejected.
+    EXPECT_THROW(table.deserialize(bytes.data(), bytes.size() - 1), std::runtime_error);
+    auto corrupt = bytes;
+    corrupt[0] = 'X';
+    EXPECT_THROW(table.deserialize(corrupt), std::runtime_error);
+    FunctionTable<Counts> other;
+    other.add_leaf("first", [](Counts &) { return true; });
+    EXPECT_THROW(other.deserialize(bytes), std::runtime_error);
+}
+
+TEST(BeehiveTest, StateSnapshotTest)
+{
+    using namespace beehive;
+
+    using Counts = std::array<int, 4>;
+    auto const make_tree = [] {
+        return Builder<Counts>{}
+            .sequence()
+                .reactive(1)
+                    .leaf([](Counts &counts) { return ++counts[0] > 0; })
+                .end()
+                .parallel()
+                    .leaf([](Counts &counts) { return ++counts[1] % 3 == 0 ? Status::SUCCESS : Status::RUNNING; })
+                    .sequence()
+                        .leaf([](Counts &counts) { return ++counts[2] > 0; })
+                        .leaf([](Counts &counts) { return ++counts[3] % 2 == 0 ? Status::SUCCESS : Status::RUNNING; })
+                    .end()
+                .end()
+            .end()
+            .build();
+    };
+    auto const tree = make_tree();
+    auto const copy = make_tree();
+    EXPECT_EQ(tree.structure_hash(), copy.structure_hash());
+    auto const other = Builder<Counts>{}.leaf([](Counts &) { return true; }).build();
+    EXPECT_NE(tree.structure_hash(), other.structure_hash());
+
+    // The running parallel, the sequence resuming inside it and the reactive
+    // cache all carry over to a tree built the same way.
+    std::vector<TreeState> states{tree.make_state(), tree.make_state()};
+    Counts counts{};
+    EXPECT_EQ(Status::RUNNING, tree.process(states[0], counts));
+    std::vector<unsigned char> bytes;
+    tree.encode_states(states, bytes);
+
+    std::vector<TreeState> restored{copy.make_state(), copy.make_state()};
+    EXPECT_EQ(bytes.size(), copy.decode_states(bytes.data(), bytes.size(), restored));
+    EXPECT_EQ(states[0].resume_index, restored[0].resume_index);
+    auto restored_counts = counts;
+    for (auto const expected : {Status::RUNNING, Status::SUCCESS}) {
+        EXPECT_EQ(expected, tree.process(states[0], counts));
+        EXPECT_EQ(expected, copy.process(restored[0], restored_counts));
+    }
+    EXPECT_EQ((Counts{1, 3, 1, 2}), counts);
+    EXPECT_EQ(counts, restored_counts);
+
+    // A state that never ran restores to the start.
+    Counts fresh{};
+    EXPECT_EQ(Status::RUNNING, copy.process(restored[1], fresh));
+    EXPECT_EQ((Counts{1, 1, 1, 1}), fresh);
+
+    // Snapshots for another structure, of another size or cut short are rejected.
+    std::vector<TreeState> one{copy.make_state()};
+    EXPECT_THROW(copy.decode_states(bytes.data(), bytes.size(), one), std::runtime_error);
+    std::vector<TreeState> others{other.make_state(), other.make_state()};
+    EXPECT_THROW(other.decode_states(bytes.data(), bytes.size(), others), std::runtime_error);
+    EXPECT_THROW(copy.decode_states(bytes.data(), bytes.size() - 1, restored), std::runtime_error);
+
+    // So are snapshots resuming nodes the tree can't resume there.
+    auto const two_leaves = Builder<Counts>{}
+        .sequence()
+            .leaf([](Counts &) { return true; })
+            .leaf([](Counts &) { return Status::RUNNING; })
+        .end()
+        .build();
+    std::vector<TreeState> running{two_leaves.make_state()};
+    Counts unused{};
+    EXPECT_EQ(Status::RUNNING, two_leaves.process(running[0], unused));
+    std::vector<unsigned char> valid;
+    two_leaves.encode_states(running, valid);
+    // One state, one frame: the sequence at its second child, plus one. No slots.
+    auto const frame = valid.size() - 2;
+    ASSERT_EQ((std::vector<unsigned char>{1, 1, 1, 2, 0}), std::vector<unsigned char>(valid.begin() + frame - 3, valid.end()));
+    EXPECT_EQ(valid.size(), two_leaves.decode_states(valid.data(), valid.size(), running));
+    for (auto const &corrupt : {
+        std::make_pair(frame, 3), // past the sequence's children
+        std::make_pair(frame - 1, 2), // at a leaf
+        std::make_pair(frame - 1, 9), // past the end of the tree
+    }) {
+        auto bytes = valid;
+        bytes[corrupt.first] = static_cast<unsigned char>(corrupt.second);
+        EXPECT_THROW(two_leaves.decode_states(bytes.data(), bytes.size(), running), std::runtime_error);
+    }
+}
+
+TEST(BeehiveTest, StatefulDecoratorTest)
+{
+    using namespace beehive;
+
+    using Clock = std::chrono::steady_clock;
+    static Clock::time_point now{};
+    auto const clock = [] { return now; };
+    using Counts = std::array<int, 2>;
+
+    // repeat() keeps counting successes across RUNNING ticks.
+    auto const repeat = Builder<Counts>{}
+        .repeat(3)
+            .leaf([](Counts &counts) { return ++counts[0] == 2 ? Status::RUNNING : Status::SUCCESS; })
+        .end()
+        .build();
+    auto state = repeat.make_state();
+    Counts counts{};
+    EXPECT_EQ(Status::RUNNING, repeat.process(state, counts));
+    EXPECT_EQ(Status::SUCCESS, repeat.process(state, counts));
+    EXPECT_EQ(4, counts[0]);
+
+    // retry() runs the child until it succeeds, up to the number of attempts.
+    auto const retry = Builder<Counts>{}
+        .retry(3)
+            .leaf([](Counts &counts) { return ++counts[0] % 3 == 0; })
+        .end()
+        .build();
+    counts = {};
+    state = retry.make_state();
+    EXPECT_EQ(Status::SUCCESS, retry.process(state, counts));
+    EXPECT_EQ(3, counts[0]);
+    EXPECT_EQ(Status::FAILURE, Builder<Counts>{}
+        .retry(2)
+            .leaf([](Counts &) { return false; })
+        .end()
+        .build()
+        .process(counts));
+
+    // cooldown() skips its subtree until the period has passed.
+    auto const cooldown = Builder<Counts>{}
+        .cooldown(std::chrono::seconds{10}, clock)
+            .leaf([](Counts &counts) { return ++counts[0] > 0; })
+        .end()
+        .build();
+    counts = {};
+    state = cooldown.make_state();
+    EXPECT_EQ(Status::SUCCESS, cooldown.process(state, counts));
+    now += std::chrono::seconds{9};
+    EXPECT_EQ(Status::FAILURE, cooldown.process(state, counts));
+    EXPECT_EQ(1, counts[0]);
+    now += std::chrono::seconds{1};
+    EXPECT_EQ(Status::SUCCESS, cooldown.process(state, counts));
+    EXPECT_EQ(2, counts[0]);
+
+    // timeout() abandons a child that runs for too long.
+    auto const timeout = Builder<Counts>{}
+        .sequence()
+            .leaf([](Counts &counts) { return ++counts[1] > 0; })
+            .timeout(std::chrono::seconds{5}, clock)
+                .sequence()
+                    .leaf([](Counts &) { return true; })
+                    .leaf([](Counts &counts) { return ++counts[0] > 0 ? Status::RUNNING : Status::FAILURE; })
+                .end()
+            .end()
+        .end()
+        .build();
+    counts = {};
+    state = timeout.make_state();
+    EXPECT_EQ(Status::RUNNING, timeout.process(state, counts));
+    now += std::chrono::seconds{4};
+    EXPECT_EQ(Status::RUNNING, timeout.process(state, counts));
+    EXPECT_EQ((Counts{2, 1}), counts);
+    now += std::chrono::seconds{1};
+    EXPECT_EQ(Status::FAILURE, timeout.process(state, counts));
+    EXPECT_EQ((Counts{2, 1}), counts);
+    EXPECT_EQ(Status::RUNNING, timeout.process(state, counts));
+    EXPECT_EQ((Counts{3, 2}), counts);
+
+    // rate_limit() allows a number of starts per period.
+    auto const rate_limit = Builder<Counts>{}
+        .rate_limit(2, std::chrono::seconds{1}, clock)
+            .leaf([](Counts &counts) { return ++counts[0] > 0; })
+        .end()
+        .build();
+    counts = {};
+    state = rate_limit.make_state();
+    EXPECT_EQ(Status::SUCCESS, rate_limit.process(state, counts));
+    EXPECT_EQ(Status::SUCCESS, rate_limit.process(state, counts));
+    EXPECT_EQ(Status::FAILURE, rate_limit.process(state, counts));
+    now += std::chrono::seconds{1};
+    EXPECT_EQ(Status::SUCCESS, rate_limit.process(state, counts));
+    EXPECT_EQ(3, counts[0]);
+
+    // The decorators are saved with their parameters, and each entity has its own state.
+    FunctionTable<Counts> table;
+    table.add_leaf("count", [](Counts &counts) { return ++counts[0] > 0; });
+    table.set_time_source(clock);
+    auto const saved = Builder<Counts>{}
+        .cooldown(std::chrono::seconds{1}, clock)
+            .repeat(2)
+                .leaf(table, "count")
+            .end()
+        .end()
+        .build();
+    auto const loaded = table.deserialize(table.serialize(saved));
+    EXPECT_EQ(saved.structure_hash(), loaded.structure_hash());
+    auto first = loaded.make_state();
+    auto second = loaded.make_state();
+    counts = {};
+    EXPECT_EQ(Status::SUCCESS, loaded.process(first, counts));
+    EXPECT_EQ(Status::FAILURE, loaded.process(first, counts));
+    EXPECT_EQ(Status::SUCCESS, loaded.process(second, counts));
+    EXPECT_EQ(4, counts[0]);
+}
+
+TEST(BeehiveTest, UtilityTest)
+{
+    using namespace beehive;
+
+    struct Agent
+    {
+        std::array<float, 3> utilities;
+        std::array<int, 3> ticks;
+    };
+    auto const scores = [](Agent const &agent, Span<float> scores) {
+        std::copy_n(agent.utilities.begin(), scores.size(), scores.begin());
+    };
+    auto const tick = [](size_t child, Status status) {
+        return [child, status](Agent &agent) {
+            ++agent.ticks[child];
+            return status;
+        };
+    };
+
+    // The best child runs; failures fall through to the next best, NaN is skipped.
+    auto const tree = Builder<Agent>{}
+        .utility_selector(scores)
+            .leaf(tick(0, Status::SUCCESS))
+            .leaf(tick(1, Status::FAILURE))
+            .leaf(tick(2, Status::FAILURE))
+        .end()
+        .build();
+    Agent agent{{0.5f, 1.0f, 0.25f}, {}};
+    EXPECT_EQ(Status::SUCCESS, tree.process(agent));
+    EXPECT_EQ((std::array<int, 3>{1, 1, 0}), agent.ticks);
+    agent = {{std::nanf(""), 1.0f, 0.25f}, {}};
+    EXPECT_EQ(Status::FAILURE, tree.process(agent));
+    EXPECT_EQ((std::array<int, 3>{0, 1, 1}), agent.ticks);
+    agent = {{0.5f, 0.5f, 0.5f}, {}};
+    EXPECT_EQ(Status::SUCCESS, tree.process(agent));
+    EXPECT_EQ((std::array<int, 3>{1, 0, 0}), agent.ticks);
+
+    // A RUNNING child resumes while it scores highest and is abandoned once it doesn't.
+    auto const running = Builder<Agent>{}
+        .utility_selector(scores)
+            .sequence()
+                .leaf(tick(0, Status::SUCCESS))
+                .leaf(tick(1, Status::RUNNING))
+            .end()
+            .leaf(tick(2, Status::RUNNING))
+        .end()
+        .build();
+    auto state = running.make_state();
+    agent = {{1.0f, 0.0f, 0.0f}, {}};
+    EXPECT_EQ(Status::RUNNING, running.process(state, agent));
+    EXPECT_EQ(Status::RUNNING, running.process(state, agent));
+    EXPECT_EQ((std::array<int, 3>{1, 2, 0}), agent.ticks);
+    agent.utilities = {0.0f, 1.0f, 0.0f};
+    EXPECT_EQ(Status::RUNNING, running.process(state, agent));
+    agent.utilities = {1.0f, 0.0f, 0.0f};
+    EXPECT_EQ(Status::RUNNING, running.process(state, agent));
+    EXPECT_EQ((std::array<int, 3>{2, 3, 1}), agent.ticks);
+    EXPECT_EQ(Status::RUNNING, running.compile().process(agent));
+    EXPECT_EQ((std::array<int, 3>{3, 4, 1}), agent.ticks);
+
+    // A batch_scored() scorer scores every entity of process_batch() at once.
+    struct BatchScorer
+    {
+        void operator()(Agent const &agent, Span<float> scores) const
+        {
+            ++*single;
+            std::copy(agent.utilities.begin(), agent.utilities.end(), scores.begin());
+        }
+
+        void operator()(Span<Agent const> agents, Span<float> scores) const
+        {
+            ++*batches;
+            for (size_t j = 0; j < agents.size(); ++j) {
+                for (size_t i = 0; i < 3; ++i) {
+                    scores[i * agents.size() + j] = agents[j].utilities[i];
+                }
+            }
+        }
+
+        int *single;
+        int *batches;
+    };
+    int single = 0;
+    int batches = 0;
+    FunctionTable<Agent> table;
+    table.add_utility_selector("needs", batch_scored(BatchScorer{&single, &batches}));
+    table.add_leaf("first", tick(0, Status::SUCCESS));
+    table.add_leaf("second", tick(1, Status::SUCCESS));
+    table.add_leaf("third", tick(2, Status::SUCCESS));
+    auto const saved = Builder<Agent>{}
+        .utility_selector(table, "needs")
+            .leaf(table, "first")
+            .leaf(table, "second")
+            .leaf(table, "third")
+        .end()
+        .build();
+    auto const batched = table.deserialize(table.serialize(saved));
+    std::vector<Agent> agents{
+        {{1.0f, 0.0f, 0.0f}, {}},
+        {{0.0f, 1.0f, 0.0f}, {}},
+        {{0.0f, 0.0f, 1.0f}, {}},
+        {{0.0f, 1.0f, 0.0f}, {}},
+    };
+    std::vector<TreeState> states(agents.size(), batched.make_state());
+    std::vector<Status> statuses(agents.size());
+    batched.process_batch(states, agents, statuses);
+    EXPECT_EQ(1, batches);
+    EXPECT_EQ(0, single);
+    EXPECT_EQ((std::array<int, 3>{1, 0, 0}), agents[0].ticks);
+    EXPECT_EQ((std::array<int, 3>{0, 1, 0}), agents[1].ticks);
+    EXPECT_EQ((std::array<int, 3>{0, 0, 1}), agents[2].ticks);
+    EXPECT_EQ((std::array<int, 3>{0, 1, 0}), agents[3].ticks);
+    EXPECT_EQ(Status::SUCCESS, batched.process(agents[0]));
+    EXPECT_EQ(1, single);
+
+    // Unmarked, each entity is scored as it reaches the selector, after what
+    // the nodes in front of it changed, just like when ticked on its own.
+    auto const shifted = Builder<Agent>{}
+        .sequence()
+            .void_leaf([](Agent &agent) {
+                std::rotate(agent.utilities.begin(), agent.utilities.begin() + 1, agent.utilities.end());
+            })
+            .utility_selector(BatchScorer{&single, &batches})
+                .leaf(tick(0, Status::SUCCESS))
+                .leaf(tick(1, Status::SUCCESS))
+                .leaf(tick(2, Status::SUCCESS))
+            .end()
+        .end()
+        .build();
+    single = batches = 0;
+    for (auto &agent : agents) {
+        agent.ticks = {};
+    }
+    auto each = agents;
+    std::vector<TreeState> shifted_states(agents.size(), shifted.make_state());
+    for (int round = 0; round < 2; ++round) {
+        shifted.process_batch(shifted_states, agents, statuses);
+        for (auto &agent : each) {
+            EXPECT_EQ(Status::SUCCESS, shifted.process(agent));
+        }
+    }
+    EXPECT_EQ(0, batches);
+    for (size_t i = 0; i < agents.size(); ++i) {
+        EXPECT_EQ(each[i].ticks, agents[i].ticks);
+    }
+    EXPECT_EQ((std::array<int, 3>{0, 1, 1}), agents[0].ticks);
+}
+
+TEST(BeehiveTest, TreeHandleTest)
+{
+    using namespace beehive;
+
+    using Counts = std::array<int, 3>;
+    auto const count = [](size_t i, Status status) {
+        return [i, status](Counts &counts) {
+            ++counts[i];
+            return status;
+        };
+    };
+    auto const make_tree = [&](Status last) {
+        return Builder<Counts>{}
+            .sequence()
+                .leaf(count(0, Status::SUCCESS))
+                .selector()
+                    .leaf(count(1, Status::FAILURE))
+                    .leaf(count(2, last))
+                .end()
+            .end()
+            .build();
+    };
+
+    // A state resumes where it was in a reloaded tree of the same shape.
+    TreeHandle<Counts> handle{make_tree(Status::RUNNING)};
+    Counts counts{};
+    TreeState state = handle.read()->make_state();
+    EXPECT_EQ(Status::RUNNING, handle.read()->process(state, counts));
+    handle.reload(make_tree(Status::SUCCESS));
+    {
+        auto const tree = handle.read();
+        EXPECT_EQ(1u, tree.generation());
+        tree.update(state);
+        EXPECT_EQ(Status::SUCCESS, tree->process(state, counts));
+        EXPECT_EQ((Counts{1, 1, 2}), counts);
+    }
+
+    // Only the part of the path that still matches is kept.
+    auto const first = make_tree(Status::RUNNING);
+    auto const changed = Builder<Counts>{}
+        .sequence()
+            .leaf(count(0, Status::SUCCESS))
+            .sequence()
+                .leaf(count(1, Status::SUCCESS))
+                .leaf(count(2, Status::SUCCESS))
+            .end()
+        .end()
+        .build();
+    counts = {};
+    state = first.make_state();
+    EXPECT_EQ(Status::RUNNING, first.process(state, counts));
+    auto const migration = changed.migration_from(first);
+    EXPECT_TRUE(migration.applies_to(state));
+    migration.migrate(state);
+    EXPECT_FALSE(migration.applies_to(state));
+    EXPECT_EQ(Status::SUCCESS, changed.process(state, counts));
+    EXPECT_EQ((Counts{1, 2, 2}), counts);
+
+    // Values kept in slots carry over, and pools keep their paths.
+    auto const make_repeat = [&](Status last) {
+        return Builder<Counts>{}
+            .repeat(3)
+                .sequence()
+                    .leaf(count(0, Status::SUCCESS))
+                    .leaf(count(1, last))
+                .end()
+            .end()
+            .build();
+    };
+    auto const running = make_repeat(Status::RUNNING);
+    auto const succeeding = make_repeat(Status::SUCCESS);
+    counts = {};
+    state = running.make_state();
+    EXPECT_EQ(Status::RUNNING, running.process(state, counts));
+    succeeding.migration_from(running).migrate(state);
+    EXPECT_EQ(Status::SUCCESS, succeeding.process(state, counts));
+    EXPECT_EQ((Counts{3, 4, 0}), counts);
+    auto pool = running.make_state_pool(2);
+    running.process(pool, 1, counts);
+    succeeding.migration_from(running).migrate(pool);
+    EXPECT_EQ(0u, pool.resume_index(0));
+    EXPECT_NE(0u, pool.resume_index(1));
+    EXPECT_EQ(Status::SUCCESS, succeeding.process(pool, 1, counts));
+
+    // A reload waits for the readers of the old tree, who keep using it.
+    std::atomic<bool> reloaded{false};
+    std::thread reloader;
+    {
+        auto const tree = handle.read();
+        reloader = std::thread([&] {
+            handle.reload(make_tree(Status::FAILURE));
+            reloaded = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        EXPECT_FALSE(reloaded);
+        counts = {};
+        EXPECT_EQ(Status::SUCCESS, tree->process(counts));
+    }
+    reloader.join();
+    EXPECT_TRUE(reloaded);
+    auto const tree = handle.read();
+    EXPECT_EQ(2u, tree.generation());
+    tree.update(state); // a state of another tree starts over
+    EXPECT_EQ(Status::FAILURE, tree->process(state, counts));
+}
+
+TEST(BeehiveTest, MemoizeTest)
+{
+    using namespace beehive;
+
+    using Counts = std::array<int, 2>;
+    auto const fail = [](Counts &) { return false; };
+    auto const check = Builder<Counts>{}
+        .sequence()
+            .memoized_leaf([](Counts &counts) { return ++counts[0] > 0; })
+        .end()
+        .build();
+    auto const tree = Builder<Counts>{}
+        .selector()
+            .sequence()
+                .tree(check)
+                .leaf(fail)
+            .end()
+            .sequence()
+                .tree(check)
+                .leaf([](Counts &counts) { return ++counts[1] > 0; })
+            .end()
+        .end()
+        .build();
+
+    // Copies share one cached status per tick.
+    auto state = tree.make_state();
+    Counts counts{};
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, counts));
+    EXPECT_EQ((Counts{1, 1}), counts);
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, counts));
+    EXPECT_EQ((Counts{2, 2}), counts);
+    auto other = tree.make_state();
+    EXPECT_EQ(Status::SUCCESS, tree.process(other, counts));
+    EXPECT_EQ((Counts{3, 3}), counts);
+
+    // Without slots, the leaf runs every time.
+    EXPECT_EQ(Status::SUCCESS, tree.process(counts));
+    EXPECT_EQ((Counts{5, 4}), counts);
+
+    // Separately added leaves have caches of their own.
+    auto const memoized = [](Counts &counts) { return ++counts[0] > 0; };
+    auto const separate = Builder<Counts>{}
+        .sequence()
+            .memoized_leaf(memoized)
+            .memoized_leaf(memoized)
+        .end()
+        .build();
+    counts = {};
+    state = separate.make_state();
+    EXPECT_EQ(Status::SUCCESS, separate.process(state, counts));
+    EXPECT_EQ(2, counts[0]);
+
+    // Every node of a table entry shares the entry's cache, also once loaded.
+    FunctionTable<Counts> table;
+    table.add_memoized_leaf("check", [](Counts &counts) { return ++counts[0] > 1; });
+    table.add_leaf("count", [](Counts &counts) { return ++counts[1] > 0; });
+    auto const saved = Builder<Counts>{}
+        .selector()
+            .leaf(table, "check")
+            .sequence()
+                .inverter()
+                    .leaf(table, "check")
+                .end()
+                .leaf(table, "count")
+            .end()
+        .end()
+        .build();
+    auto const loaded = table.deserialize(table.serialize(saved));
+    counts = {};
+    state = loaded.make_state();
+    EXPECT_EQ(Status::SUCCESS, loaded.process(state, counts));
+    EXPECT_EQ((Counts{1, 1}), counts);
+    EXPECT_EQ(Status::SUCCESS, loaded.process(state, counts));
+    EXPECT_EQ((Counts{2, 1}), counts);
+}
+
+TEST(BeehiveTest, OptimizeTest)
+{
+    using namespace beehive;
+
+    using Calls = std::vector<int>;
+    auto const call = [](int id, bool result) {
+        return [id, result](Calls &calls) {
+            calls.push_back(id);
+            return result;
+        };
+    };
+    auto const steps = Builder<Calls>{}
+        .sequence()
+            .leaf(call(1, true))
+            .leaf(call(2, true))
+        .end()
+        .build();
+    auto const tree = Builder<Calls>{}
+        .sequence()
+            .tree(steps)
+            .inverter()
+                .inverter()
+                    .leaf(call(3, true))
+                .end()
+            .end()
+            .selector()
+                .leaf(call(4, false))
+                .selector()
+                    .leaf(call(5, true))
+                .end()
+            .end()
+            .condition(call(6, true))
+        .end()
+        .build();
+
+    // Forwarders and the inverter pair go, and nested composites merge.
+    auto const optimized = tree.optimized();
+    auto const &nodes = optimized.nodes();
+    ASSERT_EQ(8u, nodes.size());
+    EXPECT_EQ(5u, nodes[0].child_count());
+    EXPECT_EQ(2u, nodes[5].child_count());
+    EXPECT_EQ(14u, tree.nodes().size());
+
+    // The condition runs first; everything else in the original order.
+    Calls calls;
+    EXPECT_EQ(Status::SUCCESS, tree.process(calls));
+    EXPECT_EQ((Calls{1, 2, 3, 4, 5, 6}), calls);
+    calls.clear();
+    EXPECT_EQ(Status::SUCCESS, optimized.process(calls));
+    EXPECT_EQ((Calls{6, 1, 2, 3, 4, 5}), calls);
+
+    // A single inverter stays, and a lone leaf becomes the root.
+    auto const inverted = Builder<Calls>{}
+        .inverter()
+            .inverter()
+                .inverter()
+                    .leaf(call(7, true))
+                .end()
+            .end()
+        .end()
+        .build()
+        .optimized();
+    EXPECT_EQ(2u, inverted.nodes().size());
+    calls.clear();
+    EXPECT_EQ(Status::FAILURE, inverted.process(calls));
+    EXPECT_EQ(1u, Builder<Calls>{}.leaf(call(8, true)).build().optimized().nodes().size());
+}
+
+TEST(BeehiveTest, SharedTest)
+{
+    using namespace beehive;
+
+    struct Agent
+    {
+        int cell;
+        int acted;
+    };
+    int looks = 0;
+    auto const look = [&looks](Agent &agent) {
+        ++looks;
+        if (agent.cell == 3) {
+            return Status::RUNNING;
+        }
+        return agent.cell == 1 ? Status::SUCCESS : Status::FAILURE;
+    };
+    auto const tree = Builder<Agent>{}
+        .sequence()
+            .shared()
+                .leaf(look)
+            .end()
+            .void_leaf([](Agent &agent) { ++agent.acted; })
+        .end()
+        .build();
+    auto const cell = [](Agent const &agent) { return agent.cell; };
+
+    std::vector<Agent> agents{{1, 0}, {2, 0}, {1, 0}, {3, 0}, {1, 0}, {3, 0}};
+    std::vector<TreeState> states;
+    for (size_t i = 0; i < agents.size(); ++i) {
+        states.push_back(tree.make_state());
+    }
+    std::vector<Status> statuses(agents.size());
+
+    // Each cell is looked at once, except that RUNNING is never shared.
+    tree.process_batch_shared(states, agents, statuses, cell);
+    EXPECT_EQ(4, looks);
+    std::vector<Status> const expected{
+        Status::SUCCESS, Status::FAILURE, Status::SUCCESS, Status::RUNNING, Status::SUCCESS, Status::RUNNING
+    };
+    EXPECT_EQ(expected, statuses);
+    for (auto const &agent : agents) {
+        EXPECT_EQ(agent.cell == 1 ? 1 : 0, agent.acted);
+    }
+
+    // Results last for one call only, and other calls don't share them.
+    tree.process_batch_shared(states, agents, statuses, cell);
+    EXPECT_EQ(8, looks);
+    tree.process_batch(states, agents, statuses);
+    EXPECT_EQ(14, looks);
+    EXPECT_EQ(Status::SUCCESS, tree.process(agents[0]));
+    EXPECT_EQ(15, looks);
+
+    // Pools share as well, and so do loaded trees.
+    FunctionTable<Agent> table;
+    table.add_leaf("look", look);
+    auto const registered = Builder<Agent>{}
+        .shared()
+            .leaf(table, "look")
+        .end()
+        .build();
+    auto const loaded = table.deserialize(table.serialize(registered));
+    auto pool = loaded.make_state_pool(agents.size());
+    looks = 0;
+    loaded.process_batch_shared(pool, agents, statuses, cell);
+    EXPECT_EQ(4, looks);
+    EXPECT_EQ(Status::FAILURE, statuses[1]);
+}
+
+TEST(BeehiveTest, TraceTest)
+{
+    using namespace beehive;
+
+    auto const tree = Builder<int>{}
+        .sequence()
+            .leaf([](int &ticks) { return ticks-- > 0 ? Status::RUNNING : Status::SUCCESS; })
+            .void_leaf([](int &) {})
+        .end()
+        .build();
+    auto const traced = tree.instrumented(Tracer{});
+    auto const leaf = tree.nodes().size() - 2;
+
+    // Only entities given a buffer are recorded, node by node as they return.
+    TraceBuffer buffer{6};
+    EXPECT_EQ(8, buffer.capacity());
+    auto state = tree.make_state();
+    auto untraced = tree.make_state();
+    state.trace(&buffer);
+    auto ticks = 1;
+    EXPECT_EQ(Status::RUNNING, traced.process(state, ticks));
+    EXPECT_EQ(Status::SUCCESS, traced.process(state, ticks));
+    EXPECT_EQ(Status::SUCCESS, traced.process(untraced, ticks));
+    std::vector<TraceEvent> events(16);
+    events.resize(buffer.drain(events));
+    auto const per_tick = tree.nodes().size();
+    ASSERT_EQ(2 * per_tick - 1, events.size());
+    EXPECT_EQ(1, events[0].tick);
+    EXPECT_EQ(leaf, events[0].node);
+    EXPECT_EQ(Status::RUNNING, events[0].status);
+    EXPECT_EQ(2, events.back().tick);
+    EXPECT_EQ(0, events.back().node);
+    EXPECT_EQ(Status::SUCCESS, events.back().status);
+    EXPECT_EQ(0, buffer.drain(events));
+
+    // Traces survive encoding, chunk by chunk.
+    std::vector<unsigned char> bytes;
+    encode_trace(Span<TraceEvent const>(events.data(), 2), bytes);
+    encode_trace(Span<TraceEvent const>(events.data() + 2, events.size() - 2), bytes);
+    std::vector<TraceEvent> decoded;
+    auto const first = decode_trace(bytes.data(), bytes.size(), decoded);
+    EXPECT_EQ(bytes.size(), first + decode_trace(bytes.data() + first, bytes.size() - first, decoded));
+    ASSERT_EQ(events.size(), decoded.size());
+    for (size_t i = 0; i < events.size(); ++i) {
+        EXPECT_EQ(events[i].tick, decoded[i].tick);
+        EXPECT_EQ(events[i].node, decoded[i].node);
+        EXPECT_EQ(events[i].status, decoded[i].status);
+    }
+    EXPECT_THROW(decode_trace(bytes.data(), first - 1, decoded), std::runtime_error);
+    EXPECT_THROW(decode_trace(bytes.data() + 1, bytes.size() - 1, decoded), std::runtime_error);
+
+    // The dump shows each tick's path through the tree.
+    std::ostringstream out;
+    dump_trace(out, tree, events);
+    auto const dump = out.str();
+    EXPECT_NE(std::string::npos, dump.find("tick 1\n"));
+    EXPECT_NE(std::string::npos, dump.find("tick 2\n"));
+    EXPECT_NE(std::string::npos, dump.find("running    sequence\n"));
+    EXPECT_NE(std::string::npos, dump.find("success      leaf\n"));
+    EXPECT_EQ(2 + 2 * per_tick - 1, std::count(dump.begin(), dump.end(), '\n'));
+
+    // A full buffer drops new events, even while another thread drains it.
+    TraceBuffer small{2};
+    state.trace(&small);
+    ticks = 0;
+    EXPECT_EQ(Status::SUCCESS, traced.process(state, ticks));
+    EXPECT_EQ(per_tick - 2, small.dropped());
+    std::vector<TraceEvent> drained;
+    std::atomic<bool> done{false};
+    std::thread ticker{[&] {
+        auto count = 0;
+        for (int i = 0; i < 1000; ++i) {
+            traced.process(state, count);
+        }
+        done = true;
+    }};
+    for (auto finished = false; !finished;) {
+        finished = done;
+        std::array<TraceEvent, 2> chunk;
+        drained.insert(drained.end(), chunk.begin(), chunk.begin() + small.drain(chunk));
+    }
+    ticker.join();
+    EXPECT_EQ(1001 * per_tick, drained.size() + small.dropped());
+    EXPECT_TRUE(std::is_sorted(drained.begin(), drained.end(), [](TraceEvent const &a, TraceEvent const &b) {
+        return a.tick < b.tick;
+    }));
+
+    // Migrated and reloaded states keep recording.
+    auto const changed = Builder<int>{}
+        .sequence()
+            .leaf([](int &ticks) { return ticks-- > 0 ? Status::RUNNING : Status::SUCCESS; })
+        .end()
+        .build();
+    TraceBuffer kept{64};
+    state = tree.make_state();
+    state.trace(&kept);
+    ticks = 2;
+    EXPECT_EQ(Status::RUNNING, traced.process(state, ticks));
+    changed.migration_from(tree).migrate(state);
+    EXPECT_EQ(Status::RUNNING, changed.instrumented(Tracer{}).process(state, ticks));
+    events.resize(kept.capacity());
+    events.resize(kept.drain(events));
+    ASSERT_EQ(per_tick - 1 + changed.nodes().size(), events.size());
+    EXPECT_EQ(2, events.back().tick);
+    TreeHandle<int> handle{changed};
+    handle.reload(tree);
+    handle.reload(tree.optimized());
+    handle.read().update(state); // from two trees back, so it starts over
+    EXPECT_EQ(0, state.resume_index);
+    EXPECT_EQ(Status::SUCCESS, handle.read()->instrumented(Tracer{}).process(state, ticks));
+    EXPECT_EQ(handle.read()->nodes().size(), kept.drain(events));
+}
+
+TEST(BeehiveTest, AnyContextTest)
+{
+    using namespace beehive;
+
+    struct Zombie
+    {
+        bool is_hungry() const { return hunger > 0; }
+        int hunger;
+        int eaten;
+    };
+    struct Human
+    {
+        int fled;
+    };
+
+    // Trees for different agent types are all Tree<AnyContext>.
+    auto const zombies = TypedTree<Zombie>{Builder<AnyContext>{}
+        .sequence()
+            .leaf(typed<Zombie>(&Zombie::is_hungry))
+            .void_leaf(typed<Zombie>([](Zombie &zombie) {
+                --zombie.hunger;
+                ++zombie.eaten;
+            }))
+        .end()
+        .build()};
+    FunctionTable<AnyContext> table;
+    table.add_leaf("flee", typed<Human>([](Human &human) {
+        return ++human.fled < 2 ? Status::RUNNING : Status::SUCCESS;
+    }));
+    auto const humans = TypedTree<Human>{table.deserialize(table.serialize(Builder<AnyContext>{}
+        .leaf(table, "flee")
+        .build()))};
+
+    Zombie zombie{1, 0};
+    EXPECT_EQ(Status::SUCCESS, zombies.process(zombie));
+    EXPECT_EQ(Status::FAILURE, zombies.process(zombie));
+    EXPECT_EQ(1, zombie.eaten);
+
+    std::vector<Human> people(3);
+    std::vector<TreeState> states;
+    for (size_t i = 0; i < people.size(); ++i) {
+        states.push_back(humans.make_state());
+    }
+    std::vector<Status> statuses(people.size());
+    humans.process_batch(states, people, statuses);
+    EXPECT_EQ(std::vector<Status>(3, Status::RUNNING), statuses);
+    humans.process_batch(states, people, statuses);
+    EXPECT_EQ(std::vector<Status>(3, Status::SUCCESS), statuses);
+    auto pool = humans.make_state_pool(1);
+    humans.process_batch(pool, Span<Human>(people.data(), 1), Span<Status>(statuses.data(), 1));
+    EXPECT_EQ(Status::SUCCESS, statuses[0]);
+    EXPECT_EQ(3, people[0].fled);
+
+    // The reference remembers the type it was made from.
+    AnyContext any{zombie};
+    EXPECT_TRUE(any.is<Zombie>());
+    EXPECT_FALSE(any.is<Human>());
+    EXPECT_EQ(&zombie, &any.get<Zombie>());
+}
+
+TEST(BeehiveTest, AsyncTest)
+{
+    using namespace beehive;
+
+    struct Agent
+    {
+        int starts;
+        int arrived;
+    };
+    AsyncQueue queue;
+    std::vector<AsyncCallback> pending;
+    auto const tree = Builder<Agent>{}
+        .sequence()
+            .async_leaf(queue, [&pending](Agent &agent, AsyncCallback done) {
+                ++agent.starts;
+                pending.push_back(std::move(done));
+            })
+            .void_leaf([](Agent &agent) { ++agent.arrived; })
+        .end()
+        .build();
+
+    // The operation starts once, and the entity is parked until it finishes.
+    std::vector<Agent> agents(3);
+    std::vector<TreeState> states;
+    for (size_t i = 0; i < agents.size(); ++i) {
+        states.push_back(tree.make_state());
+    }
+    std::vector<Status> statuses(agents.size());
+    tree.process_batch(states, agents, statuses, queue);
+    EXPECT_EQ(std::vector<Status>(3, Status::RUNNING), statuses);
+    ASSERT_EQ(3, pending.size());
+    for (auto const &state : states) {
+        EXPECT_TRUE(state.parked());
+    }
+    tree.process_batch(states, agents, statuses, queue);
+    EXPECT_EQ(3, pending.size());
+
+    // Results may come from any thread, and are handed over by the next batch.
+    std::thread finisher{[&pending] {
+        pending[0](true);
+        pending[1](Status::FAILURE);
+    }};
+    finisher.join();
+    pending[0](false); // only the first call counts
+    EXPECT_TRUE(states[0].parked());
+    tree.process_batch(states, agents, statuses, queue);
+    EXPECT_EQ((std::vector<Status>{Status::SUCCESS, Status::FAILURE, Status::RUNNING}), statuses);
+    EXPECT_EQ(1, agents[0].arrived);
+    EXPECT_EQ(0, agents[1].arrived);
+    EXPECT_TRUE(states[2].parked());
+    EXPECT_FALSE(states[0].parked());
+
+    // Ticking a parked entity directly keeps it waiting. Dropping every copy of
+    // the callback fails the operation.
+    EXPECT_EQ(Status::RUNNING, tree.process(states[2], agents[2]));
+    EXPECT_EQ(1, agents[2].starts);
+    pending.clear();
+    EXPECT_EQ(1, queue.drain());
+    EXPECT_FALSE(states[2].parked());
+    EXPECT_EQ(Status::FAILURE, tree.process(states[2], agents[2]));
+
+    // An operation the tree moves away from is started anew, and its late
+    // result is dropped.
+    using Clock = std::chrono::steady_clock;
+    static Clock::time_point now{};
+    auto const timed = Builder<Agent>{}
+        .timeout(std::chrono::seconds{5}, [] { return now; })
+            .async_leaf(queue, [&pending](Agent &agent, AsyncCallback done) {
+                ++agent.starts;
+                pending.push_back(std::move(done));
+            })
+        .end()
+        .build();
+    Agent agent{};
+    auto state = timed.make_state();
+    EXPECT_EQ(Status::RUNNING, timed.process(state, agent));
+    auto late = pending.back();
+    now += std::chrono::seconds{10};
+    EXPECT_EQ(Status::FAILURE, timed.process(state, agent));
+    EXPECT_EQ(Status::RUNNING, timed.process(state, agent));
+    EXPECT_EQ(2, agent.starts);
+    late(true);
+    EXPECT_EQ(0, queue.drain());
+    EXPECT_TRUE(state.parked());
+    pending.back()(true);
+    EXPECT_EQ(1, queue.drain());
+    EXPECT_EQ(Status::SUCCESS, timed.process(state, agent));
+
+    // A restored state starts its operation over, even when decoded into a
+    // state that was waiting itself.
+    std::vector<TreeState> waiting{timed.make_state()};
+    Agent restored{};
+    EXPECT_EQ(Status::RUNNING, timed.process(waiting[0], restored));
+    EXPECT_TRUE(waiting[0].parked());
+    std::vector<unsigned char> bytes;
+    timed.encode_states(waiting, bytes);
+    timed.decode_states(bytes.data(), bytes.size(), waiting);
+    EXPECT_FALSE(waiting[0].parked());
+    EXPECT_EQ(Status::RUNNING, timed.process(waiting[0], restored));
+    EXPECT_EQ(2, restored.starts);
+
+    // So does a migrated state, and the result it was waiting for is dropped.
+    auto const reloaded = Builder<Agent>{}
+        .timeout(std::chrono::seconds{5}, [] { return now; })
+            .async_leaf(queue, [&pending](Agent &agent, AsyncCallback done) {
+                agent.starts += 10;
+                pending.push_back(std::move(done));
+            })
+        .end()
+        .build();
+    Agent migrated{};
+    auto migrated_state = timed.make_state();
+    EXPECT_EQ(Status::RUNNING, timed.process(migrated_state, migrated));
+    auto abandoned = pending.back();
+    reloaded.migration_from(timed).migrate(migrated_state);
+    EXPECT_FALSE(migrated_state.parked());
+    EXPECT_EQ(Status::RUNNING, reloaded.process(migrated_state, migrated));
+    EXPECT_EQ(11, migrated.starts);
+    abandoned(true);
+    queue.drain();
+    EXPECT_TRUE(migrated_state.parked());
+    EXPECT_EQ(Status::RUNNING, reloaded.process(migrated_state, migrated));
+    EXPECT_EQ(11, migrated.starts);
+
+    // Without a state there is nowhere to wait.
+    EXPECT_EQ(Status::FAILURE, tree.process(agent));
+}
+
+TEST(BeehiveTest, MemoryUsageTest)
+{
+    using namespace beehive;
+
+    struct Agent {};
+
+    auto const tree = Builder<Agent>{}
+        .sequence()
+            .parallel(2, 1)
+                .leaf([](Agent &) { return Status::SUCCESS; })
+                .leaf([](Agent &) { return Status::RUNNING; })
+            .end()
+            .repeat(3)
+                .void_leaf([](Agent &) {})
+            .end()
+        .end()
+        .build();
+    auto const usage = tree.memory_usage();
+    EXPECT_EQ(tree.nodes().size(), usage.node_count);
+    EXPECT_EQ(tree.nodes().capacity() * sizeof(Node<Agent>), usage.nodes);
+    EXPECT_LE(sizeof(Node<Agent>), 32u); // what walking the tree reads, apart from the callables
+    EXPECT_GE(usage.bodies, tree.nodes().size() * sizeof(Node<Agent>::ProcessFunction));
+    EXPECT_EQ(0, usage.callables); // everything fits inline
+    EXPECT_EQ(tree.make_state().memory_usage(), usage.state);
+    EXPECT_EQ(tree.make_state_pool().bytes_per_entity(), usage.pooled_state);
+    EXPECT_GE(usage.state, sizeof(TreeState));
+
+    // Running states keep the paths of parallel children too.
+    auto state = tree.make_state();
+    Agent agent{};
+    EXPECT_EQ(Status::RUNNING, tree.process(state, agent));
+    EXPECT_GE(state.memory_usage(), usage.state);
+
+    // Copies run their own bodies, so they outlive the tree they came from.
+    auto copy = tree;
+    {
+        auto moved = Tree<Agent>{tree};
+        copy = std::move(moved);
+    }
+    EXPECT_EQ(Status::RUNNING, copy.process(agent));
+
+    // Only targets that didn't fit inline take heap memory.
+    std::array<int, 16> big{};
+    InlineFunction<int(), sizeof(void *), true> heap = [big]() {
+        return big[0];
+    };
+    InlineFunction<int(), sizeof(void *), true> small = []() {
+        return 0;
+    };
+    EXPECT_EQ(sizeof(big), heap.heap_size());
+    EXPECT_EQ(0, small.heap_size());
+    EXPECT_EQ(0, InlineFunction<int()>{}.heap_size());
+
+    // Instrumented trees keep a copy of every node's callable.
+    auto const instrumented = tree.instrumented<Profiler>();
+    EXPECT_EQ(
+        instrumented.nodes().size() * sizeof(Node<Agent>::ProcessFunction),
+        instrumented.memory_usage().callables
+    );
+}
+
+#if BEEHIVE_COROUTINES
+TEST(BeehiveTest, ActionTest)
+{
+    using namespace beehive;
+
+    struct Context
+    {
+        bool interrupted;
+        int steps;
+        int started;
+        int destroyed;
+    };
+
+    struct Guard
+    {
+        ~Guard() { ++context.destroyed; }
+        Context &context;
+    };
+
+    auto walk = [](Context &context) -> Action {
+        ++context.started;
+        Guard guard{context};
+        for (int step = 0; step < 3; ++step) {
+            ++context.steps;
+            co_await next_tick;
+        }
+        co_return context.steps % 2 == 1;
+    };
+
+    FramePool frames;
+    auto tree = Builder<Context>{}
+        .sequence()
+            .decorator([](Context &context, Node<Context> const &child, TreeState &state) {
+                return context.interrupted ? Status::FAILURE : child.process(context, state);
+            })
+                .action(walk, &frames)
+            .end()
+        .end()
+        .build();
+
+    // The coroutine continues where it left off.
+    auto state = tree.make_state();
+    Context context{};
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(3, context.steps);
+    EXPECT_EQ(0, context.destroyed);
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, context));
+    EXPECT_EQ(1, context.started);
+    EXPECT_EQ(1, context.destroyed);
+
+    // Frames are recycled.
+    auto const bytes = frames.bytes_allocated();
+    EXPECT_GT(bytes, 0);
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(bytes, frames.bytes_allocated());
+
+    // An abandoned coroutine is destroyed when the leaf starts over.
+    context.interrupted = true;
+    EXPECT_EQ(Status::FAILURE, tree.process(state, context));
+    context.interrupted = false;
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(3, context.started);
+    EXPECT_EQ(2, context.destroyed);
+
+    // A copied state starts over; the original keeps going.
+    auto copy = state;
+    EXPECT_EQ(Status::RUNNING, tree.process(copy, context));
+    EXPECT_EQ(4, context.started);
+    context.steps = 0;
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(Status::RUNNING, tree.process(state, context));
+    EXPECT_EQ(Status::FAILURE, tree.process(state, context));
+    EXPECT_EQ(3, context.destroyed);
+
+    // Destroying a state destroys its coroutines.
+    {
+        auto const moved = std::move(copy);
+    }
+    EXPECT_EQ(4, context.destroyed);
+
+    // Without a state, every tick starts over.
+    EXPECT_EQ(Status::RUNNING, tree.process(context));
+    EXPECT_EQ(Status::RUNNING, tree.process(context));
+    EXPECT_EQ(6, context.started);
+    EXPECT_EQ(6, context.destroyed);
+
+    // Exceptions reach the caller.
+    auto const failing = Builder<Context>{}
+        .action([](Context &) -> Action {
+            throw std::runtime_error{"failed"};
+            co_return true;
+        })
+        .build();
+    auto failing_state = failing.make_state();
+    EXPECT_THROW(failing.process(failing_state, context), std::runtime_error);
+}
+#endif
+
+TEST(BeehiveTest, StaticTreeTest)
+{
+    using namespace beehive::static_tree;
+    using beehive::Status;
+
+    auto zombie_tree = make_tree<ZombieState>(
+        sequence(
+            leaf([](ZombieState &zombie) -> Status {
+                return zombie.is_hungry ? Status::SUCCESS : Status::FAILURE;
+            }),
+            leaf(&ZombieState::has_food),
+            inverter(leaf(EnemiesAroundChecker{})),
+            void_leaf(&ZombieState::eat_food)
+        )
+    );
+    ZombieState zombie;
+    EXPECT_EQ(Status::SUCCESS, zombie_tree.process(zombie));
+    zombie._has_food = false;
+    EXPECT_EQ(Status::FAILURE, zombie_tree.process(zombie));
+
+    using VisitCountArray = std::array<int, 5>;
+    auto visit = [](size_t i, Status status) {
+        return [i, status](VisitCountArray &visited) {
+            ++visited[i];
+            return status;
+        };
+    };
+    auto visit_running_once = [](size_t i) {
+        return [i](VisitCountArray &visited) {
+            return ++visited[i] > 1 ? Status::SUCCESS : Status::RUNNING;
+        };
+    };
+
+    // RUNNING two composites deep resumes at the running leaf, then carries on
+    // through the outer sequence.
+    auto tree = make_tree<VisitCountArray>(
+        sequence(
+            leaf(visit(0, Status::SUCCESS)),
+            selector(
+                leaf(visit(1, Status::FAILURE)),
+                sequence(
+                    leaf(visit(2, Status::SUCCESS)),
+                    leaf(visit_running_once(3))
+                )
+            ),
+            leaf(visit(4, Status::SUCCESS))
+        )
+    );
+    EXPECT_EQ(3, decltype(tree)::State{}.size());
+
+    auto state = tree.make_state();
+    VisitCountArray visited{};
+    EXPECT_EQ(Status::RUNNING, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 1, 1, 1, 0}), visited);
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{1, 1, 1, 2, 1}), visited);
+
+    // Finished trees start over from the top.
+    EXPECT_EQ(Status::SUCCESS, tree.process(state, visited));
+    EXPECT_EQ((VisitCountArray{2, 2, 2, 3, 2}), visited);
+
+    // A RUNNING child swallowed by a succeeder is not resumed later.
+    auto succeeder_tree = make_tree<VisitCountArray>(
+        sequence(
+            succeeder(sequence(leaf(visit(0, Status::SUCCESS)), leaf(visit_running_once(1)))),
+            leaf(visit_running_once(2))
+        )
+    );
+    auto succeeder_state = succeeder_tree.make_state();
+    visited = {};
+    EXPECT_EQ(Status::RUNNING, succeeder_tree.process(succeeder_state, visited));
+    EXPECT_EQ(Status::SUCCESS, succeeder_tree.process(succeeder_state, visited));
+    EXPECT_EQ((VisitCountArray{1, 1, 2, 0, 0}), visited);
+    EXPECT_EQ(Status::SUCCESS, succeeder_tree.process(succeeder_state, visited));
+    EXPECT_EQ((VisitCountArray{2, 2, 3, 0, 0}), visited);
+
+    // Custom decorators get the context and a function processing the child.
+    auto decorated = make_tree<int>(
+        decorator(
+            [](int &x, auto const &process_child) {
+                x *= 10;
+                return process_child();
+            },
+            leaf([](int &x) { return ++x == 11; })
+        )
+    );
+    int x = 1;
+    EXPECT_EQ(Status::SUCCESS, decorated.process(x));
+    EXPECT_EQ(11, x);
+}